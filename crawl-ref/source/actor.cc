@@ -8,6 +8,7 @@
 #include "areas.h"
 #include "art-enum.h"
 #include "attack.h"
+#include "beam.h"
 #include "chardump.h"
 #include "directn.h"
 #include "env.h"
@@ -19,6 +20,7 @@
 #include "message.h"
 #include "mon-behv.h"
 #include "mon-death.h"
+#include "mon-pathfind.h"
 #include "religion.h"
 #include "stepdown.h"
 #include "stringutil.h"
@@ -134,6 +136,10 @@ void actor::set_position(const coord_def &c)
     position = c;
     los_actor_moved(this, oldpos);
     areas_actor_moved(this, oldpos);
+    invalidate_tracer_cache();
+    // Stationary monsters block pathfinding.
+    if (is_monster() && as_monster()->is_stationary())
+        invalidate_pathfind_fields();
 }
 
 bool actor::can_hibernate(bool holi_only, bool intrinsic_only) const
@@ -214,7 +214,9 @@ LOCAL_SRC_FILES := $(SDL_PATH)/src/main/android/SDL_android_main.c \
     $(CRAWL_PATH)/random-var.cc \
     $(CRAWL_PATH)/ranged-attack.cc \
     $(CRAWL_PATH)/ray.cc \
+    $(CRAWL_PATH)/ray-exact.cc \
     $(CRAWL_PATH)/rot.cc \
+    $(CRAWL_PATH)/savecheck.cc \
     $(CRAWL_PATH)/religion.cc \
     $(CRAWL_PATH)/shopping.cc \
     $(CRAWL_PATH)/shout.cc \
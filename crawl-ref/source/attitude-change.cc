@@ -10,6 +10,7 @@
 #include <sstream>
 
 #include "act-iter.h"
+#include "beam.h"
 #include "branch.h"
 #include "coordit.h"
 #include "database.h"
@@ -30,6 +31,8 @@
 // temporarily.
 void mons_att_changed(monster* mon)
 {
+    invalidate_tracer_cache();
+
     const mon_attitude_type att = mon->temp_attitude();
     const monster_type mc = mons_base_type(*mon);
 
@@ -2492,6 +2492,184 @@ int silver_damages_victim(actor* victim, int damage, string &dmg_msg)
     return ret;
 }
 
+// Monsters fire the same tracers over and over: while choosing a spell, again
+// when announcing it, and on every turn that the situation stays the same.
+// Within a turn, and as long as nothing a tracer could notice has changed,
+// the results of an earlier identical tracer are reused.
+//
+// Anything that can change what a tracer hits (an actor moving, appearing or
+// dying, a monster's enchantments, equipment, hit dice or attitude changing,
+// or the terrain changing) calls invalidate_tracer_cache().
+
+// The inputs of a monster tracer, after fire_tracer() has filled in its own.
+struct tracer_key
+{
+    mid_t source_id;
+    coord_def source, target;
+    int range;
+    beam_type flavour, real_flavour;
+    spell_type origin_spell;
+    const item_def *item;
+    int damage_num, damage_size, ench_power, hit;
+    killer_type thrower;
+    int ex_size;
+    string name;
+    bool pierce, is_explosion, aimed_at_spot, aimed_at_feet, affects_nothing;
+    bool is_targeting, passed_target, was_missile, beam_cancelled;
+    bool seen, heard, obvious_effect, msg_generated;
+    ac_type ac_rule;
+    mon_attitude_type attitude;
+    int foe_ratio;
+    bool explode_only, explosion_hole;
+
+    tracer_key(const bolt &b, bool explode, bool hole)
+        : source_id(b.source_id), source(b.source), target(b.target),
+          range(b.range), flavour(b.flavour), real_flavour(b.real_flavour),
+          origin_spell(b.origin_spell), item(b.item),
+          damage_num(b.damage.num), damage_size(b.damage.size),
+          ench_power(b.ench_power), hit(b.hit), thrower(b.thrower),
+          ex_size(b.ex_size), name(b.name), pierce(b.pierce),
+          is_explosion(b.is_explosion), aimed_at_spot(b.aimed_at_spot),
+          aimed_at_feet(b.aimed_at_feet), affects_nothing(b.affects_nothing),
+          is_targeting(b.is_targeting), passed_target(b.passed_target),
+          was_missile(b.was_missile), beam_cancelled(b.beam_cancelled),
+          seen(b.seen), heard(b.heard), obvious_effect(b.obvious_effect),
+          msg_generated(b.msg_generated), ac_rule(b.ac_rule),
+          attitude(b.attitude), foe_ratio(b.foe_ratio),
+          explode_only(explode), explosion_hole(hole)
+    {
+    }
+
+    bool operator==(const tracer_key &o) const
+    {
+        return source_id == o.source_id && source == o.source
+               && target == o.target && range == o.range
+               && flavour == o.flavour && real_flavour == o.real_flavour
+               && origin_spell == o.origin_spell && item == o.item
+               && damage_num == o.damage_num
+               && damage_size == o.damage_size
+               && ench_power == o.ench_power && hit == o.hit
+               && thrower == o.thrower && ex_size == o.ex_size
+               && pierce == o.pierce && is_explosion == o.is_explosion
+               && aimed_at_spot == o.aimed_at_spot
+               && aimed_at_feet == o.aimed_at_feet
+               && affects_nothing == o.affects_nothing
+               && is_targeting == o.is_targeting
+               && passed_target == o.passed_target
+               && was_missile == o.was_missile
+               && beam_cancelled == o.beam_cancelled
+               && seen == o.seen && heard == o.heard
+               && obvious_effect == o.obvious_effect
+               && msg_generated == o.msg_generated
+               && ac_rule == o.ac_rule && attitude == o.attitude
+               && foe_ratio == o.foe_ratio
+               && explode_only == o.explode_only
+               && explosion_hole == o.explosion_hole
+               && name == o.name;
+    }
+};
+
+struct tracer_cache_entry
+{
+    tracer_key key;
+    bolt result;
+};
+
+// Entries are only good for as long as all of these stay the same.
+struct tracer_cache_stamp
+{
+    turn_cache_stamp turn;
+    int player_xl = 0;
+
+    bool operator==(const tracer_cache_stamp &o) const
+    {
+        return turn == o.turn && player_xl == o.player_xl;
+    }
+};
+
+// Enough for every caster in a big fight to remember its recent tracers.
+static const size_t TRACER_CACHE_SIZE = 64;
+
+static vector<tracer_cache_entry> tracer_cache;
+static size_t tracer_cache_next = 0;
+static tracer_cache_stamp tracer_stamp;
+static unsigned int tracer_world_generation = 0;
+static tracer_cache_stats tracer_stats;
+
+void invalidate_tracer_cache()
+{
+    tracer_world_generation++;
+}
+
+const tracer_cache_stats& get_tracer_cache_stats()
+{
+    return tracer_stats;
+}
+
+void reset_tracer_cache_stats()
+{
+    tracer_stats = tracer_cache_stats();
+}
+
+static tracer_cache_stamp _current_tracer_stamp()
+{
+    tracer_cache_stamp stamp;
+    stamp.turn = turn_cache_stamp::current(tracer_world_generation);
+    stamp.player_xl = you.experience_level;
+    return stamp;
+}
+
+// Tracers that use the RNG, or whose results are more than what is copied
+// by _copy_tracer_results(), are always fired.
+static bool _tracer_cacheable(const bolt &pbolt)
+{
+    return !pbolt.special_explosion
+           && !pbolt.chose_ray
+           // fuzz_invis_tracer()
+           && !you.invisible()
+           // Flavours that fake_flavour() rolls, and tunnelling power, are
+           // rolled when firing.
+           && pbolt.real_flavour != BEAM_RANDOM
+           && pbolt.real_flavour != BEAM_CHAOS
+           && pbolt.real_flavour != BEAM_CHAOS_ENCHANTMENT
+           && pbolt.real_flavour != BEAM_CRYSTAL_SPEAR
+           && pbolt.real_flavour != BEAM_ELDRITCH
+           && pbolt.real_flavour != BEAM_CHAOTIC
+           && pbolt.real_flavour != BEAM_CHAOTIC_DEVASTATION
+           && pbolt.real_flavour != BEAM_CRYSTAL
+           && pbolt.flavour != BEAM_DIGGING
+           // Sets is_explosion depending on who it hits.
+           && pbolt.flavour != BEAM_UNRAVELLING;
+}
+
+// What is left changed in a bolt once a tracer has been fired from it.
+static void _copy_tracer_results(bolt &to, const bolt &from)
+{
+    to.foe_info           = from.foe_info;
+    to.friend_info        = from.friend_info;
+    to.path_taken         = from.path_taken;
+    to.hit_count          = from.hit_count;
+    to.range              = from.range;
+    to.flavour            = from.flavour;
+    to.extra_range_used   = from.extra_range_used;
+    to.aimed_at_feet      = from.aimed_at_feet;
+    to.aimed_at_spot      = from.aimed_at_spot;
+    to.auto_hit           = from.auto_hit;
+    to.use_target_as_pos  = from.use_target_as_pos;
+    to.in_explosion_phase = from.in_explosion_phase;
+    to.passed_target      = from.passed_target;
+    to.seen               = from.seen;
+    to.heard              = from.heard;
+    to.obvious_effect     = from.obvious_effect;
+    to.msg_generated      = from.msg_generated;
+    to.noise_generated    = from.noise_generated;
+    to.beam_cancelled     = from.beam_cancelled;
+    to.reflections        = from.reflections;
+    to.reflector          = from.reflector;
+    to.bounces            = from.bounces;
+    to.bounce_pos         = from.bounce_pos;
+}
+
 //  Used by monsters in "planning" which spell to cast. Fires off a "tracer"
 //  which tells the monster what it'll hit if it breathes/casts etc.
 //
@@ -2536,6 +2714,33 @@ void fire_tracer(const monster* mons, bolt &pbolt, bool explode_only,
 
     pbolt.in_explosion_phase = false;
 
+    const tracer_key key(pbolt, explode_only, explosion_hole);
+    const bool cacheable = _tracer_cacheable(pbolt);
+    if (!cacheable)
+        tracer_stats.uncacheable++;
+    else
+    {
+        const tracer_cache_stamp stamp = _current_tracer_stamp();
+        if (!(stamp == tracer_stamp))
+        {
+            tracer_cache.clear();
+            tracer_cache_next = 0;
+            tracer_stamp = stamp;
+        }
+
+        for (const tracer_cache_entry &entry : tracer_cache)
+        {
+            if (entry.key == key)
+            {
+                tracer_stats.hits++;
+                _copy_tracer_results(pbolt, entry.result);
+                pbolt.is_tracer = false;
+                return;
+            }
+        }
+        tracer_stats.misses++;
+    }
+
     // Fire!
     if (explode_only)
         pbolt.explode(false, explosion_hole);
@@ -2544,6 +2749,18 @@ void fire_tracer(const monster* mons, bolt &pbolt, bool explode_only,
 
     // Unset tracer flag (convenience).
     pbolt.is_tracer = false;
+
+    // Firing the tracer shouldn't have changed anything, but be sure.
+    if (cacheable && _current_tracer_stamp() == tracer_stamp)
+    {
+        tracer_cache_entry entry = { key, pbolt };
+        // Once full, replace the oldest entry.
+        if (tracer_cache.size() < TRACER_CACHE_SIZE)
+            tracer_cache.push_back(move(entry));
+        else
+            tracer_cache[tracer_cache_next] = move(entry);
+        tracer_cache_next = (tracer_cache_next + 1) % TRACER_CACHE_SIZE;
+    }
 }
 
 static coord_def _random_point_hittable_from(const coord_def &c,
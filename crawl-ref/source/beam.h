@@ -325,6 +325,20 @@ bool curare_actor(actor* source, actor* target, int levels, string name,
 int silver_damages_victim(actor* victim, int damage, string &dmg_msg);
 void fire_tracer(const monster* mons, bolt &pbolt,
                   bool explode_only = false, bool explosion_hole = false);
+
+// Counters for the cache of monster tracer results in fire_tracer().
+struct tracer_cache_stats
+{
+    uint64_t hits = 0;
+    uint64_t misses = 0;
+    // Tracers that are never cached, e.g. because they use the RNG.
+    uint64_t uncacheable = 0;
+};
+
+// Call when something a tracer could notice has changed.
+void invalidate_tracer_cache();
+const tracer_cache_stats& get_tracer_cache_stats();
+void reset_tracer_cache_stats();
 bool imb_can_splash(coord_def origin, coord_def center,
                     vector<coord_def> path_taken, coord_def target);
 spret zapping(zap_type ztype, int power, bolt &pbolt,
@@ -0,0 +1,93 @@
+#include "catch.hpp"
+
+#include "AppHdr.h"
+#include "los.h"
+#include "losparam.h"
+#include "ray-exact.h"
+
+// Nothing blocks, so find_ray() will cycle through every ray to a target.
+class opacity_none : public opacity_func
+{
+public:
+    CLONE(opacity_none)
+    opacity_type operator()(const coord_def&) const override
+    {
+        return OPC_CLEAR;
+    }
+};
+static const opacity_none opc_none;
+
+static const coord_def origin(GXM / 2, GYM / 2);
+
+// A scattering of walls to bounce off, different for each seed.
+static bool _solid(const coord_def &c, int seed)
+{
+    if (c == origin || !seed)
+        return false;
+    const uint32_t h = (c.x * 73856093u) ^ (c.y * 19349663u)
+                       ^ (seed * 83492791u);
+    return h % 5 == 0;
+}
+
+// Move both rays along like bolt::fire() does, bouncing as in
+// bolt::bounce(), and check that they stay in the same cells.
+static void _follow(ray_def ray, exact_ray exact, int seed)
+{
+    for (int step = 0; step < 3 * LOS_RADIUS; ++step)
+    {
+        CAPTURE(step);
+        REQUIRE(exact.advance() == ray.advance());
+        REQUIRE(exact.pos() == ray.pos());
+        if (!_solid(ray.pos(), seed))
+            continue;
+
+        do
+        {
+            ray.regress();
+            exact.regress();
+            REQUIRE(exact.pos() == ray.pos());
+        }
+        while (_solid(ray.pos(), seed));
+
+        reflect_grid rg;
+        for (int x = -1; x <= 1; ++x)
+            for (int y = -1; y <= 1; ++y)
+                rg(coord_def(x, y)) = _solid(ray.pos() + coord_def(x, y), seed);
+        ray.bounce(rg);
+        exact.bounce(rg);
+        REQUIRE(exact.pos() == ray.pos());
+        REQUIRE(exact.on_corner == ray.on_corner);
+    }
+}
+
+TEST_CASE( "exact_ray visits the same cells as ray_def", "[single-file]" ) {
+    for (int x = -LOS_RADIUS; x <= LOS_RADIUS; ++x)
+        for (int y = -LOS_RADIUS; y <= LOS_RADIUS; ++y)
+        {
+            const coord_def target = origin + coord_def(x, y);
+            if (target == origin)
+                continue;
+            CAPTURE(x, y);
+
+            ray_def ray;
+            REQUIRE(find_ray(origin, target, ray, opc_none));
+            const int first = ray.cycle_idx;
+            do
+            {
+                CAPTURE(ray.cycle_idx);
+                for (int seed = 0; seed < 8; ++seed)
+                {
+                    CAPTURE(seed);
+                    _follow(ray, exact_ray(ray), seed);
+                }
+                REQUIRE(find_ray(origin, target, ray, opc_none,
+                                 LOS_RADIUS, true));
+            }
+            while (ray.cycle_idx != first);
+
+            ray_def fallback;
+            fallback_ray(origin, target, fallback);
+            for (int seed = 0; seed < 8; ++seed)
+                _follow(fallback, exact_ray(fallback), seed);
+        }
+}
@@ -18,6 +18,121 @@ typedef vector<unique_ptr<vault_placement>> vault_placement_refv;
 
 typedef FixedArray< map_cell, GXM, GYM > MapKnowledge;
 
+// Remembered items of a level loaded from a save, still in their saved form.
+struct lazy_map_items
+{
+    lazy_map_items() : minor(0), left(0), column_left(0) {}
+
+    struct record
+    {
+        record() : offset(0), size(0) {}
+        uint32_t offset;
+        uint32_t size;   // 0 once decoded (or if there was none)
+    };
+
+    vector<unsigned char> data;
+    int minor;           // of the save data came from
+    int left;
+    FixedVector<int, GXM> column_left;
+    FixedArray<record, GXM, GYM> records;
+};
+
+/*
+ * The player's knowledge of the current level. Loading a level leaves the
+ * remembered items undecoded until their cell is first accessed, as most of
+ * them are never looked at before the player leaves again; saving the level
+ * writes the undecoded ones back out unchanged.
+ */
+class map_knowledge_grid
+{
+public:
+    template<class Indexer>
+    map_cell& operator () (const Indexer &i)
+    {
+        _decode(i.x, i.y);
+        return cells[i.x][i.y];
+    }
+
+    template<class Indexer>
+    const map_cell& operator () (const Indexer &i) const
+    {
+        _decode(i.x, i.y);
+        return cells[i.x][i.y];
+    }
+
+    MapKnowledge::Column& operator[](unsigned long x)
+    {
+        _decode_column(x);
+        return cells[x];
+    }
+
+    const MapKnowledge::Column& operator[](unsigned long x) const
+    {
+        _decode_column(x);
+        return cells[x];
+    }
+
+    operator const MapKnowledge& () const
+    {
+        for (int x = 0; x < GXM; ++x)
+            _decode_column(x);
+        return cells;
+    }
+
+    map_knowledge_grid& operator=(const MapKnowledge &other)
+    {
+        lazy.reset();
+        cells = other;
+        return *this;
+    }
+
+    void init(const map_cell &def)
+    {
+        lazy.reset();
+        cells.init(def);
+    }
+
+    // The cell as far as it is decoded: everything but a remembered item
+    // is always there, so this will do for terrain, clouds and monsters.
+    const map_cell& peek(const coord_def &c) const
+    {
+        return cells(c);
+    }
+
+    bool item_pending(const coord_def &c) const
+    {
+        return lazy && lazy->records(c).size;
+    }
+
+    const lazy_map_items *lazy_items() const { return lazy.get(); }
+
+    void set_lazy_items(unique_ptr<lazy_map_items> items)
+    {
+        lazy = move(items);
+        if (lazy && !lazy->left)
+            lazy.reset();
+    }
+
+private:
+    void _decode(int x, int y) const
+    {
+        if (lazy && lazy->records[x][y].size)
+            decode_item(x, y);
+    }
+
+    void _decode_column(int x) const
+    {
+        for (int y = 0; lazy && lazy->column_left[x] && y < GYM; ++y)
+            _decode(x, y);
+    }
+
+    // In tags.cc, with the rest of the map cell unmarshalling.
+    void decode_item(int x, int y) const;
+
+    mutable MapKnowledge cells;
+    mutable unique_ptr<lazy_map_items> lazy;
+};
+
 class final_effect;
 struct crawl_environment
 {
@@ -48,7 +163,7 @@ struct crawl_environment
 
     map_bitmask                              map_seen;
     // Player-remembered terrain and LOS
-    MapKnowledge                             map_knowledge;
+    map_knowledge_grid                       map_knowledge;
     // Forgotten map knowledge (X^F)
     unique_ptr<MapKnowledge>                 map_forgotten;
     set<coord_def> visible;
@@ -37,6 +37,7 @@
 #include "dbg-util.h"
 #include "dgn-overview.h"
 #include "directn.h"
+#include "dlua.h"
 #include "dungeon.h"
 #include "end.h"
 #include "errors.h"
@@ -119,6 +120,8 @@ static void _ghost_dprf(const char *format, ...)
 #endif
 
 static void _save_level(const level_id& lid);
+static void _load_level(const level_id &level);
+static void _discard_speculative_levels();
 
 static bool _ghost_version_compatible(const save_version &version);
 
@@ -807,6 +810,44 @@ bool save_exists(const string& filename)
     return file_exists(_get_savefile_directory() + filename);
 }
 
+// How often each chunk was written or skipped as unchanged, and its size,
+// since the last reset_save_chunk_stats().
+static map<string, save_chunk_stats> chunk_stats;
+
+// The contents of each chunk of the player state as last written to the
+// current save.
+static map<string, vector<unsigned char>> written_chunks;
+
+const map<string, save_chunk_stats> &get_save_chunk_stats()
+{
+    return chunk_stats;
+}
+
+void reset_save_chunk_stats()
+{
+    chunk_stats.clear();
+}
+
+// Applies the options that control how the save is written.
+// Called for every save that is created or opened.
+void set_save_options(package *save)
+{
+    written_chunks.clear();
+    _discard_speculative_levels();
+
+    save->set_async_commit(Options.async_save);
+
+    package_codec codec = codec_by_name(Options.save_codec);
+    if (codec == NUM_CODECS || !codec_available(codec))
+    {
+        mprf(MSGCH_ERROR, "Save codec \"%s\" is not available, using zlib.",
+             Options.save_codec.c_str());
+        codec = CODEC_ZLIB;
+    }
+    save->set_codec(codec);
+    save->set_compaction(Options.save_compact_slack, save_load_order());
+}
+
 string get_savedir_filename(const string &name)
 {
     return _get_savefile_directory() + get_save_filename(name);
@@ -1527,6 +1568,218 @@ bool generate_level(const level_id &l)
     return true;
 }
 
+// A level built ahead of time, while the player sat at the prompt, that
+// hasn't been visited yet.
+struct speculative_level
+{
+    // The levelgen state it was built from, and what building it left.
+    vector<unsigned char> state_before, state_after;
+    vector<unsigned char> persist;
+    // The level's chunk and those of any portal levels built with it.
+    map<string, vector<char>> chunks;
+};
+
+static map<level_id, speculative_level> speculative_levels;
+// Levels that couldn't be built ahead of time; they aren't tried again.
+static set<level_id> unspeculable_levels;
+static bool speculating = false;
+static bool speculation_spoilt = false;
+
+static vector<unsigned char> _levelgen_state()
+{
+    vector<unsigned char> state;
+    writer th(&state);
+    tag_write_levelgen_state(th);
+    return state;
+}
+
+static void _set_levelgen_state(const vector<unsigned char> &state)
+{
+    reader th(state, TAG_MINOR_VERSION);
+    tag_read_levelgen_state(th);
+}
+
+static vector<unsigned char> _persist_data()
+{
+    vector<unsigned char> data;
+    writer th(&data);
+    if (!dlua.callfn("dgn_save_data", "u", &th))
+        mprf(MSGCH_ERROR, "Failed to save Lua data: %s", dlua.error.c_str());
+    return data;
+}
+
+static vector<unsigned char> _props_data()
+{
+    vector<unsigned char> data;
+    writer th(&data);
+    you.props.write(th);
+    return data;
+}
+
+static void _discard_speculative_levels()
+{
+    speculative_levels.clear();
+    unspeculable_levels.clear();
+}
+
+// The levels the known down stairs and branch entrances of the current
+// level lead to that haven't been built yet.
+static vector<level_id> _speculation_candidates()
+{
+    vector<level_id> candidates;
+    for (rectangle_iterator ri(0); ri; ++ri)
+    {
+        const dungeon_feature_type feat = env.map_knowledge.peek(*ri).feat();
+        // Finding out where these go changes the abyss.
+        if (feat_stair_direction(feat) != CMD_GO_DOWNSTAIRS
+            || feat == DNGN_ENTER_ABYSS || feat == DNGN_ABYSSAL_STAIR)
+        {
+            continue;
+        }
+
+        const level_id dest = stair_destination(feat,
+            env.markers.property_at(*ri, MAT_ANY, "dst"));
+        if (dest.is_valid() && is_connected_branch(dest)
+            && !is_existing_level(dest)
+            && !speculative_levels.count(dest)
+            && !unspeculable_levels.count(dest)
+            && find(candidates.begin(), candidates.end(), dest)
+               == candidates.end())
+        {
+            candidates.push_back(dest);
+        }
+    }
+    return candidates;
+}
+
+// The levels speculate_levels() could build from here, if any.
+vector<level_id> speculation_candidates()
+{
+    if (!Options.speculative_levelgen || !you.save
+        || you.deterministic_levelgen
+        || !crawl_state.game_standard_levelgen()
+        || !is_connected_branch(you.where_are_you)
+        || (env.level_state & LSTATE_DELETED)
+        || you.entering_level)
+    {
+        return {};
+    }
+    return _speculation_candidates();
+}
+
+// Builds `lid` from the current level, keeps it in memory if that had no
+// side effects, and puts everything back as it was.
+static void _speculate_level(const level_id &lid)
+{
+    const level_id here = level_id::current();
+
+    const vector<unsigned char> state = _levelgen_state();
+    speculative_level level;
+    level.state_before = state;
+    level.persist = _persist_data();
+    const vector<unsigned char> props = _props_data();
+    const CrawlVector generators = rng::generators_to_vector();
+    const vector<string> chunks_before = you.save->list_chunks();
+
+    dprf("Building '%s' ahead of time.", lid.describe().c_str());
+    _save_level(here);
+    {
+        unwind_bool spec(speculating, true);
+        unwind_bool spoilt(speculation_spoilt, false);
+        unwind_bool on_level(you.on_current_level, false);
+        generate_level(lid);
+
+        // Whatever the builder changed on the player, the bones or the Lua
+        // persistent data can't be undone, so the level can't be kept.
+        bool keep = !speculation_spoilt && _persist_data() == level.persist
+                    && _props_data() == props;
+
+        level.state_after = _levelgen_state();
+        for (const string &name : you.save->list_chunks())
+        {
+            if (find(chunks_before.begin(), chunks_before.end(), name)
+                != chunks_before.end())
+            {
+                continue;
+            }
+            if (keep)
+            {
+                chunk_reader in(you.save, name);
+                in.read_all(level.chunks[name]);
+            }
+            you.save->delete_chunk(name);
+        }
+
+        if (keep)
+            speculative_levels[lid] = move(level);
+        else
+        {
+            dprf("Discarding '%s': building it had side effects.",
+                 lid.describe().c_str());
+            unspeculable_levels.insert(lid);
+        }
+    }
+
+    rng::load_generators(generators);
+    _set_levelgen_state(state);
+    _load_level(here);
+    env.markers.activate_all(false);
+}
+
+/**
+ * Build the levels below the current one while the player is idle, so that
+ * taking the stairs later only has to load them. `candidates` are what
+ * speculation_candidates() returned for the current level. Each level is kept in
+ * memory, and everything building it changed outside the level is put back
+ * as it was; load_level() only uses it if nothing it was built from changed
+ * in the meantime. A level can't be abandoned halfway, but this stops
+ * between levels as soon as there's a key to handle.
+ *
+ * Levels are only built ahead in games without deterministic levelgen: there
+ * the builder's random numbers are drawn in a fixed order, and building one
+ * level early would change every level built after it.
+ */
+void speculate_levels(const vector<level_id> &candidates)
+{
+    for (const level_id &lid : candidates)
+    {
+        if (has_pending_input() || kbhit())
+            return;
+        _speculate_level(lid);
+    }
+}
+
+// Move a level built ahead of time for `lid` into the save, if it was built
+// from the same state the builder would now see; otherwise throw it away.
+static void _take_speculative_level(const level_id &lid)
+{
+    auto spec = speculative_levels.find(lid);
+    if (spec == speculative_levels.end())
+        return;
+
+    const speculative_level level = move(spec->second);
+    speculative_levels.erase(spec);
+
+    bool usable = _levelgen_state() == level.state_before
+                  && _persist_data() == level.persist;
+    for (const auto &chunk : level.chunks)
+        usable = usable && !you.save->has_chunk(chunk.first);
+    if (!usable)
+    {
+        dprf("Discarding '%s' built ahead of time: the dungeon has changed.",
+             lid.describe().c_str());
+        return;
+    }
+
+    dprf("Using '%s' built ahead of time.", lid.describe().c_str());
+    for (const auto &chunk : level.chunks)
+    {
+        writer outf(you.save, chunk.first);
+        outf.write(chunk.second.data(), chunk.second.size());
+    }
+    _set_levelgen_state(level.state_after);
+}
+
 // bel's original proposal generated D to lair depth, then lair, then D
 // to orc depth, then orc, then the rest of D. I have simplified this to
 // just generate whole branches at a time -- I am not sure how much real
@@ -1658,6 +1911,25 @@ bool pregen_dungeon(const level_id &stopping_point)
         // is possible to call this in a way that doesn't lead to generation.
         bool generated = false;
 
+        // Generation itself has to be serial: the builder works on the one
+        // global env, and levels depend on what earlier ones used up
+        // (unique vaults, uniques, unrands). But staging the levels lets
+        // them be compressed together when they're committed, on up to
+        // MAX_ENCODE_THREADS threads once there's at least 64 KiB of them
+        // (see write_staged()), rather than one by one between builds.
+        you.save->set_async_commit(true);
+        // If we leave this way, whatever is on the way out will want the
+        // save left alone, so don't let a late commit error get in its way.
+        unwinder restore_async = [] {
+            try
+            {
+                you.save->set_async_commit(Options.async_save);
+            }
+            catch (...)
+            {
+            }
+        };
+
         for (const level_id &new_level : to_generate)
         {
             string status = "\nbuilding ";
@@ -1683,6 +1955,8 @@ bool pregen_dungeon(const level_id &stopping_point)
             generated = generate_level(new_level) || generated;
         }
 
+        restore_async.cancel();
+        you.save->set_async_commit(Options.async_save);
         return generated;
     }
 }
@@ -1785,6 +2059,8 @@ bool load_level(dungeon_feature_type stair_taken, load_mode_type load_mode,
             note_equipment();
     }
 
+    _take_speculative_level(level_id::current());
+
     // GENERATE new level(s) when the file can't be opened:
     if (!pregen_dungeon(level_id::current()))
     {
@@ -2053,11 +2329,61 @@ static void _save_level(const level_id& lid)
 # define CHUNK(short, long) long
 #endif
 
+// The chunks of the player state, in the order a restore reads them. Levels
+// aren't listed; they're loaded one at a time, whenever the player gets there.
+vector<string> save_load_order()
+{
+    return
+    {
+        "chr", "you", CHUNK("st", "stashes"), "lua", CHUNK("kil", "kills"),
+        CHUNK("tc", "travel_cache"), CHUNK("nts", "notes"),
+        CHUNK("tut", "tutorial"), CHUNK("msg", "messages"),
+        CHUNK("tdl", "tiles_doll"),
+    };
+}
+
+// Write a chunk of the player state, unless the save already has exactly
+// these contents. Comparing the serialised data catches every change
+// without each subsystem having to track its own.
+static void _save_chunk(const string &chunkname,
+                        const vector<unsigned char> &data)
+{
+    save_chunk_stats &stats = chunk_stats[chunkname];
+    stats.bytes = data.size();
+
+    auto old = written_chunks.find(chunkname);
+    if (old != written_chunks.end() && old->second == data
+        && you.save->has_chunk(chunkname))
+    {
+        stats.unchanged++;
+        return;
+    }
+
+    {
+        writer outf(you.save, chunkname);
+        outf.write(data.data(), data.size());
+    }
+    stats.writes++;
+    written_chunks[chunkname] = data;
+}
+
+static void _save_tagged_chunk(const string &chunkname, tag_type tag)
+{
+    vector<unsigned char> buf;
+    writer outf(&buf);
+
+    write_save_version(outf, save_version::current());
+    tag_write(tag, outf);
+    _save_chunk(chunkname, buf);
+}
+
 #define SAVEFILE(short, long, savefn)           \
     do                                          \
     {                                           \
-        writer w(you.save, CHUNK(short, long)); \
+        vector<unsigned char> buf;              \
+        writer w(&buf);                         \
         savefn(w);                              \
+        _save_chunk(CHUNK(short, long), buf);   \
     } while (false)
 
 // Stack allocated string's go in separate function, so Valgrind doesn't
@@ -2094,8 +2420,8 @@ static void _save_game_base()
     SAVEFILE("tdl", "tiles_doll", save_doll_file);
 #endif
 
-    _write_tagged_chunk("you", TAG_YOU);
-    _write_tagged_chunk("chr", TAG_CHR);
+    _save_tagged_chunk("you", TAG_YOU);
+    _save_tagged_chunk("chr", TAG_CHR);
 }
 
 // Stack allocated string's go in separate function, so Valgrind doesn't
@@ -2127,6 +2453,7 @@ static void _save_game_exit()
 
     delete you.save;
     you.save = 0;
+    written_chunks.clear();
 }
 
 void save_game(bool leave_game, const char *farewellmsg)
@@ -2156,7 +2483,15 @@ void save_game(bool leave_game, const char *farewellmsg)
     if (!leave_game)
     {
         if (!crawl_state.disables[DIS_SAVE_CHECKPOINTS])
+        {
+            if (you.save->take_compaction_failure())
+            {
+                mprf(MSGCH_ERROR, "Couldn't replace the save file with a "
+                                  "compacted copy; save_compact_slack is "
+                                  "ignored until the game is reloaded.");
+            }
             you.save->commit();
+        }
         return;
     }
 
@@ -2522,6 +2857,13 @@ static vector<ghost_demon> _load_ephemeral_ghosts()
         return results; // no such ghost.
     }
 
+    // Bones used by a level that might never be visited would be lost.
+    if (speculating)
+    {
+        speculation_spoilt = true;
+        return results;
+    }
+
     results = _load_ghosts_core(ghost_filename, true);
 
     if (unlink(ghost_filename.c_str()) != 0)
@@ -2688,6 +3030,7 @@ static bool _restore_game(const string& filename)
     clear_message_store();
 
     you.save = new package((_get_savefile_directory() + filename).c_str(), true);
+    set_save_options(you.save);
 
     if (!_read_char_chunk(you.save))
     {
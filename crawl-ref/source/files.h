@@ -85,6 +85,8 @@ void update_portal_entrances();
 void reset_portal_entrances();
 bool generate_level(const level_id &l);
 bool pregen_dungeon(const level_id &stopping_point);
+vector<level_id> speculation_candidates();
+void speculate_levels(const vector<level_id> &candidates);
 bool load_level(dungeon_feature_type stair_taken, load_mode_type load_mode,
                 const level_id& old_level);
 void delete_level(const level_id &level);
@@ -94,10 +96,23 @@ void save_game(bool leave_game, const char *bye = nullptr);
 // Save game without exiting (used when changing levels).
 void save_game_state();
 
+// Counters for the chunks of the player state written by save_game().
+struct save_chunk_stats
+{
+    size_t bytes = 0;   // size when last serialised
+    int writes = 0;     // times written to the save
+    int unchanged = 0;  // times skipped because the save already had it
+};
+const map<string, save_chunk_stats> &get_save_chunk_stats();
+void reset_save_chunk_stats();
+
 void write_save_version(writer &file, save_version version);
 save_version get_save_version(reader &file);
 
 bool save_exists(const string& filename);
+class package;
+void set_save_options(package *save);
+vector<string> save_load_order();
 bool restore_game(const string& filename);
 
 bool is_existing_level(const level_id &level);
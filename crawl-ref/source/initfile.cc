@@ -14,6 +14,7 @@
 #include "initfile.h"
 
 #include <algorithm>
+#include <chrono>
 #include <cinttypes>
 #include <cctype>
 #include <cstdio>
@@ -42,6 +43,7 @@
 #include "jobs.h"
 #include "kills.h"
 #include "libutil.h"
+#include "los.h"
 #include "macro.h"
 #include "mapdef.h"
 #include "message.h"
@@ -214,6 +216,9 @@ const vector<GameOption*> game_options::build_options_list()
         new BoolGameOption(SIMPLE_NAME(explore_auto_rest), false),
         new BoolGameOption(SIMPLE_NAME(travel_key_stop), true),
         new BoolGameOption(SIMPLE_NAME(dump_on_save), true),
+        new BoolGameOption(SIMPLE_NAME(async_save), false),
+        new IntGameOption(SIMPLE_NAME(save_compact_slack), 50, 0, 100),
+        new BoolGameOption(SIMPLE_NAME(speculative_levelgen), false),
         new BoolGameOption(SIMPLE_NAME(rest_wait_both), false),
         new BoolGameOption(SIMPLE_NAME(rest_wait_ancestor), false),
         new BoolGameOption(SIMPLE_NAME(cloud_status), !is_tiles()),
@@ -307,6 +312,7 @@ const vector<GameOption*> game_options::build_options_list()
         new BoolGameOption(SIMPLE_NAME(newgame_after_quit), false),
         new StringGameOption(SIMPLE_NAME(map_file_name), ""),
         new StringGameOption(SIMPLE_NAME(save_dir), _get_save_path("saves/")),
+        new StringGameOption(SIMPLE_NAME(save_codec), "zlib"),
         new StringGameOption(SIMPLE_NAME(morgue_dir),
                              _get_save_path("morgue/")),
 #endif
@@ -3910,6 +3916,8 @@ enum commandline_option_type
     CLO_NO_THROTTLE,
     CLO_PLAYABLE_JSON, // JSON metadata for species, jobs, combos.
     CLO_EDIT_BONES,
+    CLO_CHECK_LOS_TABLES,
+    CLO_COMPACT_SAVE,
 #ifdef USE_TILE_WEB
     CLO_WEBTILES_SOCKET,
     CLO_AWAIT_CONNECTION,
@@ -3928,7 +3936,7 @@ static const char *cmd_ops[] =
     "extra-opt-first", "extra-opt-last", "sprint-map", "edit-save",
     "print-charset", "tutorial", "wizard", "explore", "no-save", "gdb",
     "no-gdb", "nogdb", "throttle", "no-throttle", "playable-json",
-    "bones",
+    "bones", "check-los-tables", "compact-save",
 #ifdef USE_TILE_WEB
     "webtiles-socket", "await-connection", "print-webtiles-options",
 #endif
@@ -3997,6 +4005,32 @@ static void _print_save_version(char *name)
     }
 }
 
+// Rewrites a save without its unused space, the chunks that are read first
+// at the front.
+static void _compact_save(const char *name)
+{
+    try
+    {
+        string filename = name;
+        // Check for the exact filename first, then go by char name.
+        if (!file_exists(filename))
+            filename = get_savedir_filename(filename);
+        package save(filename.c_str(), true);
+
+        const plen_t old_size = save.get_size();
+        const plen_t slack = save.get_slack();
+        save.set_compaction(0, save_load_order());
+        if (!save.compact())
+            fail("Can't replace \"%s\".", filename.c_str());
+        printf("Compacted %s: %u -> %u bytes (%u unused).\n", name, old_size,
+               save.get_size(), slack);
+    }
+    catch (ext_fail_exception &fe)
+    {
+        fprintf(stderr, "Error: %s\n", fe.what());
+    }
+}
+
 enum es_command_type
 {
     ES_LS,
@@ -4031,7 +4065,7 @@ static edit_command<es_command_type> es_commands[] =
     { ES_GET,     "get",     false, 1, 2, },
     { ES_PUT,     "put",     true,  1, 2, },
     { ES_RM,      "rm",      true,  1, 1, },
-    { ES_REPACK,  "repack",  false, 0, 0, },
+    { ES_REPACK,  "repack",  false, 0, 1, },
     { ES_INFO,    "info",    false, 0, 0, },
 };
 
@@ -4054,7 +4088,10 @@ static void _edit_save(int argc, char **argv)
                "  put <chunk> [<chunkfile>]   import a chunk from <chunkfile>\n"
                "     <chunkfile> defaults to \"chunk\"; use \"-\" for stdout/stdin\n"
                "  rm <chunk>                  delete a chunk\n"
-               "  repack                      defrag and reclaim unused space\n"
+               "  repack [<codec>]            defrag and reclaim unused space,\n"
+               "                              recompressing with <codec>\n"
+               "  info                        show sizes, codecs and timings\n"
+               "     <codec> is one of zlib, none, lz4, zstd (if built in)\n"
              );
         return;
     }
@@ -4157,7 +4194,34 @@ static void _edit_save(int argc, char **argv)
         }
         else if (cmd == ES_REPACK)
         {
+            package_codec codec = CODEC_ZLIB;
+            if (argc == 3)
+            {
+                codec = codec_by_name(argv[2]);
+                if (codec == NUM_CODECS || !codec_available(codec))
+                    FAIL("Codec \"%s\" is not available.\n", argv[2]);
+            }
+
             package save2((filename + ".tmp").c_str(), true, true);
+            if (codec == CODEC_ZSTD)
+            {
+                // Train the dictionary on the contents of this very save.
+                vector<string> samples;
+                for (const string &chunk : save.list_chunks())
+                {
+                    vector<char> data;
+                    chunk_reader in(&save, chunk);
+                    in.read_all(data);
+                    samples.emplace_back(data.begin(), data.end());
+                }
+                const string dict = train_codec_dictionary(samples);
+                if (!dict.empty())
+                    save2.set_dictionary(dict);
+                else
+                    fprintf(stderr, "Too little data for a dictionary.\n");
+            }
+            save2.set_codec(codec);
+
             for (const string &chunk : save.list_chunks())
             {
                 char buf[16384];
@@ -4180,20 +4244,36 @@ static void _edit_save(int argc, char **argv)
             plen_t frag = save.get_chunk_fragmentation("");
             plen_t flen = save.get_size();
             plen_t slack = save.get_slack();
-            printf("Chunks: (size compressed/uncompressed, fragments, name)\n");
+            plen_t total_cclen = 0, total_clen = 0;
+            auto total_time = chrono::microseconds::zero();
+            printf("Chunks: (size compressed/uncompressed, fragments, codec, "
+                   "decompression time in us, name)\n");
             for (const string &chunk : list)
             {
                 int cfrag = save.get_chunk_fragmentation(chunk);
                 frag += cfrag;
                 int cclen = save.get_chunk_compressed_length(chunk);
+                package_codec codec = save.get_chunk_codec(chunk);
 
                 char buf[16384];
+                const auto start = chrono::steady_clock::now();
                 chunk_reader in(&save, chunk);
                 plen_t clen = 0;
                 while (plen_t s = in.read(buf, sizeof(buf)))
                     clen += s;
-                printf("%7d/%7d %3u %s\n", cclen, clen, cfrag, chunk.c_str());
+                const auto time = chrono::duration_cast<chrono::microseconds>(
+                    chrono::steady_clock::now() - start);
+                printf("%7d/%7d %3u %-4s %7d %s\n", cclen, clen, cfrag,
+                       codec_name(codec), (int)time.count(), chunk.c_str());
+
+                total_cclen += cclen;
+                total_clen += clen;
+                total_time += time;
             }
+            printf("Total:            %u/%u (%4.2f), %d us\n", total_cclen,
+                   total_clen,
+                   total_clen ? (float)total_cclen / total_clen : 0.0f,
+                   (int)total_time.count());
             // the directory is not a chunk visible from the outside
             printf("Fragmentation:    %u/%u (%4.2f)\n", frag, nchunks + 1,
                    ((float)frag) / (nchunks + 1));
@@ -4983,10 +5063,23 @@ bool parse_args(int argc, char **argv, bool rc_only)
             _edit_save(argc - current - 1, argv + current + 1);
             end(0);
 
+        case CLO_COMPACT_SAVE:
+            if (!next_is_param)
+                return false;
+
+            _compact_save(next_arg);
+            end(0);
+
         case CLO_EDIT_BONES:
             _edit_bones(argc - current - 1, argv + current + 1);
             end(0);
 
+        case CLO_CHECK_LOS_TABLES:
+            if (!check_los_tables())
+                end(1, false, "LOS ray tables differ from a fresh calculation.");
+            printf("LOS ray tables OK.\n");
+            end(0);
+
         case CLO_SEED:
             if (!next_is_param)
             {
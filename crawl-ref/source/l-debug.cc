@@ -6,6 +6,7 @@
 #include "l-libs.h"
 
 #include "act-iter.h"
+#include "beam.h"
 #include "branch.h"
 #include "chardump.h"
 #include "cluautil.h"
@@ -18,12 +19,15 @@
 #include "message.h"
 #include "mon-act.h"
 #include "mon-death.h"
+#include "mon-pathfind.h"
 #include "mon-poly.h"
 #include "ng-setup.h"
 #include "religion.h"
+#include "savecheck.h"
 #include "stairs.h"
 #include "state.h"
 #include "stringutil.h"
+#include "tags.h"
 #include "tileview.h"
 #include "view.h"
 #include "wiz-dgn.h"
@@ -181,6 +185,111 @@ LUAFN(debug_bouncy_beam)
     return 0;
 }
 
+// Counters of the monster tracer cache.
+LUAFN(debug_tracer_cache_stats)
+{
+    const tracer_cache_stats &stats = get_tracer_cache_stats();
+    lua_newtable(ls);
+    lua_pushnumber(ls, stats.hits);
+    lua_setfield(ls, -2, "hits");
+    lua_pushnumber(ls, stats.misses);
+    lua_setfield(ls, -2, "misses");
+    lua_pushnumber(ls, stats.uncacheable);
+    lua_setfield(ls, -2, "uncacheable");
+    return 1;
+}
+
+LUAWRAP(debug_reset_tracer_cache_stats, reset_tracer_cache_stats())
+
+LUAFN(debug_pathfind_field_stats)
+{
+    const pathfind_field_stats &stats = get_pathfind_field_stats();
+    lua_newtable(ls);
+    lua_pushnumber(ls, stats.hits);
+    lua_setfield(ls, -2, "hits");
+    lua_pushnumber(ls, stats.misses);
+    lua_setfield(ls, -2, "misses");
+    lua_pushnumber(ls, stats.builds);
+    lua_setfield(ls, -2, "builds");
+    return 1;
+}
+
+LUAWRAP(debug_reset_pathfind_field_stats, reset_pathfind_field_stats())
+
+// Time pathfinding to the player for every monster on the level, with and
+// without the shared distance fields.
+LUAFN(debug_bench_pathfind_fields)
+{
+    const pathfind_field_bench bench =
+        bench_pathfind_fields(luaL_safe_checkint(ls, 1));
+    lua_newtable(ls);
+    lua_pushnumber(ls, bench.astar_us);
+    lua_setfield(ls, -2, "astar_us");
+    lua_pushnumber(ls, bench.shared_us);
+    lua_setfield(ls, -2, "shared_us");
+    lua_pushnumber(ls, bench.searches);
+    lua_setfield(ls, -2, "searches");
+    lua_pushnumber(ls, bench.builds);
+    lua_setfield(ls, -2, "builds");
+    lua_pushnumber(ls, bench.hits);
+    lua_setfield(ls, -2, "hits");
+    lua_pushnumber(ls, bench.mismatches);
+    lua_setfield(ls, -2, "mismatches");
+    return 1;
+}
+
+// Sizes of the chunks of the player state, and how often each was written
+// or left alone because it hadn't changed.
+LUAFN(debug_save_chunk_stats)
+{
+    lua_newtable(ls);
+    for (const auto &entry : get_save_chunk_stats())
+    {
+        lua_newtable(ls);
+        lua_pushnumber(ls, entry.second.bytes);
+        lua_setfield(ls, -2, "bytes");
+        lua_pushnumber(ls, entry.second.writes);
+        lua_setfield(ls, -2, "writes");
+        lua_pushnumber(ls, entry.second.unchanged);
+        lua_setfield(ls, -2, "unchanged");
+        lua_setfield(ls, -2, entry.first.c_str());
+    }
+    return 1;
+}
+
+LUAWRAP(debug_reset_save_chunk_stats, reset_save_chunk_stats())
+
+// Time the level grid section of a save in the old per-cell format and
+// the block format.
+LUAFN(debug_bench_level_grids)
+{
+    const level_grid_bench bench = bench_level_grids(luaL_safe_checkint(ls, 1));
+    lua_newtable(ls);
+    lua_pushnumber(ls, bench.legacy_write_us);
+    lua_setfield(ls, -2, "legacy_write_us");
+    lua_pushnumber(ls, bench.legacy_read_us);
+    lua_setfield(ls, -2, "legacy_read_us");
+    lua_pushnumber(ls, bench.legacy_bytes);
+    lua_setfield(ls, -2, "legacy_bytes");
+    lua_pushnumber(ls, bench.bulk_write_us);
+    lua_setfield(ls, -2, "bulk_write_us");
+    lua_pushnumber(ls, bench.bulk_read_us);
+    lua_setfield(ls, -2, "bulk_read_us");
+    lua_pushnumber(ls, bench.bulk_bytes);
+    lua_setfield(ls, -2, "bulk_bytes");
+    return 1;
+}
+
+// Check every save in a directory, returning a JSON report. This reads each
+// save into the current game, which is useless afterwards.
+LUAFN(debug_verify_saves)
+{
+    const string dir = luaL_checkstring(ls, 1);
+    const int threads = lua_isnumber(ls, 2) ? luaL_safe_checkint(ls, 2) : 0;
+    lua_pushstring(ls, verify_saves(dir, threads).c_str());
+    return 1;
+}
+
 // If menv[] is full, dismiss all monsters not near the player.
 LUAFN(debug_cull_monsters)
 {
@@ -448,6 +557,15 @@ const struct luaL_reg debug_dlib[] =
 { "vault_names", debug_vault_names },
 { "test_explore", _debug_test_explore },
 { "bouncy_beam", debug_bouncy_beam },
+{ "tracer_cache_stats", debug_tracer_cache_stats },
+{ "reset_tracer_cache_stats", debug_reset_tracer_cache_stats },
+{ "pathfind_field_stats", debug_pathfind_field_stats },
+{ "reset_pathfind_field_stats", debug_reset_pathfind_field_stats },
+{ "bench_pathfind_fields", debug_bench_pathfind_fields },
+{ "bench_level_grids", debug_bench_level_grids },
+{ "save_chunk_stats", debug_save_chunk_stats },
+{ "reset_save_chunk_stats", debug_reset_save_chunk_stats },
+{ "verify_saves", debug_verify_saves },
 { "cull_monsters", debug_cull_monsters},
 { "dismiss_adjacent", debug_dismiss_adjacent},
 { "dismiss_monsters", debug_dismiss_monsters},
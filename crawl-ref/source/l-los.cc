@@ -57,11 +57,34 @@ LUAFN(los_cell_see_cell)
     PLUARET(number, cell_see_cell(p, q, LOS_DEFAULT));
 }
 
+static void _push_stat(lua_State *ls, const char *name, uint64_t val)
+{
+    lua_pushnumber(ls, val);
+    lua_setfield(ls, -2, name);
+}
+
+// Counters of the global cell_see_cell cache.
+LUAFN(los_get_cache_stats)
+{
+    const los_cache_stats &stats = get_los_cache_stats();
+    lua_newtable(ls);
+    _push_stat(ls, "hits", stats.hits);
+    _push_stat(ls, "misses", stats.misses);
+    _push_stat(ls, "invalidated_entries", stats.invalidated_entries);
+    _push_stat(ls, "region_invalidations", stats.region_invalidations);
+    _push_stat(ls, "full_invalidations", stats.full_invalidations);
+    return 1;
+}
+
+LUAWRAP(los_reset_cache_stats, reset_los_cache_stats())
+
 const struct luaL_reg los_dlib[] =
 {
     { "findray", los_find_ray },
     { "make_ray", los_make_ray },
     { "cell_see_cell", los_cell_see_cell },
+    { "cache_stats", los_get_cache_stats },
+    { "reset_cache_stats", los_reset_cache_stats },
     { nullptr, nullptr }
 };
 
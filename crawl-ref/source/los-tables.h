@@ -0,0 +1,48 @@
+/**
+ * @file
+ * @brief Precomputed LOS ray tables, as generated at build time.
+**/
+
+#pragma once
+
+// A full ray: the geom::ray it was cast along, and its footprint
+// coords[start..start+length-1].
+struct los_table_ray
+{
+    double x, y, dx, dy;
+    unsigned int start;
+    unsigned int length;
+};
+
+struct los_table_coord
+{
+    int8_t x, y;
+};
+
+// A minimal cellray: the first end+1 cells of rays[ray], with the
+// parameters find_ray() uses to rank cellrays to the same target.
+struct los_table_cellray
+{
+    unsigned int ray;
+    unsigned int end;
+    int imbalance;
+    bool first_diag;
+};
+
+// The minimal cellrays are listed by target cell, in the order find_ray()
+// prefers them.
+struct los_table
+{
+    unsigned int num_rays;
+    const los_table_ray *rays;
+    unsigned int num_coords;
+    const los_table_coord *coords;
+    unsigned int num_cellrays;
+    const los_table_cellray *cellrays;
+};
+
+#ifdef USE_LOS_TABLES
+// Defined by the generated los-tables.cc. The generator itself links an
+// empty table, which makes los.cc fall back to casting the rays.
+extern const los_table los_builtin_table;
+#endif
@@ -46,14 +46,19 @@
 
 #include <algorithm>
 #include <cmath>
+#if defined(USE_PACKED_LOS) && defined(__AVX2__)
+#include <immintrin.h>
+#endif
 
 #include "areas.h"
 #include "coord.h"
 #include "coordit.h"
 #include "env.h"
 #include "god-passive.h" // passive_t::monster_shadows
+#include "los-tables.h"
 #include "losglobal.h"
 #include "mon-act.h"
+#include "stringutil.h"
 
 // These determine what rays are cast in the precomputation,
 // and affect start-up time significantly.
@@ -64,7 +69,8 @@
 // These store all unique (in terms of footprint) full rays.
 // The footprint of ray=fullray[i] consists of ray.length cells,
 // stored in ray_coords[ray.start..ray.length-1].
-// These are filled during precomputation (_register_ray).
+// These are filled during precomputation (_register_ray), or
+// from the built-in tables (_load_los_table).
 // XXX: fullrays is not needed anymore after precomputation.
 struct los_ray;
 static vector<los_ray> fullrays;
@@ -91,6 +97,24 @@ static FixedArray<vector<cellray>, LOS_MAX_RANGE+1, LOS_MAX_RANGE+1> min_cellray
 static bit_vector *dead_rays     = nullptr;
 static bit_vector *smoke_rays    = nullptr;
 
+// For each cell p in the quadrant, the end cells of those minimal
+// cellrays that pass through p, i.e. the cells whose visibility from
+// the origin can depend on the opacity of p. Used by losglobal.cc to
+// invalidate only the affected parts of the LOS cache.
+static FixedArray<vector<coord_def>, LOS_MAX_RANGE+1, LOS_MAX_RANGE+1> shadows;
+
+#ifdef USE_PACKED_LOS
+// The packed LOS engine keeps its own copy of blockrays as plain
+// 64-bit words, padded to whole 256-bit blocks. The blockrays of the
+// quadrant cell (x,y) start at packed_blockrays[packed_index(x,y)].
+// Padding bits don't correspond to any cellray and are kept dead.
+static int packed_words = 0;
+static vector<uint64_t> packed_blockrays;
+static vector<uint64_t> packed_padding;
+static vector<uint64_t> packed_dead;
+static vector<uint64_t> packed_smoke;
+#endif
+
 class quadrant_iterator : public rectangle_iterator
 {
 public:
@@ -105,8 +129,12 @@ void clear_rays_on_exit()
 {
     delete dead_rays;
     delete smoke_rays;
+    dead_rays = smoke_rays = nullptr;
     for (quadrant_iterator qi; qi; ++qi)
+    {
         delete blockrays(*qi);
+        blockrays(*qi) = nullptr;
+    }
 }
 
 // LOS radius.
@@ -306,9 +334,9 @@ static compare_type _compare_cellrays(const cellray& a, const cellray& b)
 }
 
 // Determine all minimal cellrays.
-// They're stored globally by target in min_cellrays,
-// and returned as a list of indices into ray_coords.
-static vector<int> _find_minimal_cellrays()
+// They're returned grouped by target, in quadrant order, and
+// sorted by preference (_is_better) for each target.
+static vector<cellray> _find_minimal_cellrays()
 {
     FixedArray<list<cellray>, LOS_MAX_RANGE+1, LOS_MAX_RANGE+1> minima;
     list<cellray>::iterator min_it;
@@ -351,18 +379,15 @@ static vector<int> _find_minimal_cellrays()
         }
     }
 
-    vector<int> result;
+    vector<cellray> result;
     for (quadrant_iterator qi; qi; ++qi)
     {
         list<cellray>& min = minima(*qi);
+        // Calculate imbalance and slope difference for sorting.
         for (min_it = min.begin(); min_it != min.end(); ++min_it)
-        {
-            // Calculate imbalance and slope difference for sorting.
             min_it->calc_params();
-            result.push_back(min_it->index());
-        }
         min.sort(_is_better);
-        min_cellrays(*qi) = vector<cellray>(min.begin(), min.end());
+        result.insert(result.end(), min.begin(), min.end());
     }
     return result;
 }
@@ -383,57 +408,84 @@ static void _register_ray(geom::ray r)
     fullrays.push_back(ray);
 }
 
-static void _create_blockrays()
+#ifdef USE_PACKED_LOS
+static int _packed_index(int x, int y)
 {
-    // First, we calculate blocking information for all cell rays.
-    // Cellrays are numbered according to the index of their end
-    // cell in ray_coords.
-    const int n_cellrays = ray_coords.size();
-    blockrays_t all_blockrays;
-    for (quadrant_iterator qi; qi; ++qi)
-        all_blockrays(*qi) = new bit_vector(n_cellrays);
+    return (y * (LOS_MAX_RANGE + 1) + x) * packed_words;
+}
 
-    for (los_ray ray : fullrays)
+// Copy the compressed blockrays into the word arrays used by
+// _losight_quadrant_packed().
+static void _pack_blockrays(int n_rays)
+{
+    packed_words = (n_rays + 255) / 256 * 4;
+    packed_blockrays.assign((LOS_MAX_RANGE + 1) * (LOS_MAX_RANGE + 1)
+                            * packed_words, 0);
+    for (quadrant_iterator qi; qi; ++qi)
     {
-        for (unsigned int i = 0; i < ray.length; ++i)
-        {
-            // Every cell is contained in (thus blocks)
-            // all following cellrays.
-            for (unsigned int j = i + 1; j < ray.length; ++j)
-                all_blockrays(ray[i])->set(ray.start + j);
-        }
+        uint64_t *words = &packed_blockrays[_packed_index(qi->x, qi->y)];
+        for (int i = 0; i < n_rays; ++i)
+            if (blockrays(*qi)->get(i))
+                words[i / 64] |= (uint64_t)1 << (i % 64);
     }
 
-    // We've built the basic blockray array; now compress it, keeping
-    // only the nonduplicated cellrays.
+    packed_padding.assign(packed_words, 0);
+    for (int i = n_rays; i < packed_words * 64; ++i)
+        packed_padding[i / 64] |= (uint64_t)1 << (i % 64);
 
-    // Determine minimal cellrays and store their indices in ray_coords.
-    vector<int> min_indices = _find_minimal_cellrays();
-    const int n_min_rays    = min_indices.size();
-    cellray_ends.resize(n_min_rays);
-    for (int i = 0; i < n_min_rays; ++i)
-        cellray_ends[i] = ray_coords[min_indices[i]];
+    packed_dead.resize(packed_words);
+    packed_smoke.resize(packed_words);
+}
+#endif
+
+// Set up everything losight() and find_ray() need from the minimal
+// cellrays, as returned by _find_minimal_cellrays(). Bit i of the
+// blockrays corresponds to min_rays[i].
+static void _create_blockrays(const vector<cellray>& min_rays)
+{
+    clear_rays_on_exit();
 
-    // Compress blockrays accordingly.
+    const int n_min_rays = min_rays.size();
     for (quadrant_iterator qi; qi; ++qi)
     {
+        min_cellrays(*qi).clear();
+        shadows(*qi).clear();
         blockrays(*qi) = new bit_vector(n_min_rays);
-        for (int i = 0; i < n_min_rays; ++i)
-        {
-            blockrays(*qi)->set(i, all_blockrays(*qi)
-                                   ->get(min_indices[i]));
-        }
     }
 
-    // We can throw away all_blockrays now.
-    for (quadrant_iterator qi; qi; ++qi)
-        delete all_blockrays(*qi);
+    // Every cell of a cellray before its end blocks it.
+    cellray_ends.resize(n_min_rays);
+    for (int i = 0; i < n_min_rays; ++i)
+    {
+        cellray c = min_rays[i];
+        cellray_ends[i] = c.target();
+        min_cellrays(c.target()).push_back(c);
+        for (unsigned int j = 0; j < c.end; ++j)
+            blockrays(c[j])->set(i);
+    }
 
     dead_rays  = new bit_vector(n_min_rays);
     smoke_rays = new bit_vector(n_min_rays);
 
-    dprf("Cellrays: %d Fullrays: %u Minimal cellrays: %u",
-          n_cellrays, (unsigned int)fullrays.size(), n_min_rays);
+    // Collect the shadow of each cell; several minimal cellrays
+    // may end in the same cell.
+    for (quadrant_iterator qi; qi; ++qi)
+    {
+        vector<coord_def> &shadow = shadows(*qi);
+        for (int i = 0; i < n_min_rays; ++i)
+            if (blockrays(*qi)->get(i))
+                shadow.push_back(cellray_ends[i]);
+        sort(shadow.begin(), shadow.end());
+        shadow.erase(unique(shadow.begin(), shadow.end()), shadow.end());
+    }
+
+#ifdef USE_PACKED_LOS
+    _pack_blockrays(n_min_rays);
+#endif
+
+    dprf("Cellrays: %u Fullrays: %u Minimal cellrays: %u",
+          (unsigned int)ray_coords.size(), (unsigned int)fullrays.size(),
+          n_min_rays);
 }
 
 static int _gcd(int x, int y)
@@ -455,15 +507,13 @@ static bool _complexity_lt(const pair<int,int>& lhs, const pair<int,int>& rhs)
 }
 
 // Cast all rays
-static void raycast()
+static void _cast_rays()
 {
-    static bool done_raycast = false;
-    if (done_raycast)
-        return;
+    fullrays.clear();
+    ray_coords.clear();
 
     // Creating all rays for first quadrant
     // We have a considerable amount of overkill.
-    done_raycast = true;
 
     // register perpendiculars FIRST, to make them top choice
     // when selecting beams
@@ -504,7 +554,140 @@ static void raycast()
     }
 
     // Now create the appropriate blockrays array
-    _create_blockrays();
+    _create_blockrays(_find_minimal_cellrays());
+}
+
+#ifdef USE_LOS_TABLES
+// Take the rays from tables written by _los_table_source(), rather
+// than casting them.
+static void _load_los_table(const los_table& table)
+{
+    ray_coords.clear();
+    for (unsigned int i = 0; i < table.num_coords; ++i)
+        ray_coords.emplace_back(table.coords[i].x, table.coords[i].y);
+
+    fullrays.clear();
+    for (unsigned int i = 0; i < table.num_rays; ++i)
+    {
+        const los_table_ray &r = table.rays[i];
+        los_ray ray(geom::ray(r.x, r.y, r.dx, r.dy));
+        ray.start = r.start;
+        ray.length = r.length;
+        fullrays.push_back(ray);
+    }
+
+    vector<cellray> min_rays;
+    for (unsigned int i = 0; i < table.num_cellrays; ++i)
+    {
+        const los_table_cellray &c = table.cellrays[i];
+        min_rays.emplace_back(fullrays[c.ray], c.end);
+        min_rays.back().imbalance = c.imbalance;
+        min_rays.back().first_diag = c.first_diag;
+    }
+    _create_blockrays(min_rays);
+}
+#endif
+
+static void raycast()
+{
+    static bool done_raycast = false;
+    if (done_raycast)
+        return;
+    done_raycast = true;
+
+#ifdef USE_LOS_TABLES
+    if (los_builtin_table.num_rays)
+    {
+        _load_los_table(los_builtin_table);
+        return;
+    }
+#endif
+    _cast_rays();
+}
+
+// The current rays as C++ source for a los_table named los_builtin_table.
+// Doubles are printed with enough digits to read back exactly.
+static string _los_table_source()
+{
+    map<unsigned int, unsigned int> ray_by_start;
+    for (unsigned int i = 0; i < fullrays.size(); ++i)
+        ray_by_start[fullrays[i].start] = i;
+
+    string src = "static const los_table_ray los_rays[] =\n{\n";
+    for (const los_ray &ray : fullrays)
+    {
+        src += make_stringf("    { %.17g, %.17g, %.17g, %.17g, %u, %u },\n",
+                            ray.r.start.x, ray.r.start.y,
+                            ray.r.dir.x, ray.r.dir.y, ray.start, ray.length);
+    }
+    src += "};\n\nstatic const los_table_coord los_coords[] =\n{\n";
+    for (const coord_def &c : ray_coords)
+        src += make_stringf("    { %d, %d },\n", c.x, c.y);
+    src += "};\n\nstatic const los_table_cellray los_cellrays[] =\n{\n";
+    unsigned int n_min_rays = 0;
+    for (quadrant_iterator qi; qi; ++qi)
+        for (const cellray &c : min_cellrays(*qi))
+        {
+            src += make_stringf("    { %u, %u, %d, %s },\n",
+                                ray_by_start[c.ray.start], c.end,
+                                c.imbalance,
+                                c.first_diag ? "true" : "false");
+            n_min_rays++;
+        }
+    src += "};\n\n";
+    src += make_stringf("const los_table los_builtin_table =\n{\n"
+                        "    %u, los_rays,\n    %u, los_coords,\n"
+                        "    %u, los_cellrays,\n};\n",
+                        (unsigned int)fullrays.size(),
+                        (unsigned int)ray_coords.size(), n_min_rays);
+    return src;
+}
+
+/**
+ * Write the LOS ray tables out as a C++ source file.
+ *
+ * @param f  The file to write los-tables.cc to.
+ */
+void write_los_tables(FILE *f)
+{
+    raycast();
+    fprintf(f, "// Generated by util/los-tables; do not edit.\n\n"
+               "#include \"AppHdr.h\"\n\n#include \"los-tables.h\"\n\n"
+               "%s", _los_table_source().c_str());
+}
+
+/**
+ * Check the ray tables in use against a fresh calculation.
+ *
+ * @return Whether casting the rays again gives exactly the same tables.
+ *         Afterwards, the freshly cast rays are in use.
+ */
+bool check_los_tables()
+{
+    raycast();
+    const string in_use = _los_table_source();
+    _cast_rays();
+    return _los_table_source() == in_use;
+}
+
+
+
+/**
+ * Which cells can be hidden from the origin by the given cell?
+ *
+ * @param p  A cell in the positive quadrant, relative to the origin.
+ * @return   The (positive quadrant) cells whose visibility from the origin
+ *           can change when the opacity of p changes. p itself is not
+ *           included.
+ */
+const vector<coord_def>& los_shadow(const coord_def& p)
+{
+    ASSERT(p.x >= 0);
+    ASSERT(p.y >= 0);
+    ASSERT(p.rdist() <= LOS_MAX_RANGE);
+
+    raycast();
+    return shadows(p);
 }
 
 static int _imbalance(ray_def ray, const coord_def& target)
@@ -792,6 +975,7 @@ bool cell_see_cell_nocache(const coord_def& p1, const coord_def& p2)
 // Smoke will now only block LOS after two cells of smoke. This is
 // done by updating with a second array.
 
+#if !defined(USE_PACKED_LOS) || defined(DEBUG)
 static void _losight_quadrant(los_grid& sh, const los_param& dat, int sx, int sy)
 {
     const unsigned int num_cellrays = cellray_ends.size();
@@ -836,6 +1020,132 @@ static void _losight_quadrant(los_grid& sh, const los_param& dat, int sx, int sy
         }
     }
 }
+#endif
+
+#ifdef USE_PACKED_LOS
+// The packed engine does the same as _losight_quadrant(), but collects
+// blockers and visible cells as row bitmasks (bit x of row y stands for
+// the cell (sx*x, sy*y)) and combines the blockrays of whole rows of
+// cellrays at once, 256 at a time when AVX2 is available.
+
+// dead |= rays
+static inline void _kill_rays(uint64_t *dead, const uint64_t *rays)
+{
+#ifdef __AVX2__
+    for (int i = 0; i < packed_words; i += 4)
+    {
+        __m256i *d = reinterpret_cast<__m256i *>(dead + i);
+        const __m256i r =
+            _mm256_loadu_si256(reinterpret_cast<const __m256i *>(rays + i));
+        _mm256_storeu_si256(d, _mm256_or_si256(_mm256_loadu_si256(d), r));
+    }
+#else
+    for (int i = 0; i < packed_words; ++i)
+        dead[i] |= rays[i];
+#endif
+}
+
+// dead |= smoke & rays; smoke |= rays
+static inline void _smoke_rays(uint64_t *dead, uint64_t *smoke,
+                               const uint64_t *rays)
+{
+#ifdef __AVX2__
+    for (int i = 0; i < packed_words; i += 4)
+    {
+        __m256i *d = reinterpret_cast<__m256i *>(dead + i);
+        __m256i *s = reinterpret_cast<__m256i *>(smoke + i);
+        const __m256i r =
+            _mm256_loadu_si256(reinterpret_cast<const __m256i *>(rays + i));
+        const __m256i sv = _mm256_loadu_si256(s);
+        _mm256_storeu_si256(d, _mm256_or_si256(_mm256_loadu_si256(d),
+                                               _mm256_and_si256(sv, r)));
+        _mm256_storeu_si256(s, _mm256_or_si256(sv, r));
+    }
+#else
+    for (int i = 0; i < packed_words; ++i)
+    {
+        dead[i] |= smoke[i] & rays[i];
+        smoke[i] |= rays[i];
+    }
+#endif
+}
+
+// Index of the lowest set bit of a non-zero word.
+static inline int _lowest_bit(uint64_t w)
+{
+#ifdef __GNUC__
+    return __builtin_ctzll(w);
+#else
+    int i = 0;
+    while (!(w & 1))
+        w >>= 1, i++;
+    return i;
+#endif
+}
+
+static void _losight_quadrant_packed(los_grid& sh, const los_param& dat,
+                                     int sx, int sy)
+{
+    uint64_t bounds_rows[LOS_MAX_RANGE + 1] = { 0 };
+    uint64_t opaque_rows[LOS_MAX_RANGE + 1] = { 0 };
+    uint64_t half_rows[LOS_MAX_RANGE + 1] = { 0 };
+
+    for (quadrant_iterator qi; qi; ++qi)
+    {
+        coord_def p = coord_def(sx*(qi->x), sy*(qi->y));
+        if (!dat.los_bounds(p))
+            continue;
+
+        const uint64_t bit = (uint64_t)1 << qi->x;
+        bounds_rows[qi->y] |= bit;
+        switch (dat.opacity(p))
+        {
+        case OPC_OPAQUE:
+            opaque_rows[qi->y] |= bit;
+            break;
+        case OPC_HALF:
+            half_rows[qi->y] |= bit;
+            break;
+        default:
+            break;
+        }
+    }
+
+    uint64_t *dead = packed_dead.data();
+    uint64_t *smoke = packed_smoke.data();
+    copy(packed_padding.begin(), packed_padding.end(), dead);
+    fill(packed_smoke.begin(), packed_smoke.end(), 0);
+
+    // A ray dies at its first opaque cell or its second smoky one, so
+    // the order in which the blockers are applied doesn't matter.
+    for (int y = 0; y <= LOS_MAX_RANGE; ++y)
+    {
+        for (uint64_t row = opaque_rows[y]; row; row &= row - 1)
+        {
+            _kill_rays(dead,
+                       &packed_blockrays[_packed_index(_lowest_bit(row), y)]);
+        }
+        for (uint64_t row = half_rows[y]; row; row &= row - 1)
+        {
+            _smoke_rays(dead, smoke,
+                        &packed_blockrays[_packed_index(_lowest_bit(row), y)]);
+        }
+    }
+
+    // The end cells of the surviving rays are visible.
+    uint64_t vis_rows[LOS_MAX_RANGE + 1] = { 0 };
+    for (int w = 0; w < packed_words; ++w)
+        for (uint64_t alive = ~dead[w]; alive; alive &= alive - 1)
+        {
+            const coord_def &end = cellray_ends[w * 64 + _lowest_bit(alive)];
+            vis_rows[end.y] |= (uint64_t)1 << end.x;
+        }
+
+    for (int y = 0; y <= LOS_MAX_RANGE; ++y)
+        for (uint64_t row = vis_rows[y] & bounds_rows[y]; row; row &= row - 1)
+            sh(coord_def(sx * _lowest_bit(row), sy * y)) = true;
+}
+#endif
 
 struct los_param_funcs : public los_param
 {
@@ -872,12 +1182,28 @@ void losight(los_grid& sh, const coord_def& center,
 
     const int quadrant_x[4] = {  1, -1, -1,  1 };
     const int quadrant_y[4] = {  1,  1, -1, -1 };
+#ifdef USE_PACKED_LOS
+    for (int q = 0; q < 4; ++q)
+        _losight_quadrant_packed(sh, dat, quadrant_x[q], quadrant_y[q]);
+#else
     for (int q = 0; q < 4; ++q)
         _losight_quadrant(sh, dat, quadrant_x[q], quadrant_y[q]);
+#endif
 
     // Center is always visible.
     const coord_def o = coord_def(0,0);
     sh(o) = true;
+
+#if defined(USE_PACKED_LOS) && defined(DEBUG)
+    // The packed engine must agree exactly with the reference one.
+    los_grid check;
+    check.init(false);
+    for (int q = 0; q < 4; ++q)
+        _losight_quadrant(check, dat, quadrant_x[q], quadrant_y[q]);
+    check(o) = true;
+    for (rectangle_iterator ri(o, LOS_MAX_RANGE); ri; ++ri)
+        ASSERT(sh(*ri) == check(*ri));
+#endif
 }
 
 opacity_type mons_opacity(const monster* mon, los_type how)
@@ -38,10 +38,13 @@ int num_feats_between(const coord_def& source, const coord_def& target,
                       bool exclude_endpoints = true,
                       bool just_check = false);
 bool cell_see_cell_nocache(const coord_def& p1, const coord_def& p2);
+const vector<coord_def>& los_shadow(const coord_def& p);
 
 typedef SquareArray<bool, LOS_MAX_RANGE> los_grid;
 
 void clear_rays_on_exit();
+void write_los_tables(FILE *f);
+bool check_los_tables();
 void losight(los_grid& sh, const coord_def& center,
              const opacity_func &opc = opc_default,
              const circle_def &bds = BDS_DEFAULT);
@@ -5,7 +5,9 @@
 #include "coord.h"
 #include "coordit.h"
 #include "libutil.h"
+#include "los.h"
 #include "los-def.h"
+#include "player.h"
 
 #define LOS_KNOWN 5
 
@@ -17,6 +19,9 @@ typedef halflos_t globallos_t[GXM][GYM];
 
 static globallos_t globallos;
 
+static los_cache_stats cache_stats;
+static unsigned int cache_generation = 0;
+
 static losfield_t* _lookup_globallos(const coord_def& p, const coord_def& q)
 {
     COMPILE_CHECK(LOS_KNOWN * 2 <= sizeof(losfield_t) * 8);
@@ -58,24 +63,74 @@ static void _save_los(los_def* los, los_type l)
         }
 }
 
-// Opacity at p has changed.
+// Opacity at p has changed. Only forget those pairs of cells that have a
+// cellray passing through p; everything else stays cached.
 void invalidate_los_around(const coord_def& p)
 {
-    int x1 = max(p.x - LOS_MAX_RANGE, 0);
-    int y1 = max(p.y - LOS_MAX_RANGE, 0);
-    int x2 = min(p.x, GXM - 1);
-    int y2 = min(p.y + LOS_MAX_RANGE, GYM - 1);
-    for (int y = y1; y <= y2; y++)
-        for (int x = x1; x <= x2; x++)
-            memset(globallos[x][y], 0, sizeof(halflos_t));
+    cache_stats.region_invalidations++;
+    cache_generation++;
+    for (rectangle_iterator ci(p, LOS_MAX_RANGE); ci; ++ci)
+    {
+        const coord_def c = *ci;
+        // Offset of the changed cell as seen from c.
+        const coord_def d = p - c;
+        if (d.origin())
+            continue;
+
+        // Cells on an axis belong to two (or four) quadrants.
+        for (int sx = -1; sx <= 1; sx += 2)
+            for (int sy = -1; sy <= 1; sy += 2)
+            {
+                if (d.x * sx < 0 || d.y * sy < 0)
+                    continue;
+
+                const coord_def qd(d.x * sx, d.y * sy);
+                for (const coord_def &s : los_shadow(qd))
+                {
+                    losfield_t* flags =
+                        _lookup_globallos(c, c + coord_def(s.x * sx, s.y * sy));
+                    if (flags && *flags)
+                    {
+                        *flags = 0;
+                        cache_stats.invalidated_entries++;
+                    }
+                }
+            }
+    }
 }
 
 void invalidate_los()
 {
+    cache_stats.full_invalidations++;
+    cache_generation++;
     for (rectangle_iterator ri(0); ri; ++ri)
         memset(globallos[ri->x][ri->y], 0, sizeof(halflos_t));
 }
 
+unsigned int los_generation()
+{
+    return cache_generation;
+}
+
+turn_cache_stamp turn_cache_stamp::current(unsigned int world)
+{
+    turn_cache_stamp stamp;
+    stamp.turn = you.num_turns;
+    stamp.world = world;
+    stamp.los = cache_generation;
+    return stamp;
+}
+
+const los_cache_stats& get_los_cache_stats()
+{
+    return cache_stats;
+}
+
+void reset_los_cache_stats()
+{
+    cache_stats = los_cache_stats();
+}
+
 static void _update_globallos_at(const coord_def& p, los_type l)
 {
     switch (l)
@@ -131,7 +186,12 @@ bool cell_see_cell(const coord_def& p, const coord_def& q, los_type l)
         return false; // outside range
 
     if (!(*flags & (l << LOS_KNOWN)))
+    {
+        cache_stats.misses++;
         _update_globallos_at(p, l);
+    }
+    else
+        cache_stats.hits++;
 
     ASSERT(*flags & (l << LOS_KNOWN));
     return *flags & l;
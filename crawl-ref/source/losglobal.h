@@ -2,7 +2,41 @@
 
 #include "los-type.h"
 
+// Counters for the global cell_see_cell() cache.
+struct los_cache_stats
+{
+    uint64_t hits = 0;
+    uint64_t misses = 0;
+    // Cell pairs forgotten by invalidate_los_around().
+    uint64_t invalidated_entries = 0;
+    uint64_t region_invalidations = 0;
+    uint64_t full_invalidations = 0;
+};
+
 void invalidate_los_around(const coord_def& p);
 void invalidate_los();
 
+// Bumped whenever any cached LOS information is thrown away.
+unsigned int los_generation();
+
+// For caches of things worked out during a player turn: they're only good
+// while the turn, the LOS generation and the cache's own generation, bumped
+// for whatever else it depends on, stay the same.
+struct turn_cache_stamp
+{
+    int turn = -1;
+    unsigned int world = 0;
+    unsigned int los = 0;
+
+    static turn_cache_stamp current(unsigned int world);
+
+    bool operator==(const turn_cache_stamp &o) const
+    {
+        return turn == o.turn && world == o.world && los == o.los;
+    }
+};
+
+const los_cache_stats& get_los_cache_stats();
+void reset_los_cache_stats();
+
 bool cell_see_cell(const coord_def& p, const coord_def& q, los_type l);
@@ -129,6 +129,7 @@
 #include "stash.h"
 #include "state.h"
 #include "stringutil.h"
+#include "syscalls.h"
 #include "tags.h"
 #include "target.h"
 #include "terrain.h"
@@ -475,6 +476,8 @@ static void _show_commandline_options_help()
     puts("  -macro <dir>          directory to save/find macro.txt");
     puts("  -version              Crawl version (and compilation info)");
     puts("  -save-version <name>  Save file version for the given player");
+    puts("  -compact-save <name>  rewrite the save without its unused space");
+    puts("  -check-los-tables     compare the LOS ray tables with a fresh calculation");
     puts("  -sprint               select Sprint");
     puts("  -sprint-map <name>    preselect a Sprint map");
     puts("  -tutorial             select the Tutorial");
@@ -913,6 +916,29 @@ static void _update_place_info()
     curr_PlaceInfo.assert_validity();
 }
 
+// How long the player has to leave the keyboard alone before levels are
+// built ahead of time.
+static const int SPECULATION_IDLE_MS = 250;
+
+// Shows the player where things stand, then waits up to `ms` for a key.
+// Returns true if none came.
+static bool _idle_for(int ms)
+{
+#ifdef USE_TILE
+    tiles.redraw();
+#endif
+#ifdef USE_TILE_WEB
+    tiles.flush_messages();
+#endif
+    for (int waited = 0; waited < ms; waited += 10)
+    {
+        if (has_pending_input() || kbhit())
+            return false;
+        usleep(10 * 1000);
+    }
+    return !has_pending_input() && !kbhit();
+}
+
 //
 //  This function handles the player's input. It's called from main(),
 //  from inside an endless loop.
@@ -1055,6 +1081,12 @@ static void _input()
         // Flush messages and display message window.
         msgwin_new_cmd();
 
+        // If the player takes a moment over the next command, get ahead on
+        // the levels they might go to next.
+        const vector<level_id> ahead = speculation_candidates();
+        if (!ahead.empty() && _idle_for(SPECULATION_IDLE_MS))
+            speculate_levels(ahead);
+
         crawl_state.waiting_for_command = true;
         c_input_reset(true);
 
@@ -13,6 +13,7 @@
 #include "artefact.h"
 #include "art-enum.h"
 #include "attitude-change.h"
+#include "beam.h"
 #include "bloodspatter.h"
 #include "branch.h"
 #include "butcher.h"
@@ -50,6 +51,7 @@
 #include "mon-abil.h"
 #include "mon-behv.h"
 #include "mon-gear.h"
+#include "mon-pathfind.h"
 #include "mon-place.h"
 #include "mon-poly.h"
 #include "mon-speak.h"
@@ -3096,6 +3098,9 @@ void end_flayed_effect(monster* ghost)
 void monster_cleanup(monster* mons)
 {
     crawl_state.mon_gone(mons);
+    invalidate_tracer_cache();
+    if (mons->is_stationary())
+        invalidate_pathfind_fields();
 
     if (mons->has_ench(ENCH_AWAKEN_FOREST))
     {
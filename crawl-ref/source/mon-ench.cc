@@ -12,6 +12,7 @@
 #include "act-iter.h"
 #include "areas.h"
 #include "attitude-change.h"
+#include "beam.h"
 #include "bloodspatter.h"
 #include "cloud.h"
 #include "coordit.h"
@@ -175,6 +176,7 @@ bool monster::add_ench(const mon_enchant &ench)
         new_enchantment = true;
         added = &(enchantments[ench.ench] = ench);
         ench_cache.set(ench.ench, true);
+        invalidate_tracer_cache();
     }
 
     // If the duration is not set, we must calculate it (depending on the
@@ -341,6 +343,7 @@ bool monster::del_ench(enchant_type ench, bool quiet, bool effect)
 
     enchantments.erase(et);
     ench_cache.set(et, false);
+    invalidate_tracer_cache();
     if (effect)
         remove_enchantment_effect(me, quiet);
     return true;
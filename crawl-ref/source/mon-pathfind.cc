@@ -2,15 +2,20 @@
 
 #include "mon-pathfind.h"
 
+#include <chrono>
+
+#include "act-iter.h"
 #include "directn.h"
 #include "env.h"
 #include "los.h"
+#include "losglobal.h"
 #include "mon-movetarget.h"
 #include "mon-place.h"
 #include "religion.h"
 #include "state.h"
 #include "terrain.h"
 #include "traps.h"
+#include "unwind.h"
 
 /////////////////////////////////////////////////////////////////////////////
 // monster_pathfind
@@ -28,6 +33,72 @@
 // then there's no path that matches the requirements fed into monster_pathfind.
 // (These requirements are usually preference of habitat of a specific monster
 // or a limit of the distance between start and any grid on the path.)
+//
+// Monsters pathfind a lot, so the arrays used for a search are kept around
+// between searches in a pathfind_workspace. Distances are stamped with the
+// search that set them, so nothing needs to be cleared for a new search.
+
+// Grid positions in the hash are stored as x + y * GXM.
+typedef uint16_t pathfind_cell;
+COMPILE_CHECK(GXM * GYM <= 65536);
+
+static pathfind_cell _cell_index(const coord_def &c)
+{
+    return c.x + c.y * GXM;
+}
+
+static coord_def _cell_coord(pathfind_cell i)
+{
+    return coord_def(i % GXM, i / GXM);
+}
+
+struct pathfind_workspace
+{
+    // Distances are only valid where stamp matches generation.
+    unsigned int generation = 0;
+    FixedArray<unsigned int, GXM, GYM> stamp;
+    // The array of distances from start to any already tried point.
+    FixedArray<int, GXM, GYM> dist;
+    // An array to store where we came from on a given shortest path.
+    FixedArray<int8_t, GXM, GYM> prev;
+
+    // The positions still to be looked at, bucketed by estimated total path
+    // length. Positions only ever move to a lower bucket, and rather than
+    // being searched for, the outdated entry in the old bucket is skipped
+    // once it comes up.
+    vector<vector<pathfind_cell>> hash;
+    // Only buckets below this may be non-empty.
+    size_t hash_used = 0;
+
+    pathfind_workspace() : stamp(0) { }
+
+    void new_search()
+    {
+        if (!++generation)
+        {
+            stamp.init(0);
+            generation = 1;
+        }
+
+        for (size_t i = 0; i < hash_used; ++i)
+            hash[i].clear();
+        hash_used = 0;
+    }
+};
+
+// Workspaces not in use by any monster_pathfind. Usually there is just the
+// one, but pathfinds can be nested.
+static vector<unique_ptr<pathfind_workspace>> spare_workspaces;
+
+static pathfind_workspace *_get_workspace()
+{
+    if (spare_workspaces.empty())
+        return new pathfind_workspace;
+
+    pathfind_workspace *ws = spare_workspaces.back().release();
+    spare_workspaces.pop_back();
+    return ws;
+}
 
 int mons_tracking_range(const monster* mon)
 {
@@ -68,12 +139,13 @@ int mons_tracking_range(const monster* mon)
 monster_pathfind::monster_pathfind()
     : mons(nullptr), start(), target(), pos(), allow_diagonals(true),
       traverse_unmapped(false), range(0), min_length(0), max_length(0),
-      dist(), prev(), hash()
+      ws(_get_workspace())
 {
 }
 
 monster_pathfind::~monster_pathfind()
 {
+    spare_workspaces.emplace_back(ws);
 }
 
 void monster_pathfind::set_range(int r)
@@ -84,7 +156,7 @@ void monster_pathfind::set_range(int r)
 
 coord_def monster_pathfind::next_pos(const coord_def &c) const
 {
-    return c + Compass[prev[c.x][c.y]];
+    return c + Compass[ws->prev(c)];
 }
 
 // The main method in the monster_pathfind class.
@@ -112,6 +184,10 @@ bool monster_pathfind::init_pathfind(const monster* mon, coord_def dest,
         return true;
     }
 
+    bool found;
+    if (!msg && shared_pathfind(found))
+        return found;
+
     return start_pathfind(msg);
 }
 
@@ -140,11 +216,10 @@ bool monster_pathfind::start_pathfind(bool msg)
     //       a wall.
 
     max_length = min_length = grid_distance(pos, target);
-    for (int i = 0; i < GXM; i++)
-        for (int j = 0; j < GYM; j++)
-            dist[i][j] = INFINITE_DISTANCE;
+    ws->new_search();
 
-    dist[pos.x][pos.y] = 0;
+    ws->stamp(pos) = ws->generation;
+    ws->dist(pos) = 0;
 
     bool success = false;
     do
@@ -214,8 +289,8 @@ bool monster_pathfind::calc_path_to_neighbours()
         if (range && estimated_cost(npos) > range)
             continue;
 
-        distance = dist[pos.x][pos.y] + travel_cost(npos);
-        old_dist = dist[npos.x][npos.y];
+        distance = ws->dist(pos) + travel_cost(npos);
+        old_dist = get_dist(npos);
 
         // Also bail out if this would make the path longer than twice the
         // allowed distance from the target. (This factor may need tuning.)
@@ -257,7 +332,8 @@ bool monster_pathfind::calc_path_to_neighbours()
             }
 
             // Update distance start->pos.
-            dist[npos.x][npos.y] = distance;
+            ws->stamp(npos) = ws->generation;
+            ws->dist(npos) = distance;
 
             // Set backtracking information.
             // Converts the Compass direction to its counterpart.
@@ -265,7 +341,7 @@ bool monster_pathfind::calc_path_to_neighbours()
             //      7  .  3   ==>   3  .  7       e.g. (3 + 4) % 8          = 7
             //      6  5  4         2  1  0            (7 + 4) % 8 = 11 % 8 = 3
 
-            prev[npos.x][npos.y] = (dir + 4) % 8;
+            ws->prev(npos) = (dir + 4) % 8;
 
             // Are we finished?
             if (npos == target)
@@ -287,17 +363,25 @@ bool monster_pathfind::get_best_position()
 {
     for (int i = min_length; i <= max_length; i++)
     {
-        if (!hash[i].empty())
-        {
-            if (i > min_length)
-                min_length = i;
+        if (i >= (int) ws->hash_used)
+            break;
 
-            vector<coord_def> &vec = hash[i];
+        vector<pathfind_cell> &vec = ws->hash[i];
+        while (!vec.empty())
+        {
             // Pick the last position pushed into the vector as it's most
             // likely to be close to the target.
-            pos = vec[vec.size()-1];
+            const coord_def c = _cell_coord(vec.back());
             vec.pop_back();
 
+            // Skip positions that have since moved to a lower bucket.
+            if (get_dist(c) + estimated_cost(c) != i)
+                continue;
+
+            if (i > min_length)
+                min_length = i;
+            pos = c;
+
 #ifdef DEBUG_PATHFIND
             mprf("Returning (%d, %d) as best pos with total dist %d.",
                  pos.x, pos.y, min_length);
@@ -331,7 +415,7 @@ vector<coord_def> monster_pathfind::backtrack()
     int dir;
     do
     {
-        dir = prev[pos.x][pos.y];
+        dir = ws->prev(pos);
         pos = pos + Compass[dir];
         ASSERT_IN_BOUNDS(pos);
 #ifdef DEBUG_PATHFIND
@@ -498,26 +582,349 @@ int monster_pathfind::estimated_cost(coord_def p)
     return grid_distance(p, target);
 }
 
+// The distance from start to p found so far.
+int monster_pathfind::get_dist(const coord_def& p) const
+{
+    return ws->stamp(p) == ws->generation ? ws->dist(p) : INFINITE_DISTANCE;
+}
+
 void monster_pathfind::add_new_pos(coord_def npos, int total)
 {
-    hash[total].push_back(npos);
+    ASSERT(total >= 0);
+    const size_t bucket = total;
+    if (bucket >= ws->hash.size())
+        ws->hash.resize(bucket + 1);
+    if (bucket >= ws->hash_used)
+        ws->hash_used = bucket + 1;
+
+    ws->hash[bucket].push_back(_cell_index(npos));
 }
 
 void monster_pathfind::update_pos(coord_def npos, int total)
 {
-    // Find hash position of old distance and delete it,
-    // then call_add_new_pos.
-    int old_total = dist[npos.x][npos.y] + estimated_cost(npos);
+    // The entry in the bucket of the old distance is left where it is;
+    // get_best_position() knows to skip it.
+    add_new_pos(npos, total);
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// Shared distance fields
+//
+// When many monsters hunt the same target, they would each run their own
+// search towards it. Instead, once a second monster of the same kind asks
+// for a path to the same target within a turn, a single search is run
+// backwards from the target over the whole level. Every monster of that
+// kind then just follows the field downhill to get its path.
+//
+// Monsters share a field only if they move the same way: same (zombie base)
+// type, flight, attitude, ways through doors and traps they won't step on.
+// Whether a monster thinks a trap is safe can depend on its position and
+// health (monster::is_trap_safe), but those don't change during a search, so
+// it's worked out once per trap when the monster asks. Monsters with
+// position-dependent rules (wall clingers, the thorn hunter and wandering
+// mushroom hacks in traversable(), and friendly summons kept in sight) always
+// use A*.
+//
+// Fields are only good within a turn, and only as long as neither the
+// terrain nor a stationary monster changes. Those call
+// invalidate_pathfind_fields().
+
+// Everything about a monster that traversable() and travel_cost() look at.
+struct pathfind_class
+{
+    monster_type type;
+    monster_type base_type;
+    bool airborne;
+    bool friendly;
+    // The ways through a closed door that mons_can_traverse() allows, apart
+    // from door_restrict markers, which are the same for everyone.
+    bool walks;
+    bool opens_doors;
+    bool eats_doors;
+    bool crashes_doors;
+    // The traps it won't step on, in env.trap order.
+    vector<coord_def> avoided_traps;
+
+    explicit pathfind_class(const monster &mon)
+        : type(mon.type), base_type(mons_base_type(mon)),
+          airborne(mon.airborne()), friendly(mon.friendly()),
+          walks(mon.can_pass_through_feat(DNGN_FLOOR)),
+          opens_doors((mons_itemuse(mon) & MU_DOOR) && !mon.friendly()),
+          eats_doors(mons_eats_items(mon)
+                     || mons_class_flag(base_type, M_EAT_DOORS)),
+          crashes_doors(mons_class_flag(base_type, M_CRASH_DOORS))
+    {
+        for (const auto &entry : env.trap)
+            if (!mon.is_trap_safe(entry.first))
+                avoided_traps.push_back(entry.first);
+    }
+
+    bool operator==(const pathfind_class &o) const
+    {
+        return type == o.type && base_type == o.base_type
+               && airborne == o.airborne && friendly == o.friendly
+               && walks == o.walks && opens_doors == o.opens_doors
+               && eats_doors == o.eats_doors
+               && crashes_doors == o.crashes_doors
+               && avoided_traps == o.avoided_traps;
+    }
+};
+
+struct pathfind_field
+{
+    coord_def target;
+    pathfind_class cls;
+    // How often a path to target was asked for before the field was built.
+    int requests;
+    bool built;
+    // The travel cost from each position to target.
+    FixedArray<int, GXM, GYM> dist;
+    // The Compass direction of the next step towards target.
+    FixedArray<int8_t, GXM, GYM> next;
+
+    pathfind_field(const coord_def &t, const pathfind_class &c)
+        : target(t), cls(c), requests(0), built(false)
+    {
+    }
+};
+
+// A few targets are popular at once at most: the player and a couple of
+// allies or summons.
+static const size_t PATHFIND_FIELD_CACHE_SIZE = 8;
+
+static vector<unique_ptr<pathfind_field>> pathfind_fields;
+static size_t pathfind_field_next = 0;
+static turn_cache_stamp pathfind_stamp;
+static unsigned int pathfind_world_generation = 0;
+static pathfind_field_stats field_stats;
+static bool pathfind_fields_enabled = true;
 
-    vector<coord_def> &vec = hash[old_total];
-    for (unsigned int i = 0; i < vec.size(); i++)
+void invalidate_pathfind_fields()
+{
+    pathfind_world_generation++;
+}
+
+const pathfind_field_stats& get_pathfind_field_stats()
+{
+    return field_stats;
+}
+
+void reset_pathfind_field_stats()
+{
+    field_stats = pathfind_field_stats();
+}
+
+static pathfind_field &_find_field(const coord_def &target,
+                                   const pathfind_class &cls)
+{
+    const turn_cache_stamp stamp =
+        turn_cache_stamp::current(pathfind_world_generation);
+    if (!(stamp == pathfind_stamp))
     {
-        if (vec[i] == npos)
+        pathfind_fields.clear();
+        pathfind_field_next = 0;
+        pathfind_stamp = stamp;
+    }
+
+    for (auto &field : pathfind_fields)
+        if (field->target == target && field->cls == cls)
+            return *field;
+
+    unique_ptr<pathfind_field> field(new pathfind_field(target, cls));
+    if (pathfind_fields.size() < PATHFIND_FIELD_CACHE_SIZE)
+    {
+        pathfind_fields.push_back(move(field));
+        return *pathfind_fields.back();
+    }
+
+    pathfind_fields[pathfind_field_next] = move(field);
+    pathfind_field &result = *pathfind_fields[pathfind_field_next];
+    pathfind_field_next = (pathfind_field_next + 1)
+                          % PATHFIND_FIELD_CACHE_SIZE;
+    return result;
+}
+
+// Tries to answer the search set up by init_pathfind() from a shared field.
+// Returns false if A* has to be used after all; otherwise found is set to
+// whether there's a path, and if so backtrack() will return it.
+bool monster_pathfind::shared_pathfind(bool &found)
+{
+    if (!pathfind_fields_enabled
+        || !mons || !allow_diagonals || traverse_unmapped || traverse_in_sight
+        || mons->can_cling_to_walls()
+        || mons->type == MONS_THORN_HUNTER
+        || mons->type == MONS_WANDERING_MUSHROOM)
+    {
+        return false;
+    }
+
+    pathfind_field &field = _find_field(target, pathfind_class(*mons));
+    if (!field.built)
+    {
+        // Not worth it for a single monster.
+        if (++field.requests < 2)
         {
-            vec.erase(vec.begin() + i);
-            break;
+            field_stats.misses++;
+            return false;
         }
+
+        fill_field(field);
+        field.built = true;
+        field_stats.builds++;
     }
+    field_stats.hits++;
 
-    add_new_pos(npos, total);
+    if (field.dist(start) == INFINITE_DISTANCE)
+    {
+        found = false;
+        return true;
+    }
+
+    // The field gives a shortest path ignoring range. If that one stays
+    // within range, it's as good as anything A* would find; otherwise, A*
+    // may still find a longer one that does.
+    if (range && field.dist(start) > range * 2)
+        return false;
+
+    for (coord_def c = start; c != target; )
+    {
+        const int dir = field.next(c);
+        c += Compass[dir];
+        if (range && estimated_cost(c) > range)
+            return false;
+
+        // Set backtracking information, as calc_path_to_neighbours() does.
+        ws->prev(c) = (dir + 4) % 8;
+    }
+
+    found = true;
+    return true;
+}
+
+// Runs a Dijkstra search backwards from target over the whole level, using
+// the same traversable() and travel_cost() as A*.
+void monster_pathfind::fill_field(pathfind_field &field)
+{
+    ws->new_search();
+    field.dist.init(INFINITE_DISTANCE);
+
+    ws->stamp(target) = ws->generation;
+    ws->dist(target) = 0;
+    add_new_pos(target, 0);
+
+    // Costs are positive, so positions are only ever added to buckets past
+    // the current one.
+    for (size_t d = 0; d < ws->hash_used; ++d)
+    {
+        for (size_t i = 0; i < ws->hash[d].size(); ++i)
+        {
+            const coord_def q = _cell_coord(ws->hash[d][i]);
+            // Skip positions that have since moved to a lower bucket.
+            if (get_dist(q) != (int) d)
+                continue;
+
+            field.dist(q) = d;
+
+            // As with A*, the target itself need not be traversable.
+            pos = q;
+            if (q != target && !traversable(q))
+                continue;
+
+            // The cost of stepping onto q from any of its neighbours.
+            const int cost = d + travel_cost(q);
+            for (int dir = 0; dir < 8; ++dir)
+            {
+                const coord_def p = q + Compass[dir];
+                if (!in_bounds(p))
+                    continue;
+
+                const int old_dist = get_dist(p);
+                // On a tie, prefer orthogonal steps, to reduce zigzagging.
+                if (cost < old_dist
+                    || (cost == old_dist && !(dir % 2) && field.next(p) % 2))
+                {
+                    field.next(p) = (dir + 4) % 8;
+                }
+
+                if (cost < old_dist)
+                {
+                    ws->stamp(p) = ws->generation;
+                    ws->dist(p) = cost;
+                    add_new_pos(p, cost);
+                }
+            }
+        }
+    }
+}
+
+// The cost of following path from start to target, as travel_cost() counts
+// it, or -1 if some step of it can't be taken.
+int monster_pathfind::path_cost(const vector<coord_def> &path)
+{
+    if (path.empty() || path.front() != start || path.back() != target)
+        return -1;
+
+    int cost = 0;
+    for (size_t i = 1; i < path.size(); ++i)
+    {
+        pos = path[i - 1];
+        const coord_def c = path[i];
+        if (grid_distance(pos, c) != 1
+            || (!allow_diagonals && pos.x != c.x && pos.y != c.y)
+            || (c != target && !traversable(c)))
+        {
+            return -1;
+        }
+        cost += travel_cost(c);
+    }
+    return cost;
+}
+
+// How long it takes every monster on the level to find a path to the player,
+// once each with A* alone and with the shared fields, and how many of the
+// paths taken from the fields are not valid or cost more than the ones A*
+// finds. Paths of the same cost can differ, as ties are broken differently.
+pathfind_field_bench bench_pathfind_fields(int iterations)
+{
+    pathfind_field_bench bench;
+    if (iterations < 1)
+        return bench;
+
+    typedef chrono::steady_clock bench_clock;
+    auto run = [iterations](bool shared, vector<int> &costs)
+    {
+        unwind_bool enabled(pathfind_fields_enabled, shared);
+        bench_clock::duration time(0);
+        for (int i = 0; i < iterations; ++i)
+        {
+            // Include building the fields in every round.
+            invalidate_pathfind_fields();
+            costs.clear();
+            bench_clock::duration round(0);
+            for (monster_iterator mi; mi; ++mi)
+            {
+                const bench_clock::time_point start = bench_clock::now();
+                monster_pathfind mp;
+                mp.set_range(mons_tracking_range(*mi));
+                const bool found = mp.init_pathfind(*mi, you.pos());
+                const vector<coord_def> path = found ? mp.backtrack()
+                                                     : vector<coord_def>();
+                round += bench_clock::now() - start;
+                costs.push_back(found ? mp.path_cost(path) : -2);
+            }
+            time += round;
+        }
+        return chrono::duration<double, micro>(time).count() / iterations;
+    };
+
+    vector<int> astar, fields;
+    bench.astar_us = run(false, astar);
+    const pathfind_field_stats before = field_stats;
+    bench.shared_us = run(true, fields);
+    bench.builds = field_stats.builds - before.builds;
+    bench.hits = field_stats.hits - before.hits;
+    bench.searches = astar.size();
+    for (size_t i = 0; i < astar.size(); ++i)
+        bench.mismatches += fields[i] == -1 || astar[i] != fields[i];
+    return bench;
 }
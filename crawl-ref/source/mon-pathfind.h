@@ -1,15 +1,50 @@
 #pragma once
 
 class monster;
+struct pathfind_field;
+struct pathfind_workspace;
 
 int mons_tracking_range(const monster* mon);
 
+// Counters for the distance fields shared by monsters chasing one target.
+struct pathfind_field_stats
+{
+    // Searches answered from a field.
+    uint64_t hits = 0;
+    // Searches that could have used a field, but ran A* because nobody
+    // else had looked for the target yet.
+    uint64_t misses = 0;
+    uint64_t builds = 0;
+};
+
+struct pathfind_field_bench
+{
+    double astar_us = 0;
+    double shared_us = 0;
+    int searches = 0;
+    // Fields built and searches answered from them in the shared run.
+    uint64_t builds = 0;
+    uint64_t hits = 0;
+    // Searches where the path from a field couldn't be taken, or cost
+    // something other than the one A* found.
+    int mismatches = 0;
+};
+
+// Call when terrain or a stationary monster changes.
+void invalidate_pathfind_fields();
+const pathfind_field_stats& get_pathfind_field_stats();
+void reset_pathfind_field_stats();
+pathfind_field_bench bench_pathfind_fields(int iterations);
+
 class monster_pathfind
 {
 public:
     monster_pathfind();
     virtual ~monster_pathfind();
 
+    monster_pathfind(const monster_pathfind&) = delete;
+    monster_pathfind& operator=(const monster_pathfind&) = delete;
+
     // public methods
     void set_range(int r);
     coord_def next_pos(const coord_def &p) const;
@@ -21,6 +56,7 @@ public:
     bool start_pathfind(bool msg = false);
     vector<coord_def> backtrack();
     vector<coord_def> calc_waypoints();
+    int path_cost(const vector<coord_def> &path);
 
 protected:
     // protected methods
@@ -33,6 +69,9 @@ protected:
     void add_new_pos(coord_def pos, int total);
     void update_pos(coord_def pos, int total);
     bool get_best_position();
+    int  get_dist(const coord_def& p) const;
+    bool shared_pathfind(bool &found);
+    void fill_field(pathfind_field &field);
 
     // The monster trying to find a path.
     const monster* mons;
@@ -59,10 +98,8 @@ protected:
     int min_length;
     int max_length;
 
-    // The array of distances from start to any already tried point.
-    int dist[GXM][GYM];
-    // An array to store where we came from on a given shortest path.
-    int prev[GXM][GYM];
-
-    FixedVector<vector<coord_def>, GXM * GYM> hash;
+    // Distances, backtracking information and the queue of positions to
+    // look at, borrowed from a pool so that they needn't be set up anew for
+    // every search.
+    pathfind_workspace *ws;
 };
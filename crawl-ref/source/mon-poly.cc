@@ -9,6 +9,7 @@
 
 #include "artefact.h"
 #include "attitude-change.h"
+#include "beam.h"
 #include "coordit.h"
 #include "delay.h"
 #include "describe.h"
@@ -214,6 +215,7 @@ static bool _jiyva_slime_target(monster_type targetc)
 void change_monster_type(monster* mons, monster_type targetc)
 {
     ASSERT(mons); // XXX: change to monster &mons
+    invalidate_tracer_cache();
     bool could_see     = you.can_see(*mons);
     bool slimified = _jiyva_slime_target(targetc);
 
@@ -15,6 +15,7 @@
 #include "art-enum.h"
 #include "attack.h"
 #include "attitude-change.h"
+#include "beam.h"
 #include "bloodspatter.h"
 #include "branch.h"
 #include "cloud.h"
@@ -972,6 +973,8 @@ bool monster::unequip(item_def &item, bool msg, bool force)
     if (!force && item.cursed())
         return false;
 
+    invalidate_tracer_cache();
+
     if (!force && you.can_see(*this))
         set_ident_flags(item, ISFLAG_KNOW_CURSE);
 
@@ -1021,6 +1024,8 @@ bool monster::pickup(item_def &item, mon_inv_type slot, bool msg)
 {
     ASSERT(item.defined());
 
+    invalidate_tracer_cache();
+
     const monster* other_mon = item.holding_monster();
 
     if (other_mon != nullptr)
@@ -2608,6 +2613,7 @@ int monster::mindex() const
 void monster::set_hit_dice(int new_hit_dice)
 {
     hit_dice = new_hit_dice;
+    invalidate_tracer_cache();
 
     // XXX: this is unbelievably hacky to preserve old behaviour
     if (type == MONS_OKLOB_PLANT && !spells.empty()
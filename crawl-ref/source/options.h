@@ -175,6 +175,7 @@ public:
     uint64_t    seed_from_rc;
     bool        pregen_dungeon; // Is the dungeon completely generated at the beginning?
     bool        incremental_pregen; // Does the dungeon always generate in a specified order?
+    bool        speculative_levelgen; // Build the levels below while idle?
 
 #ifdef DGL_SIMPLE_MESSAGING
     bool        messaging;      // Check for messages.
@@ -396,6 +397,9 @@ public:
     vector<menu_sort_condition> sort_menus;
 
     bool        dump_on_save;       // Automatically dump character when saving.
+    bool        async_save;         // Write the save in a background thread.
+    string      save_codec;         // Compression for new save chunks.
+    int         save_compact_slack; // % of unused space to rewrite the save.
     int         dump_kill_places;   // How to dump place information for kills.
     int         dump_message_count; // How many old messages to dump
 
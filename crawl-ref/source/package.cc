@@ -16,6 +16,10 @@ Notes:
 * Readers always get the last complete (but not necessarily committed) write
   (ie, READ_UNCOMMITTED) at the time they started; it is safe to continue
   reading even if the chunk has been changed since.
+* In async mode, writes are kept in memory and commit() only starts writing
+  them out in a background thread; the commit is finished by the next call
+  that needs the file. A crash before then returns the save to the previous
+  commit, exactly as a crash in the middle of a synchronous commit would.
 */
 
 #include "AppHdr.h"
@@ -25,6 +29,7 @@ Notes:
 #include <cstdio>
 #include <cstdlib>
 #include <cstring>
+#include <exception>
 #include <sstream>
 #include <fcntl.h>
 #include <sys/stat.h>
@@ -32,12 +37,28 @@ Notes:
 #if defined(UNIX) || defined(TARGET_COMPILER_MINGW)
 #include <unistd.h>
 #endif
+#ifdef UNIX
+#define USE_MMAP
+#include <sys/mman.h>
+#endif
 
 #include "end.h"
 #include "endianness.h"
 #include "errors.h"
 #include "syscalls.h"
 #include "libutil.h" // map_find
+#include "threads.h"
+
+#ifdef USE_ZLIB
+#include <zlib.h>
+#endif
+#ifdef USE_LZ4
+#include <lz4frame.h>
+#endif
+#ifdef USE_ZSTD
+#include <zdict.h>
+#include <zstd.h>
+#endif
 
 // debugging defines
 #undef  FSCK_VERBOSE
@@ -81,8 +102,42 @@ typedef pair<plen_t, plen_t> bm_p;
 typedef map<plen_t, bm_p> bm_t;
 typedef map<plen_t, plen_t> fb_t;
 
+// Chunks not written with zlib start with a tag byte naming their codec.
+// The low nibble of the first byte of a zlib stream is always 8 (deflate),
+// so none of these can be mistaken for an old, untagged zlib chunk.
+static const uint8_t codec_tags[NUM_CODECS] = { 0, 'N', 'L', 'Z' };
+static const char *codec_names[NUM_CODECS] = { "zlib", "none", "lz4", "zstd" };
+
+// The zstd dictionary is stored as a chunk that's hidden from users of the
+// package, and is never itself compressed with the dictionary.
+static const string DICTIONARY_CHUNK = "zstd-dict";
+
+// Below this much unused space a save isn't worth rewriting, however small.
+static const plen_t MIN_COMPACT_SLACK = 256 * 1024;
+
+static package_codec _default_codec()
+{
+#ifdef USE_ZLIB
+    return CODEC_ZLIB;
+#else
+    return CODEC_NONE;
+#endif
+}
+
+// Staged changes handed over to a background commit.
+struct commit_job
+{
+    map<string, shared_ptr<const string>> writes;
+    set<string> deletes;
+    thread_t thread;
+    bool running = false;
+    exception_ptr error;
+};
+
 package::package(const char* file, bool writeable, bool empty)
-  : n_users(0), dirty(false), aborted(false)
+  : n_users(0), dirty(false), aborted(false), async(false),
+    job(new commit_job), codec(_default_codec()), compact_slack(0),
+    compaction_failed(false), mapping(nullptr)
 #ifdef DO_FSYNC
     , tmp(false)
 #endif
@@ -132,7 +187,9 @@ package::package(const char* file, bool writeable, bool empty)
 }
 
 package::package()
-  : rw(true), n_users(0), dirty(false), aborted(false)
+  : rw(true), n_users(0), dirty(false), aborted(false), async(false),
+    job(new commit_job), codec(_default_codec()), compact_slack(0),
+    compaction_failed(false), mapping(nullptr)
 #ifdef DO_FSYNC
     , tmp(true)
 #endif
@@ -180,14 +237,31 @@ void package::load()
     if (len == -1)
         sysfail("save file (%s) is not seekable", filename.c_str());
     file_len = len;
+    map_file();
     read_directory(htole(head.start), head.version);
 
     if (rw)
         load_traces();
 }
 
+// Maps a read-only save into memory, so readers can decompress straight out
+// of it rather than read()ing every block into a buffer first. Writeable
+// packages change under readers' feet, so they always use read().
+void package::map_file()
+{
+#ifdef USE_MMAP
+    if (rw || !file_len)
+        return;
+
+    void *m = mmap(nullptr, file_len, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (m != MAP_FAILED)
+        mapping = static_cast<const uint8_t *>(m);
+#endif
+}
+
 void package::load_traces()
 {
+    wait_for_commit();
     ASSERT(!dirty);
     ASSERT(!n_users);
     if (directory.empty() || !block_map.empty())
@@ -217,10 +291,16 @@ package::~package()
     if (rw && !aborted)
     {
         commit();
+        wait_for_commit();
         if (ftruncate(fd, file_len))
             sysfail("failed to update save file");
     }
 
+#ifdef USE_MMAP
+    if (mapping)
+        munmap(const_cast<uint8_t *>(mapping), file_len);
+#endif
+
     // all errors here should be cached write errors
     if (fd != -1)
         if (close(fd) && !aborted)
@@ -234,6 +314,208 @@ package::~package()
 void package::commit()
 {
     ASSERT(rw);
+    wait_for_commit();
+    if (!async)
+    {
+        write_commit();
+        return;
+    }
+
+    if (staged_chunks.empty() && staged_deletes.empty() && !dirty)
+        return;
+    ASSERT(!aborted);
+
+    job->writes.swap(staged_chunks);
+    job->deletes.swap(staged_deletes);
+
+    // Open readers seek around the same fd, so they'd get in the way.
+    if (reader_count.empty()
+        && !thread_create_joinable(&job->thread, commit_thread, this))
+    {
+        job->running = true;
+        return;
+    }
+
+    write_staged(*job);
+    write_commit();
+    job->writes.clear();
+    job->deletes.clear();
+}
+
+void *package::commit_thread(void *arg)
+{
+    package *pkg = static_cast<package *>(arg);
+    try
+    {
+        pkg->write_staged(*pkg->job);
+        pkg->write_commit();
+    }
+    catch (...)
+    {
+        // Rethrown in the main thread by wait_for_commit().
+        pkg->job->error = current_exception();
+    }
+    return nullptr;
+}
+
+// Blocks until the background commit, if any, is done. Everything that
+// touches the file or the block lists must call this first.
+void package::wait_for_commit()
+{
+    if (!job->running)
+        return;
+
+    thread_join(job->thread);
+    job->running = false;
+    job->writes.clear();
+    job->deletes.clear();
+
+    if (job->error)
+    {
+        exception_ptr err = job->error;
+        job->error = nullptr;
+        rethrow_exception(err);
+    }
+}
+
+void package::set_async_commit(bool _async)
+{
+    ASSERT(rw);
+    if (_async == async)
+        return;
+
+    wait_for_commit();
+    async_names.clear();
+    if (async)
+    {
+        // Write out whatever is still staged; it'll be committed as usual.
+        commit_job cj;
+        cj.writes.swap(staged_chunks);
+        cj.deletes.swap(staged_deletes);
+        write_staged(cj);
+    }
+    else
+    {
+        for (const auto &entry : directory)
+            if (!entry.first.empty() && entry.first != DICTIONARY_CHUNK)
+                async_names.insert(entry.first);
+    }
+    async = _async;
+}
+
+void package::stage_chunk(const string &name, shared_ptr<const string> data)
+{
+    staged_deletes.erase(name);
+    staged_chunks[name] = data;
+    async_names.insert(name);
+}
+
+// The in-memory contents of a chunk that hasn't been written yet, if any.
+// The background thread only ever reads job->writes, so this is safe to call
+// while it runs.
+shared_ptr<const string> package::find_staged(const string &name) const
+{
+    if (const shared_ptr<const string> *data = map_find(staged_chunks, name))
+        return *data;
+    if (const shared_ptr<const string> *data = map_find(job->writes, name))
+        return *data;
+    return nullptr;
+}
+
+// write_staged() compresses on at most this many threads, and only uses
+// more than one for at least this many bytes.
+static const int MAX_ENCODE_THREADS = 4;
+static const size_t MIN_THREADED_ENCODE = 64 * 1024;
+
+// Chunks for the threads of write_staged() to compress.
+struct encode_queue
+{
+    package *pkg;
+    vector<const string *> in;
+    vector<string> out;
+    atomic<size_t> next;
+    exception_ptr error;
+    mutex_t error_lock;
+};
+
+void *package::encode_thread(void *arg)
+{
+    encode_queue *queue = static_cast<encode_queue *>(arg);
+    for (size_t i; (i = queue->next++) < queue->in.size();)
+    {
+        try
+        {
+            chunk_writer ch(queue->pkg, &queue->out[i]);
+            ch.write(queue->in[i]->data(), queue->in[i]->size());
+        }
+        catch (...)
+        {
+            mutex_lock(queue->error_lock);
+            queue->error = current_exception();
+            mutex_unlock(queue->error_lock);
+        }
+    }
+    return nullptr;
+}
+
+void package::write_staged(const commit_job &cj)
+{
+    for (const string &name : cj.deletes)
+    {
+        free_chunk(name);
+        directory.erase(name);
+    }
+
+    // Compressing is most of the work, and each chunk can be done on its
+    // own, so that's spread over a few processors; writing the results out
+    // stays in order. Chunks come out the same either way. A thread costs
+    // about as much to start as compressing a fraction of a KiB, so
+    // ordinary turn-by-turn saves, which are a chunk or two, don't bother.
+    encode_queue queue;
+    queue.pkg = this;
+    size_t total = 0;
+    for (const auto &entry : cj.writes)
+    {
+        queue.in.push_back(entry.second.get());
+        total += entry.second->size();
+    }
+    queue.out.resize(queue.in.size());
+    queue.next = 0;
+    mutex_init(queue.error_lock);
+
+    int threads = 1;
+    if (queue.in.size() > 1 && total >= MIN_THREADED_ENCODE)
+    {
+        threads = min<int>(min(cpu_count(), MAX_ENCODE_THREADS),
+                           queue.in.size());
+    }
+    vector<thread_t> pool;
+    for (int i = 1; i < threads; ++i)
+    {
+        thread_t th;
+        if (thread_create_joinable(&th, encode_thread, &queue))
+            break;
+        pool.push_back(th);
+    }
+    encode_thread(&queue);
+    for (thread_t &th : pool)
+        thread_join(th);
+    mutex_destroy(queue.error_lock);
+    if (queue.error)
+        rethrow_exception(queue.error);
+
+    size_t i = 0;
+    for (const auto &entry : cj.writes)
+    {
+        const string &data = queue.out[i++];
+        ASSERT(!data.empty());
+        chunk_writer ch(this, entry.first, false, true);
+        ch.raw_write(data.data(), data.size());
+    }
+}
+
+void package::write_commit()
+{
     if (!dirty)
         return;
     ASSERT(!aborted);
@@ -267,6 +549,150 @@ void package::commit()
 #ifdef COSTLY_ASSERTS
     fsck();
 #endif
+
+    if (needs_compaction() && !write_compacted())
+    {
+        // It'd only fail the same way on every later commit.
+        compact_slack = 0;
+        compaction_failed = true;
+    }
+}
+
+// Sets when commits should compact the save, and which chunks go first in
+// the compacted file; the rest follow in directory order.
+void package::set_compaction(int slack_percent, const vector<string> &order)
+{
+    ASSERT(rw);
+    ASSERT_RANGE(slack_percent, 0, 101);
+    wait_for_commit();
+    compact_slack = slack_percent;
+    load_order = order;
+}
+
+// Like get_slack(), but safe to call from the commit thread.
+bool package::needs_compaction() const
+{
+    // Open readers point into the old file.
+    if (!compact_slack || !reader_count.empty() || !unlinked_blocks.empty())
+        return false;
+
+    plen_t slack = 0;
+    for (const auto &bl : free_blocks)
+        slack += bl.second;
+    return slack >= MIN_COMPACT_SLACK
+           && (uint64_t)slack * 100 >= (uint64_t)file_len * compact_slack;
+}
+
+// Commits, then rewrites the save regardless of how much space it'd save.
+bool package::compact()
+{
+    ASSERT(rw);
+    commit();
+    wait_for_commit();
+    ASSERT(reader_count.empty());
+    return write_compacted();
+}
+
+// Whether compaction has been given up on since this was last called, so
+// the caller can report it once.
+bool package::take_compaction_failure()
+{
+    wait_for_commit();
+    const bool failed = compaction_failed;
+    compaction_failed = false;
+    return failed;
+}
+
+// Writes every chunk into a fresh file as a single block, in load order, and
+// swaps that file in for ours. The chunks are copied still compressed. Until
+// the rename, the old file is untouched, so a crash loses nothing. Returns
+// false (leaving things as they were) if the rename fails, e.g. on systems
+// that won't replace an open file.
+bool package::write_compacted()
+{
+    ASSERT(!dirty);
+    const string tmpname = filename + ".tmp";
+    dprintf("package: compacting into %s\n", tmpname.c_str());
+
+    package out(tmpname.c_str(), true, true);
+
+    // The dictionary is needed to decode anything written with it.
+    vector<string> names;
+    if (directory.count(DICTIONARY_CHUNK))
+        names.push_back(DICTIONARY_CHUNK);
+    for (const string &name : load_order)
+        if (directory.count(name)
+            && find(names.begin(), names.end(), name) == names.end())
+        {
+            names.push_back(name);
+        }
+    for (const auto &entry : directory)
+        if (!entry.first.empty()
+            && find(names.begin(), names.end(), entry.first) == names.end())
+        {
+            names.push_back(entry.first);
+        }
+
+    for (const string &name : names)
+        copy_raw_chunk(out, name);
+    out.write_commit();
+    if (ftruncate(out.fd, out.file_len))
+        sysfail("failed to write the compacted save");
+
+    if (rename_u(tmpname.c_str(), filename.c_str()))
+    {
+        dprintf("package: can't replace the save, compaction abandoned\n");
+        out.unlink();
+        return false;
+    }
+
+    // The new file is already locked, so there's no window for another
+    // process to grab the save.
+    close(fd);
+    fd = out.fd;
+    out.fd = -1;
+    out.aborted = true;
+    file_len = out.file_len;
+    directory.swap(out.directory);
+    free_blocks.swap(out.free_blocks);
+    block_map.swap(out.block_map);
+    new_chunks.clear();
+    return true;
+}
+
+void package::copy_raw_chunk(package &to, const string &name)
+{
+    vector<uint8_t> data;
+    for (plen_t at = directory[name]; at; at = block_map[at].second)
+    {
+        const plen_t len = block_map[at].first;
+        const size_t old_size = data.size();
+        data.resize(old_size + len);
+        seek(at + sizeof(block_header));
+        ssize_t res = ::read(fd, &data[old_size], len);
+        if (res < 0)
+            sysfail("error reading the save file");
+        if ((plen_t)res != len)
+            corrupted("save file corrupted -- block past eof");
+    }
+    ASSERT(!data.empty());
+
+    // A fresh package has no holes, so this is always one block at the end.
+    plen_t len = data.size();
+    const plen_t at = to.alloc_block(len);
+    ASSERT(len == data.size());
+
+    block_header head;
+    head.len = htole(len);
+    head.next = 0;
+    to.seek(at);
+    if (::write(to.fd, &head, sizeof(head)) != sizeof(head)
+        || ::write(to.fd, &data[0], len) != (ssize_t)len)
+    {
+        sysfail("write error while compacting the save");
+    }
+    to.block_map[at] = bm_p(len, 0);
+    to.finish_chunk(name, at);
 }
 
 void package::seek(plen_t to)
@@ -286,6 +712,8 @@ chunk_writer* package::writer(const string &name)
 
 chunk_reader* package::reader(const string &name)
 {
+    if (async)
+        return has_chunk(name) ? new chunk_reader(this, name) : 0;
     if (plen_t *ch = map_find(directory, name))
         return new chunk_reader(this, *ch);
     return 0;
@@ -384,13 +812,23 @@ void package::free_chunk(const string &name)
 
 void package::delete_chunk(const string &name)
 {
+    if (async)
+    {
+        staged_chunks.erase(name);
+        staged_deletes.insert(name);
+        async_names.erase(name);
+        return;
+    }
+
     free_chunk(name);
     directory.erase(name);
 }
 
 plen_t package::write_directory()
 {
-    delete_chunk("");
+    // Not delete_chunk(), which only stages the deletion in async mode.
+    free_chunk("");
+    directory.erase("");
 
     stringstream dir;
     for (const auto &entry : directory)
@@ -405,7 +843,7 @@ plen_t package::write_directory()
     ASSERT(dir.str().size());
     dprintf("writing directory (%u bytes)\n", (unsigned int)dir.str().size());
     {
-        chunk_writer dch(this, "");
+        chunk_writer dch(this, "", false);
         dch.write(&dir.str()[0], dir.str().size());
     }
 
@@ -511,6 +949,14 @@ void package::fsck()
     file_len = save_file_len;
 }
 
+// Traces every chunk, which fails if any of them overlap or run past the end
+// of the file, then checks that the used and free blocks add up.
+void package::check()
+{
+    load_traces();
+    fsck();
+}
+
 struct dir_entry0
 {
     char name[sizeof(plen_t)];
@@ -564,15 +1010,20 @@ void package::read_directory(plen_t start, uint8_t version)
 
 bool package::has_chunk(const string &name)
 {
-    return !name.empty() && directory.count(name);
+    if (async)
+        return async_names.count(name);
+    return !name.empty() && name != DICTIONARY_CHUNK && directory.count(name);
 }
 
 vector<string> package::list_chunks()
 {
+    if (async)
+        return vector<string>(async_names.begin(), async_names.end());
+
     vector<string> list;
     list.reserve(directory.size());
     for (const auto &entry : directory)
-        if (!entry.first.empty())
+        if (!entry.first.empty() && entry.first != DICTIONARY_CHUNK)
             list.push_back(entry.first);
 
     return list;
@@ -619,6 +1070,15 @@ void package::abort()
     // Disable any further operations, allow a shutdown. All errors past
     // this point are ignored (assuming we already failed). All writes since
     // the last commit() are lost.
+    try
+    {
+        wait_for_commit();
+    }
+    catch (...)
+    {
+    }
+    staged_chunks.clear();
+    staged_deletes.clear();
     aborted = true;
 }
 
@@ -673,8 +1133,559 @@ plen_t package::get_chunk_compressed_length(const string &name)
     return len;
 }
 
+bool codec_available(package_codec codec)
+{
+    switch (codec)
+    {
+#ifdef USE_ZLIB
+    case CODEC_ZLIB:
+#endif
+    case CODEC_NONE:
+#ifdef USE_LZ4
+    case CODEC_LZ4:
+#endif
+#ifdef USE_ZSTD
+    case CODEC_ZSTD:
+#endif
+        return true;
+    default:
+        return false;
+    }
+}
+
+const char *codec_name(package_codec codec)
+{
+    ASSERT_RANGE(codec, 0, NUM_CODECS);
+    return codec_names[codec];
+}
+
+package_codec codec_by_name(const string &name)
+{
+    for (int i = 0; i < NUM_CODECS; ++i)
+        if (name == codec_names[i])
+            return static_cast<package_codec>(i);
+    return NUM_CODECS;
+}
+
+static package_codec _codec_from_tag(uint8_t tag)
+{
+    if ((tag & 0x0f) == 8)
+        return CODEC_ZLIB;
+    for (int i = 0; i < NUM_CODECS; ++i)
+        if (i != CODEC_ZLIB && tag == codec_tags[i])
+            return static_cast<package_codec>(i);
+    corrupted("save file corrupted -- unknown codec %u", tag);
+}
+
+#ifdef USE_ZSTD
+// The package's dictionary, prepared once for all the chunks that use it.
+struct codec_dictionary
+{
+    codec_dictionary(const string &dict)
+        : cdict(ZSTD_createCDict(dict.data(), dict.size(),
+                                 ZSTD_CLEVEL_DEFAULT)),
+          ddict(ZSTD_createDDict(dict.data(), dict.size()))
+    {
+        if (!cdict || !ddict)
+            fail("save file dictionary is unusable");
+    }
+    ~codec_dictionary()
+    {
+        ZSTD_freeCDict(cdict);
+        ZSTD_freeDDict(ddict);
+    }
+    ZSTD_CDict *cdict;
+    ZSTD_DDict *ddict;
+};
+
+string train_codec_dictionary(const vector<string> &samples)
+{
+    string data;
+    vector<size_t> sizes;
+    for (const string &sample : samples)
+    {
+        data += sample;
+        sizes.push_back(sample.size());
+    }
+
+    // Zstd's recommended size; level chunks are a few hundred kilobytes.
+    string dict(112640, 0);
+    size_t len = ZDICT_trainFromBuffer(&dict[0], dict.size(), data.data(),
+                                       sizes.data(), sizes.size());
+    if (ZDICT_isError(len))
+        return "";
+    dict.resize(len);
+    return dict;
+}
+#else
+struct codec_dictionary
+{
+};
+
+string train_codec_dictionary(const vector<string> &)
+{
+    return "";
+}
+#endif
+
+// Compresses the data written to a chunk_writer, passing the result on to
+// its raw_write().
+class chunk_encoder
+{
+public:
+    chunk_encoder(chunk_writer *_out) : out(_out) {}
+    virtual ~chunk_encoder() {}
+    virtual void write(const void *data, plen_t len) = 0;
+    // Writes out whatever is still buffered. Nothing may be written after.
+    virtual void finish() = 0;
+protected:
+    void emit(const void *data, plen_t len)
+    {
+        if (len)
+            out->raw_write(data, len);
+    }
+private:
+    chunk_writer *out;
+};
+
+// Decompresses raw chunk data for a chunk_reader.
+class chunk_decoder
+{
+public:
+    virtual ~chunk_decoder() {}
+    // Decodes as much of in[in_len] into out[out_len] as possible, advancing
+    // both. Returns true once the end of the stream has been reached.
+    virtual bool decode(const uint8_t *&in, plen_t &in_len,
+                        uint8_t *&out, plen_t &out_len) = 0;
+    // Whether the stream marks its own end; if not, it ends with the chunk.
+    virtual bool self_terminating() const { return true; }
+};
+
+class none_encoder : public chunk_encoder
+{
+public:
+    none_encoder(chunk_writer *_out) : chunk_encoder(_out) {}
+    void write(const void *data, plen_t len) override { emit(data, len); }
+    void finish() override {}
+};
+
+class none_decoder : public chunk_decoder
+{
+public:
+    bool decode(const uint8_t *&in, plen_t &in_len,
+                uint8_t *&out, plen_t &out_len) override
+    {
+        plen_t s = min(in_len, out_len);
+        memcpy(out, in, s);
+        in += s, in_len -= s;
+        out += s, out_len -= s;
+        return false;
+    }
+    bool self_terminating() const override { return false; }
+};
+
+#ifdef USE_ZLIB
+#define ZB_SIZE 32768
+class zlib_encoder : public chunk_encoder
+{
+public:
+    zlib_encoder(chunk_writer *_out) : chunk_encoder(_out), ended(false)
+    {
+        zs.data_type = Z_BINARY;
+        zs.zalloc    = 0;
+        zs.zfree     = 0;
+        zs.opaque    = Z_NULL;
+        if (deflateInit(&zs, Z_DEFAULT_COMPRESSION))
+            fail("save file compression failed during init: %s", zs.msg);
+        zs.next_out  = z_buffer;
+        zs.avail_out = ZB_SIZE;
+    }
+
+    ~zlib_encoder()
+    {
+        // ignore errors, they're only relevant if we finished
+        if (!ended)
+            deflateEnd(&zs);
+    }
+
+    void write(const void *data, plen_t len) override
+    {
+        zs.next_in  = (Bytef*)data;
+        zs.avail_in = len;
+        while (zs.avail_in)
+        {
+            if (!zs.avail_out)
+            {
+                emit(z_buffer, zs.next_out - z_buffer);
+                zs.next_out  = z_buffer;
+                zs.avail_out = ZB_SIZE;
+            }
+            // we don't allow Z_BUF_ERROR, so it's fatal for us
+            if (deflate(&zs, Z_NO_FLUSH) != Z_OK)
+                fail("save file compression failed: %s", zs.msg);
+        }
+    }
+
+    void finish() override
+    {
+        zs.avail_in = 0;
+        int res;
+        do
+        {
+            res = deflate(&zs, Z_FINISH);
+            if (res != Z_STREAM_END && res != Z_OK && res != Z_BUF_ERROR)
+                fail("save file compression failed: %s", zs.msg);
+            emit(z_buffer, zs.next_out - z_buffer);
+            zs.next_out = z_buffer;
+            zs.avail_out = ZB_SIZE;
+        } while (res != Z_STREAM_END);
+        ended = true;
+        if (deflateEnd(&zs) != Z_OK)
+            fail("save file compression failed during clean-up: %s", zs.msg);
+    }
+
+private:
+    z_stream zs;
+    bool ended;
+    Bytef z_buffer[ZB_SIZE];
+};
+
+class zlib_decoder : public chunk_decoder
+{
+public:
+    zlib_decoder()
+    {
+        zs.zalloc    = 0;
+        zs.zfree     = 0;
+        zs.opaque    = Z_NULL;
+        zs.next_in   = Z_NULL;
+        zs.avail_in  = 0;
+        if (inflateInit(&zs))
+            fail("save file decompression failed during init: %s", zs.msg);
+    }
+
+    ~zlib_decoder()
+    {
+        // ignore errors, all the data has been read by now
+        inflateEnd(&zs);
+    }
+
+    bool decode(const uint8_t *&in, plen_t &in_len,
+                uint8_t *&out, plen_t &out_len) override
+    {
+        zs.next_in   = (Bytef*)in;
+        zs.avail_in  = in_len;
+        zs.next_out  = out;
+        zs.avail_out = out_len;
+        int res = inflate(&zs, Z_NO_FLUSH);
+        if (res != Z_OK && res != Z_STREAM_END)
+            corrupted("save file decompression failed: %s", zs.msg);
+        in = zs.next_in, in_len = zs.avail_in;
+        out = zs.next_out, out_len = zs.avail_out;
+        return res == Z_STREAM_END;
+    }
+
+private:
+    z_stream zs;
+};
+#endif
+
+#ifdef USE_LZ4
+// Input is fed to lz4 in pieces of this size, so the output buffer has a
+// fixed bound.
+#define LZ4_CHUNK 65536
+class lz4_encoder : public chunk_encoder
+{
+public:
+    lz4_encoder(chunk_writer *_out) : chunk_encoder(_out), ctx(nullptr)
+    {
+        if (LZ4F_isError(LZ4F_createCompressionContext(&ctx, LZ4F_VERSION)))
+            fail("save file compression failed during init");
+        buffer.resize(LZ4F_compressBound(LZ4_CHUNK, nullptr));
+        emit_result(LZ4F_compressBegin(ctx, &buffer[0], buffer.size(),
+                                       nullptr));
+    }
+
+    ~lz4_encoder()
+    {
+        LZ4F_freeCompressionContext(ctx);
+    }
+
+    void write(const void *data, plen_t len) override
+    {
+        const char *in = (const char*)data;
+        while (len)
+        {
+            const plen_t s = min<plen_t>(len, LZ4_CHUNK);
+            emit_result(LZ4F_compressUpdate(ctx, &buffer[0], buffer.size(),
+                                            in, s, nullptr));
+            in += s;
+            len -= s;
+        }
+    }
+
+    void finish() override
+    {
+        emit_result(LZ4F_compressEnd(ctx, &buffer[0], buffer.size(),
+                                     nullptr));
+    }
+
+private:
+    void emit_result(size_t res)
+    {
+        if (LZ4F_isError(res))
+        {
+            fail("save file compression failed: %s",
+                 LZ4F_getErrorName(res));
+        }
+        emit(&buffer[0], res);
+    }
+
+    LZ4F_cctx *ctx;
+    vector<char> buffer;
+};
+
+class lz4_decoder : public chunk_decoder
+{
+public:
+    lz4_decoder() : ctx(nullptr)
+    {
+        if (LZ4F_isError(LZ4F_createDecompressionContext(&ctx, LZ4F_VERSION)))
+            fail("save file decompression failed during init");
+    }
+
+    ~lz4_decoder()
+    {
+        LZ4F_freeDecompressionContext(ctx);
+    }
+
+    bool decode(const uint8_t *&in, plen_t &in_len,
+                uint8_t *&out, plen_t &out_len) override
+    {
+        size_t in_size = in_len, out_size = out_len;
+        size_t res = LZ4F_decompress(ctx, out, &out_size, in, &in_size,
+                                     nullptr);
+        if (LZ4F_isError(res))
+        {
+            corrupted("save file decompression failed: %s",
+                      LZ4F_getErrorName(res));
+        }
+        in += in_size, in_len -= in_size;
+        out += out_size, out_len -= out_size;
+        return !res;
+    }
+
+private:
+    LZ4F_dctx *ctx;
+};
+#endif
+
+#ifdef USE_ZSTD
+class zstd_encoder : public chunk_encoder
+{
+public:
+    zstd_encoder(chunk_writer *_out, package *pkg)
+        : chunk_encoder(_out), cs(ZSTD_createCCtx()),
+          buffer(ZSTD_CStreamOutSize())
+    {
+        if (!cs)
+            fail("save file compression failed during init");
+        if (pkg->dictionary)
+            check(ZSTD_CCtx_refCDict(cs, pkg->dictionary->cdict));
+    }
+
+    ~zstd_encoder()
+    {
+        ZSTD_freeCCtx(cs);
+    }
+
+    void write(const void *data, plen_t len) override
+    {
+        ZSTD_inBuffer in = { data, len, 0 };
+        while (in.pos < in.size)
+            compress(in, ZSTD_e_continue);
+    }
+
+    void finish() override
+    {
+        ZSTD_inBuffer in = { nullptr, 0, 0 };
+        while (compress(in, ZSTD_e_end))
+            ;
+    }
+
+private:
+    size_t compress(ZSTD_inBuffer &in, ZSTD_EndDirective mode)
+    {
+        ZSTD_outBuffer ob = { &buffer[0], buffer.size(), 0 };
+        size_t res = check(ZSTD_compressStream2(cs, &ob, &in, mode));
+        emit(&buffer[0], ob.pos);
+        return res;
+    }
+
+    size_t check(size_t res)
+    {
+        if (ZSTD_isError(res))
+            fail("save file compression failed: %s", ZSTD_getErrorName(res));
+        return res;
+    }
+
+    ZSTD_CCtx *cs;
+    vector<char> buffer;
+};
+
+class zstd_decoder : public chunk_decoder
+{
+public:
+    zstd_decoder(package *pkg) : ds(ZSTD_createDCtx())
+    {
+        if (!ds)
+            fail("save file decompression failed during init");
+        if (!pkg->dictionary)
+            pkg->load_dictionary();
+        if (pkg->dictionary)
+            ZSTD_DCtx_refDDict(ds, pkg->dictionary->ddict);
+    }
+
+    ~zstd_decoder()
+    {
+        ZSTD_freeDCtx(ds);
+    }
+
+    bool decode(const uint8_t *&in, plen_t &in_len,
+                uint8_t *&out, plen_t &out_len) override
+    {
+        ZSTD_inBuffer ib = { in, in_len, 0 };
+        ZSTD_outBuffer ob = { out, out_len, 0 };
+        size_t res = ZSTD_decompressStream(ds, &ob, &ib);
+        if (ZSTD_isError(res))
+        {
+            corrupted("save file decompression failed: %s",
+                      ZSTD_getErrorName(res));
+        }
+        in += ib.pos, in_len -= ib.pos;
+        out += ob.pos, out_len -= ob.pos;
+        return !res;
+    }
+
+private:
+    ZSTD_DCtx *ds;
+};
+#endif
+
+static chunk_encoder *_make_encoder(package_codec codec, chunk_writer *out,
+                                    package *pkg)
+{
+    UNUSED(pkg);
+    switch (codec)
+    {
+#ifdef USE_ZLIB
+    case CODEC_ZLIB:
+        return new zlib_encoder(out);
+#endif
+    case CODEC_NONE:
+        return new none_encoder(out);
+#ifdef USE_LZ4
+    case CODEC_LZ4:
+        return new lz4_encoder(out);
+#endif
+#ifdef USE_ZSTD
+    case CODEC_ZSTD:
+        return new zstd_encoder(out, pkg);
+#endif
+    default:
+        die("save codec %s is not available", codec_name(codec));
+    }
+}
+
+static chunk_decoder *_make_decoder(package_codec codec, package *pkg)
+{
+    UNUSED(pkg);
+    switch (codec)
+    {
+#ifdef USE_ZLIB
+    case CODEC_ZLIB:
+        return new zlib_decoder();
+#endif
+    case CODEC_NONE:
+        return new none_decoder();
+#ifdef USE_LZ4
+    case CODEC_LZ4:
+        return new lz4_decoder();
+#endif
+#ifdef USE_ZSTD
+    case CODEC_ZSTD:
+        return new zstd_decoder(pkg);
+#endif
+    default:
+        fail("the save file uses the %s codec, which this build lacks",
+             codec_name(codec));
+    }
+}
+
+void package::set_codec(package_codec _codec)
+{
+    ASSERT(codec_available(_codec));
+    wait_for_commit();
+    codec = _codec;
+    if (codec == CODEC_ZSTD && !dictionary)
+        load_dictionary();
+}
+
+void package::load_dictionary()
+{
+#ifdef USE_ZSTD
+    if (plen_t *start = map_find(directory, DICTIONARY_CHUNK))
+    {
+        wait_for_commit();
+        chunk_reader in(this, *start);
+        vector<char> dict;
+        in.read_all(dict);
+        dictionary.reset(new codec_dictionary(string(dict.begin(),
+                                                     dict.end())));
+    }
+#endif
+}
+
+// Sets the dictionary for zstd chunks. Only possible on a fresh package, so
+// no chunk can have been written with a different one.
+void package::set_dictionary(const string &dict)
+{
+#ifdef USE_ZSTD
+    ASSERT(rw);
+    ASSERT(directory.empty());
+    ASSERT(!dict.empty());
+    {
+        chunk_writer out(this, DICTIONARY_CHUNK, false);
+        out.write(dict.data(), dict.size());
+    }
+    dictionary.reset(new codec_dictionary(dict));
+#else
+    UNUSED(dict);
+#endif
+}
+
+package_codec package::get_chunk_codec(const string &name)
+{
+    load_traces();
+    ASSERT(directory.count(name)); // not has_chunk(), "" is valid
+    uint8_t tag;
+    seek(directory[name] + sizeof(block_header));
+    if (::read(fd, &tag, 1) != 1)
+        corrupted("save file corrupted -- block past eof");
+    return _codec_from_tag(tag);
+}
+
 chunk_writer::chunk_writer(package *parent, const string &_name)
-    : first_block(0), cur_block(0), block_len(0)
+    : chunk_writer(parent, _name, parent && parent->async)
+{
+}
+
+// With _raw, the data is written as is; it must already be compressed, as
+// by a chunk_writer with a sink.
+chunk_writer::chunk_writer(package *parent, const string &_name,
+                           bool _buffered, bool _raw)
+    : buffered(_buffered), sink(nullptr), first_block(0), cur_block(0),
+      block_len(0)
 {
     ASSERT(parent);
     ASSERT(!parent->aborted);
@@ -688,17 +1699,37 @@ chunk_writer::chunk_writer(package *parent, const string &_name)
     pkg->n_users++;
     name = _name;
 
-#ifdef USE_ZLIB
-    zs.data_type = Z_BINARY;
-    zs.zalloc    = 0;
-    zs.zfree     = 0;
-    zs.opaque    = Z_NULL;
-    if (deflateInit(&zs, Z_DEFAULT_COMPRESSION))
-        fail("save file compression failed during init: %s", zs.msg);
-#define ZB_SIZE 32768
-    zs.next_out  = z_buffer = (Bytef*)malloc(ZB_SIZE);
-    zs.avail_out = ZB_SIZE;
-#endif
+    if (buffered)
+    {
+        buffer = make_shared<string>();
+        return;
+    }
+    if (_raw)
+        return;
+
+    // The directory and the dictionary have to be readable without knowing
+    // anything else about the package.
+    const package_codec codec = name.empty() || name == DICTIONARY_CHUNK
+                                ? _default_codec() : pkg->codec;
+    if (codec != CODEC_ZLIB)
+        raw_write(&codec_tags[codec], 1);
+    encoder.reset(_make_encoder(codec, this, pkg));
+}
+
+// Compresses a chunk with the package's codec into memory, without touching
+// the file, so any number of these can run at once.
+chunk_writer::chunk_writer(package *parent, string *_sink)
+    : buffered(false), sink(_sink), first_block(0), cur_block(0),
+      block_len(0)
+{
+    ASSERT(parent);
+    ASSERT(sink);
+    pkg = parent;
+    pkg->n_users++;
+
+    if (pkg->codec != CODEC_ZLIB)
+        raw_write(&codec_tags[pkg->codec], 1);
+    encoder.reset(_make_encoder(pkg->codec, this, pkg));
 }
 
 chunk_writer::~chunk_writer()
@@ -707,32 +1738,21 @@ chunk_writer::~chunk_writer()
 
     ASSERT(pkg->n_users > 0);
     pkg->n_users--;
-    if (pkg->aborted)
+    if (buffered)
     {
-#ifdef USE_ZLIB
-        // ignore errors, they're not relevant anymore
-        deflateEnd(&zs);
-        free(z_buffer);
-#endif
+        if (!pkg->aborted)
+            pkg->stage_chunk(name, buffer);
         return;
     }
 
-#ifdef USE_ZLIB
-    zs.avail_in = 0;
-    int res;
-    do
-    {
-        res = deflate(&zs, Z_FINISH);
-        if (res != Z_STREAM_END && res != Z_OK && res != Z_BUF_ERROR)
-            fail("save file compression failed: %s", zs.msg);
-        raw_write(z_buffer, zs.next_out - z_buffer);
-        zs.next_out = z_buffer;
-        zs.avail_out = ZB_SIZE;
-    } while (res != Z_STREAM_END);
-    if (deflateEnd(&zs) != Z_OK)
-        fail("save file compression failed during clean-up: %s", zs.msg);
-    free(z_buffer);
-#endif
+    // if aborted, ignore errors, they're not relevant anymore
+    if (pkg->aborted)
+        return;
+
+    if (encoder)
+        encoder->finish();
+    if (sink)
+        return;
     if (cur_block)
         finish_block(0);
     pkg->finish_chunk(name, first_block);
@@ -740,6 +1760,12 @@ chunk_writer::~chunk_writer()
 
 void chunk_writer::raw_write(const void *data, plen_t len)
 {
+    if (sink)
+    {
+        sink->append((const char*)data, len);
+        return;
+    }
+
     while (len > 0)
     {
         plen_t space = pkg->extend_block(cur_block, block_len, len);
@@ -782,24 +1808,10 @@ void chunk_writer::write(const void *data, plen_t len)
     ASSERT(data);
     ASSERT(!pkg->aborted);
 
-#ifdef USE_ZLIB
-    zs.next_in  = (Bytef*)data;
-    zs.avail_in = len;
-    while (zs.avail_in)
-    {
-        if (!zs.avail_out)
-        {
-            raw_write(z_buffer, zs.next_out - z_buffer);
-            zs.next_out  = z_buffer;
-            zs.avail_out = ZB_SIZE;
-        }
-        // we don't allow Z_BUF_ERROR, so it's fatal for us
-        if (deflate(&zs, Z_NO_FLUSH) != Z_OK)
-            fail("save file compression failed: %s", zs.msg);
-    }
-#else
-    raw_write(data, len);
-#endif
+    if (buffered)
+        buffer->append((const char*)data, len);
+    else
+        encoder->write(data, len);
 }
 
 void chunk_reader::init(plen_t start)
@@ -809,20 +1821,12 @@ void chunk_reader::init(plen_t start)
     pkg->reader_count[start]++;
     first_block = next_block = start;
     block_left = 0;
+    in_left = 0;
+    eof = false;
 
-#ifdef USE_ZLIB
+    // Even an empty chunk has a codec header.
     if (!start)
-        corrupted("save file corrupted -- zlib header missing");
-
-    zs.zalloc    = 0;
-    zs.zfree     = 0;
-    zs.opaque    = Z_NULL;
-    zs.next_in   = Z_NULL;
-    zs.avail_in  = 0;
-    if (inflateInit(&zs))
-        fail("save file decompression failed during init: %s", zs.msg);
-    eof = false;
-#endif
+        corrupted("save file corrupted -- codec header missing");
 }
 
 chunk_reader::chunk_reader(package *parent, plen_t start)
@@ -840,6 +1844,17 @@ chunk_reader::chunk_reader(package *parent, const string &_name)
         corrupted("save file corrupted -- chunk \"%s\" missing", _name.c_str());
     dprintf("chunk_reader(%s): starting\n", _name.c_str());
     pkg = parent;
+
+    if ((buffer = parent->find_staged(_name)))
+    {
+        pkg->n_users++;
+        first_block = next_block = 0;
+        off = block_left = 0;
+        eof = false;
+        return;
+    }
+
+    parent->wait_for_commit();
     init(parent->directory[_name]);
 }
 
@@ -847,10 +1862,13 @@ chunk_reader::~chunk_reader()
 {
     dprintf("chunk_reader: closing\n");
 
-#ifdef USE_ZLIB
-    if (inflateEnd(&zs) != Z_OK)
-        fail("save file decompression failed during clean-up: %s", zs.msg);
-#endif
+    if (buffer)
+    {
+        ASSERT(pkg->n_users > 0);
+        pkg->n_users--;
+        return;
+    }
+
     ASSERT(pkg->reader_count[first_block] > 0);
     if (!--pkg->reader_count[first_block])
         pkg->reader_count.erase(first_block);
@@ -904,42 +1922,96 @@ plen_t chunk_reader::raw_read(void *data, plen_t len)
     return (char*)buf - (char*)data;
 }
 
+// Like raw_read(), but for mapped packages: points data at the rest of the
+// current block in the mapping instead of copying it.
+plen_t chunk_reader::raw_span(const uint8_t *&data)
+{
+    const plen_t file_len = pkg->file_len;
+    if (!block_left)
+    {
+        if (!next_block)
+            return 0;
+
+        if (next_block > file_len - sizeof(block_header))
+            corrupted("save file corrupted -- block past eof");
+        block_header bl;
+        memcpy(&bl, pkg->mapping + next_block, sizeof(block_header));
+
+        off = next_block + sizeof(block_header);
+        block_left = htole(bl.len);
+        next_block = htole(bl.next);
+        // This reeks of on-disk corruption (zeroed data).
+        if (!block_left)
+            corrupted("save file corrupted -- empty block");
+        if (block_left > file_len - off)
+            corrupted("save file corrupted -- block past eof");
+    }
+
+    data = pkg->mapping + off;
+    const plen_t s = block_left;
+    off += s;
+    block_left = 0;
+    return s;
+}
+
 plen_t chunk_reader::read(void *data, plen_t len)
 {
     ASSERT(data);
     if (pkg->aborted)
         return 0;
 
-#ifdef USE_ZLIB
+    if (buffer)
+    {
+        plen_t s = min<plen_t>(len, buffer->size() - off);
+        memcpy(data, buffer->data() + off, s);
+        off += s;
+        return s;
+    }
+
     if (!len)
         return 0;
     if (eof)
         return 0;
 
-    zs.next_out  = (Bytef*)data;
-    zs.avail_out = len;
-    while (zs.avail_out)
+    uint8_t *out = (uint8_t*)data;
+    plen_t out_left = len;
+    while (out_left)
     {
-        if (!zs.avail_in)
+        if (!in_left)
         {
-            zs.next_in  = z_buffer;
-            zs.avail_in = raw_read(z_buffer, sizeof(z_buffer));
-            if (!zs.avail_in)
+            if (pkg->mapping)
+                in_left = raw_span(in_next);
+            else
+            {
+                in_next = in_buffer;
+                in_left = raw_read(in_buffer, sizeof(in_buffer));
+            }
+            if (!in_left)
+            {
+                if (decoder && !decoder->self_terminating())
+                {
+                    eof = true;
+                    break;
+                }
                 corrupted("save file corrupted -- block truncated");
+            }
         }
-        int res = inflate(&zs, Z_NO_FLUSH);
-        if (res == Z_STREAM_END)
+
+        if (!decoder)
+        {
+            const package_codec codec = _codec_from_tag(*in_next);
+            if (codec != CODEC_ZLIB)
+                ++in_next, --in_left;
+            decoder.reset(_make_decoder(codec, pkg));
+        }
+
+        if (decoder->decode(in_next, in_left, out, out_left))
         {
             eof = true;
-            return zs.next_out - (Bytef*)data;
+            break;
         }
-        if (res != Z_OK)
-            corrupted("save file decompression failed: %s", zs.msg);
     }
-    return zs.next_out - (Bytef*)data;
-#else
-    return raw_read(data, len);
-#endif
+    return out - (uint8_t*)data;
 }
 
 void chunk_reader::read_all(vector<char> &data)
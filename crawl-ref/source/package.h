@@ -2,12 +2,11 @@
 
 #define USE_ZLIB
 
+#include <atomic>
 #include <map>
+#include <memory>
 #include <string>
 #include <vector>
-#ifdef USE_ZLIB
-#include <zlib.h>
-#endif
 
 #if !defined(DGAMELAUNCH) && !defined(__ANDROID__) && !defined(DEBUG_DIAGNOSTICS)
 #define DO_FSYNC
@@ -17,20 +16,45 @@
 
 typedef uint32_t plen_t;
 
+// How the contents of a chunk are compressed. Every chunk records its own, so
+// saves can mix them; zlib is the only one older versions can read.
+enum package_codec
+{
+    CODEC_ZLIB,
+    CODEC_NONE,
+    CODEC_LZ4,  // needs USE_LZ4
+    CODEC_ZSTD, // needs USE_ZSTD; uses the package's dictionary, if any
+    NUM_CODECS
+};
+
+bool codec_available(package_codec codec);
+const char *codec_name(package_codec codec);
+package_codec codec_by_name(const string &name);
+string train_codec_dictionary(const vector<string> &samples);
+
 class package;
+struct commit_job;
+struct codec_dictionary;
+class chunk_encoder;
+class chunk_decoder;
 
 class chunk_writer
 {
 private:
+    chunk_writer(package *parent, const string &_name, bool _buffered,
+                 bool _raw = false);
+    chunk_writer(package *parent, string *_sink);
     package *pkg;
     string name;
+    // Keep the data in memory for a background commit to write out.
+    bool buffered;
+    shared_ptr<string> buffer;
+    // Collects the compressed data instead of the file, when set.
+    string *sink;
     plen_t first_block;
     plen_t cur_block;
     plen_t block_len;
-#ifdef USE_ZLIB
-    z_stream zs;
-    Bytef *z_buffer;
-#endif
+    unique_ptr<chunk_encoder> encoder;
     void raw_write(const void *data, plen_t len);
     void finish_block(plen_t next);
 public:
@@ -38,6 +62,7 @@ public:
     ~chunk_writer();
     void write(const void *data, plen_t len);
     friend class package;
+    friend class chunk_encoder;
 };
 
 class chunk_reader
@@ -48,12 +73,15 @@ private:
     package *pkg;
     plen_t first_block, next_block;
     plen_t off, block_left;
-#ifdef USE_ZLIB
+    // Set when reading a chunk that hasn't been written to the file yet.
+    shared_ptr<const string> buffer;
     bool eof;
-    z_stream zs;
-    Bytef z_buffer[32768];
-#endif
+    unique_ptr<chunk_decoder> decoder;
+    const uint8_t *in_next;
+    plen_t in_left;
+    uint8_t in_buffer[32768];
     plen_t raw_read(void *data, plen_t len);
+    plen_t raw_span(const uint8_t *&data);
 public:
     chunk_reader(package *parent, const string &_name);
     ~chunk_reader();
@@ -71,6 +99,13 @@ public:
     chunk_writer* writer(const string &name);
     chunk_reader* reader(const string &name);
     void commit();
+    void set_async_commit(bool async);
+    void wait_for_commit();
+    void set_codec(package_codec codec);
+    void set_dictionary(const string &dict);
+    void set_compaction(int slack_percent, const vector<string> &load_order);
+    bool compact();
+    bool take_compaction_failure();
     void delete_chunk(const string &name);
     bool has_chunk(const string &name);
     vector<string> list_chunks();
@@ -82,14 +117,31 @@ public:
     plen_t get_size() const { return file_len; };
     plen_t get_chunk_fragmentation(const string &name);
     plen_t get_chunk_compressed_length(const string &name);
+    package_codec get_chunk_codec(const string &name);
+    void check();
 private:
     string filename;
     bool rw;
     int fd;
     plen_t file_len;
-    int n_users;
+    atomic<int> n_users;
     bool dirty;
     bool aborted;
+    // In async mode, chunks are kept in memory until commit() hands them to
+    // a background thread, which then owns everything below.
+    bool async;
+    map<string, shared_ptr<const string>> staged_chunks;
+    set<string> staged_deletes;
+    set<string> async_names;
+    unique_ptr<commit_job> job;
+    package_codec codec;
+    unique_ptr<codec_dictionary> dictionary;
+    // Rewrite the file once this percentage of it is unused; 0 means never.
+    int compact_slack;
+    bool compaction_failed;
+    vector<string> load_order;
+    // The whole file, if it's read-only and could be mapped.
+    const uint8_t *mapping;
 #ifdef DO_FSYNC
     bool tmp;
 #endif
@@ -102,6 +154,16 @@ private:
     plen_t extend_block(plen_t at, plen_t size, plen_t by);
     plen_t alloc_block(plen_t &size);
     void finish_chunk(const string &name, plen_t at);
+    void stage_chunk(const string &name, shared_ptr<const string> data);
+    shared_ptr<const string> find_staged(const string &name) const;
+    void write_staged(const commit_job &cj);
+    static void *encode_thread(void *arg);
+    void write_commit();
+    bool needs_compaction() const;
+    bool write_compacted();
+    void copy_raw_chunk(package &to, const string &name);
+    void load_dictionary();
+    static void *commit_thread(void *arg);
     void free_chunk(const string &name);
     plen_t write_directory();
     void collect_blocks();
@@ -113,6 +175,9 @@ private:
     void trace_chunk(plen_t start);
     void load();
     void load_traces();
+    void map_file();
     friend class chunk_writer;
     friend class chunk_reader;
+    friend class zstd_encoder;
+    friend class zstd_decoder;
 };
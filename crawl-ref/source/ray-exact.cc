@@ -0,0 +1,598 @@
+/**
+ * @file
+ * @brief Exact counterpart of ray.cc.
+ *
+ * This follows ray.cc step by step, on the same diamond grid: the
+ * diamonds are bounded by the lines x+y = k+1/2 and x-y = k-1/2. Points
+ * are fractions and directions are integer vectors; every line we
+ * intersect with or reflect in has small integer coefficients, so
+ * directions stay integral and the points along a ray have bounded
+ * denominators. The rounding ray.cc does to undo floating point error
+ * isn't needed here.
+**/
+
+#include "AppHdr.h"
+
+#include "ray-exact.h"
+
+#include <cmath>
+
+#include "los.h"
+
+//////////////////////////////////////////////////
+// Fractions
+
+static int64_t _gcd(int64_t a, int64_t b)
+{
+    a = a < 0 ? -a : a;
+    b = b < 0 ? -b : b;
+    while (b)
+    {
+        const int64_t t = a % b;
+        a = b;
+        b = t;
+    }
+    return a;
+}
+
+static ray_frac _frac(int64_t num, int64_t den = 1)
+{
+    ASSERT(den != 0);
+    if (den < 0)
+    {
+        num = -num;
+        den = -den;
+    }
+    const int64_t g = _gcd(num, den);
+    ray_frac f = { num / g, den / g };
+    return f;
+}
+
+static ray_frac operator+(const ray_frac &a, const ray_frac &b)
+{
+    const int64_t g = _gcd(a.den, b.den);
+    return _frac(a.num * (b.den / g) + b.num * (a.den / g), a.den / g * b.den);
+}
+
+static ray_frac operator-(const ray_frac &a)
+{
+    ray_frac f = { -a.num, a.den };
+    return f;
+}
+
+static ray_frac operator-(const ray_frac &a, const ray_frac &b)
+{
+    return a + (-b);
+}
+
+static ray_frac operator*(const ray_frac &a, const ray_frac &b)
+{
+    const int64_t g1 = _gcd(a.num, b.den);
+    const int64_t g2 = _gcd(b.num, a.den);
+    return _frac((a.num / g1) * (b.num / g2), (a.den / g2) * (b.den / g1));
+}
+
+static ray_frac operator*(int64_t k, const ray_frac &a)
+{
+    return _frac(k) * a;
+}
+
+static ray_frac operator/(const ray_frac &a, int64_t k)
+{
+    return a * _frac(1, k);
+}
+
+static bool operator==(const ray_frac &a, const ray_frac &b)
+{
+    return a.num == b.num && a.den == b.den;
+}
+
+static bool operator<(const ray_frac &a, const ray_frac &b)
+{
+    const int64_t g = _gcd(a.den, b.den);
+    return a.num * (b.den / g) < b.num * (a.den / g);
+}
+
+static bool _is_integral(const ray_frac &a)
+{
+    return a.den == 1;
+}
+
+static int64_t _floor(const ray_frac &a)
+{
+    const int64_t q = a.num / a.den;
+    return q * a.den > a.num ? q - 1 : q;
+}
+
+static int64_t _ceil(const ray_frac &a)
+{
+    return -_floor(-a);
+}
+
+// The closest fraction to d with a reasonably small denominator.
+static ray_frac _to_frac(double d)
+{
+    // Continued fraction convergents h/k.
+    int64_t h0 = 0, h1 = 1, k0 = 1, k1 = 0;
+    double x = d;
+    for (int i = 0; i < 40; ++i)
+    {
+        const double a = floor(x);
+        const int64_t ai = static_cast<int64_t>(a);
+        const int64_t h2 = ai * h1 + h0;
+        const int64_t k2 = ai * k1 + k0;
+        h0 = h1; h1 = h2;
+        k0 = k1; k1 = k2;
+        if (fabs(d - static_cast<double>(h1) / k1) < 1e-9 || x == a)
+            break;
+        x = 1.0 / (x - a);
+    }
+    ASSERT(fabs(d - static_cast<double>(h1) / k1) < 1e-9);
+    ASSERT(k1 <= (1 << 20));
+    return _frac(h1, k1);
+}
+
+//////////////////////////////////////////////////
+// Geometry, as in geom2d.cc
+
+// The points start + t*dir.
+struct xray
+{
+    ray_point start;
+    coord_def dir;
+};
+
+// The line f^{-1}(val).
+struct xline
+{
+    coord_def f;
+    ray_frac val;
+};
+
+static ray_frac _apply(const coord_def &f, const ray_point &v)
+{
+    return f.x * v.x + f.y * v.y;
+}
+
+static int _apply(const coord_def &f, const coord_def &v)
+{
+    return f.x * v.x + f.y * v.y;
+}
+
+static void _advance(xray *r, const ray_frac &t)
+{
+    r->start.x = r->start.x + r->dir.x * t;
+    r->start.y = r->start.y + r->dir.y * t;
+}
+
+// The two sequences of lines bounding the diamonds:
+// x + y = 1/2 + k and x - y = -1/2 + k, k integral.
+static const coord_def ls1(1, 1);
+static const coord_def ls2(1, -1);
+
+static ray_frac _index(const coord_def &ls, const ray_point &v)
+{
+    return _apply(ls, v) - _frac(ls == ls1 ? 1 : -1, 2);
+}
+
+static ray_frac _intersect(const xray &r, const xline &l)
+{
+    const int fd = _apply(l.f, r.dir);
+    ASSERT(fd != 0);
+    return (l.val - _apply(l.f, r.start)) / fd;
+}
+
+// Find the next intersection of r with a line in ls.
+static ray_frac _nextintersect(const xray &r, const coord_def &ls)
+{
+    const int fd = _apply(ls, r.dir);
+    ASSERT(fd != 0);
+    const ray_frac a = _index(ls, r.start);
+    int64_t k = fd > 0 ? _ceil(a) : _floor(a);
+    if (_frac(k) == a)
+        k += fd > 0 ? 1 : -1;
+    return (_frac(k) - a) / fd;
+}
+
+static bool _to_grid_raw(xray *r, bool half)
+{
+    bool corner = false;
+    ray_frac t;
+    if (_apply(ls1, r->dir) == 0)
+        t = _nextintersect(*r, ls2);
+    else if (_apply(ls2, r->dir) == 0)
+        t = _nextintersect(*r, ls1);
+    else
+    {
+        const ray_frac s1 = _nextintersect(*r, ls1);
+        const ray_frac s2 = _nextintersect(*r, ls2);
+        t = s2 < s1 ? s2 : s1;
+        corner = s1 == s2;
+    }
+    _advance(r, half ? t / 2 : t);
+    return corner && !half;
+}
+
+static coord_def _reflect(const coord_def &v, const coord_def &f)
+{
+    const int fn = _apply(f, f);
+    ASSERT(fn == 1 || fn == 2);
+    return v - f * (2 * _apply(f, v) / fn);
+}
+
+//////////////////////////////////////////////////
+// The diamond grid, as in ray.cc
+
+static bool in_diamond_int(const ray_point &v)
+{
+    const ray_frac d1 = _index(ls1, v);
+    const ray_frac d2 = _index(ls2, v);
+    return !_is_integral(d1) && !_is_integral(d2)
+           && (_floor(d1) + _floor(d2)) % 2 == 0;
+}
+
+static bool on_line(const ray_point &v)
+{
+    return _is_integral(_index(ls1, v)) || _is_integral(_index(ls2, v));
+}
+
+static bool is_corner(const ray_point &v)
+{
+    return _is_integral(_index(ls1, v)) && _is_integral(_index(ls2, v));
+}
+
+static bool in_diamond(const ray_point &v)
+{
+    return in_diamond_int(v) || is_corner(v);
+}
+
+static bool in_non_diamond_int(const ray_point &v)
+{
+    return !in_diamond(v) && !on_line(v);
+}
+
+static coord_def floor_vec(const ray_point &v)
+{
+    return coord_def(_floor(v.x), _floor(v.y));
+}
+
+static bool _to_grid(xray *r, bool half)
+{
+    bool c = _to_grid_raw(r, half);
+    return c || is_corner(r->start);
+}
+
+static bool _to_next_cell(xray *r)
+{
+    if (_to_grid_raw(r, false))
+        return true;
+    _to_grid_raw(r, true);
+    return false;
+}
+
+static bool bad_corner(const xray &r)
+{
+    if (!is_corner(r.start))
+        return false;
+    xray copy = r;
+    _to_grid(&copy, true);
+    return in_non_diamond_int(copy.start);
+}
+
+static bool _advance_from_non_diamond(xray *r)
+{
+    ASSERT(in_non_diamond_int(r->start));
+    if (!_to_next_cell(r))
+    {
+        ASSERT(in_diamond_int(r->start));
+        return false;
+    }
+    else
+    {
+        ASSERT(is_corner(r->start));
+        return true;
+    }
+}
+
+exact_ray::exact_ray(const ray_def& ray)
+    : on_corner(ray.on_corner), cycle_idx(ray.cycle_idx)
+{
+    start.x = _to_frac(ray.r.start.x);
+    start.y = _to_frac(ray.r.start.y);
+
+    // Only the direction matters, not the length.
+    const double dx = ray.r.dir.x, dy = ray.r.dir.y;
+    const int sx = dx < 0 ? -1 : 1, sy = dy < 0 ? -1 : 1;
+    if (fabs(dx) >= fabs(dy))
+    {
+        ASSERT(dx != 0);
+        const ray_frac slope = _to_frac(fabs(dy / dx));
+        dir = coord_def(sx * slope.den, sy * slope.num);
+    }
+    else
+    {
+        const ray_frac slope = _to_frac(fabs(dx / dy));
+        dir = coord_def(sx * slope.num, sy * slope.den);
+    }
+}
+
+ray_def exact_ray::to_ray_def() const
+{
+    ray_def ray(geom::ray(static_cast<double>(start.x.num) / start.x.den,
+                          static_cast<double>(start.y.num) / start.y.den,
+                          dir.x, dir.y));
+    ray.on_corner = on_corner;
+    ray.cycle_idx = cycle_idx;
+    return ray;
+}
+
+bool exact_ray::_valid() const
+{
+    xray r = { start, dir };
+    return !dir.origin()
+           && ((on_corner && is_corner(start) && bad_corner(r))
+               || (!on_corner && in_diamond_int(start)));
+}
+
+coord_def exact_ray::pos() const
+{
+    ASSERT(_valid());
+    return floor_vec(start);
+}
+
+bool exact_ray::advance()
+{
+    ASSERT(_valid());
+    xray r = { start, dir };
+    if (on_corner)
+    {
+        ASSERT(is_corner(r.start));
+        on_corner = false;
+        _to_grid(&r, true);
+    }
+    else if (_to_next_cell(&r))
+    {
+        // On a corner, going from diamond to diamond.
+        _to_grid(&r, true);
+        start = r.start;
+        ASSERT(_valid());
+        return true;
+    }
+
+    // Now inside a non-diamond.
+    ASSERT(in_non_diamond_int(r.start));
+
+    on_corner = _advance_from_non_diamond(&r);
+    start = r.start;
+    ASSERT(_valid());
+    return !on_corner;
+}
+
+void exact_ray::regress()
+{
+    ASSERT(_valid());
+    dir = -dir;
+    advance();
+    dir = -dir;
+    ASSERT(_valid());
+}
+
+//////////////////////////////////////////////////
+// Bouncing, as in ray.cc
+
+static ray_point _mirror_pt(const ray_point &vorig, const coord_def &side)
+{
+    ray_point v = vorig;
+    if (side.x == -1)
+        v.x = _frac(1) - v.x;
+    if (side.y == -1)
+        v.y = _frac(1) - v.y;
+    return v;
+}
+
+static coord_def _mirror_dir(const coord_def &vorig, const coord_def &side)
+{
+    coord_def v = vorig;
+    if (side.x == -1)
+        v.x = -v.x;
+    if (side.y == -1)
+        v.y = -v.y;
+    return v;
+}
+
+static xray _mirror(const xray &rorig, const coord_def &side)
+{
+    xray r = { _mirror_pt(rorig.start, side), _mirror_dir(rorig.dir, side) };
+    return r;
+}
+
+static xline _choose_reflect_line(bool rx, bool ry, bool rxy)
+{
+    xline l;
+    if (rxy && rx && ry)
+        l = { coord_def(1, 1), _frac(3, 2) };
+    else if (rxy && !rx && !ry)
+        l = { coord_def(1, 1), _frac(5, 2) };
+    else if (rx)
+        l = { coord_def(1, 0), _frac(1) };
+    else
+        l = { coord_def(0, 1), _frac(1) };
+    return l;
+}
+
+// ray.cc moves 10 * EPSILON_VALUE off the corner; so do we.
+static ray_point _fudge_corner(const ray_point &w, const reflect_grid &rg)
+{
+    const ray_frac fudge = _frac(1, 10000);
+    ray_point v = w;
+    if (_is_integral(v.x))
+    {
+        v.x = v.x + fudge;
+        if (rg(floor_vec(v)))
+            v.x = v.x - 2 * fudge;
+        ASSERT(!rg(floor_vec(v)));
+    }
+    else
+    {
+        ASSERT(_is_integral(v.y));
+        v.y = v.y + fudge;
+        if (rg(floor_vec(v)))
+            v.y = v.y - 2 * fudge;
+        ASSERT(!rg(floor_vec(v)));
+    }
+    return v;
+}
+
+static xray _bounce_diag_corridor(const xray &rorig)
+{
+    xray r = rorig;
+    const coord_def wall(1, -1);
+    const xline k = { coord_def(1, 1), _frac(5, 2) };
+    ASSERT(_apply(k.f, r.dir) > 0);
+    ASSERT(_apply(wall, r.dir) != 0);
+    while (!(_intersect(r, k) == _frac(0)))
+    {
+        _to_grid(&r, false);
+        r.dir = _reflect(r.dir, wall);
+    }
+    _to_grid(&r, true);
+    return r;
+}
+
+static xray _bounce_noncorner(const xray &r, const coord_def &side,
+                              const reflect_grid &rg)
+{
+    xray rmirr = _mirror(r, side);
+
+    const coord_def dx = coord_def(side.x, 0);
+    const coord_def dy = coord_def(0, side.y);
+    bool rx  = rg(dx);
+    bool ry  = rg(dy);
+    bool rxy = rg(dx + dy);
+    ASSERT(rx || ry || rxy);
+
+    if (rx && ry && !rxy)
+        rmirr = _bounce_diag_corridor(rmirr);
+    else
+    {
+        const xline l = _choose_reflect_line(rx, ry, rxy);
+
+        const ray_frac t = _intersect(rmirr, l);
+        ASSERT(!(t < _frac(0)));
+        _advance(&rmirr, t);
+        rmirr.dir = _reflect(rmirr.dir, l.f);
+        if (bad_corner(rmirr))
+        {
+            ray_point v = _mirror_pt(rmirr.start, side);
+            v = _fudge_corner(v, rg);
+            rmirr.start = _mirror_pt(v, side);
+        }
+        else
+        {
+            _to_grid(&rmirr, true);
+            if (in_non_diamond_int(rmirr.start))
+                _advance_from_non_diamond(&rmirr);
+        }
+    }
+
+    return _mirror(rmirr, side);
+}
+
+static coord_def _corner_wall(const coord_def &side, const reflect_grid &rg)
+{
+    coord_def e;
+    if (side.x == 0)
+        e = coord_def(1, 0);
+    else
+        e = coord_def(0, 1);
+    ASSERT(!rg(coord_def(0,0)));
+    ASSERT(rg(side));
+    coord_def wall = e;
+    if (rg(e) && rg(side+e) && !rg(-e) && !rg(side-e))
+        wall = side - e;
+    else if (rg(-e) && rg(side-e) && !rg(e) && !rg(side+e))
+        wall = side + e;
+    return coord_def(wall.y, -wall.x);
+}
+
+static xray _bounce_corner(const xray &rorig, const coord_def &side,
+                           const reflect_grid &rg)
+{
+    xray r = rorig;
+    const coord_def f = _corner_wall(side, rg);
+
+    if (r.dir.x == 0 || r.dir.y == 0)
+    {
+        r.start.x = r.start.y = _frac(1, 2);
+        r.dir = _reflect(r.dir, f);
+        ASSERT(r.dir.x == 0 || r.dir.y == 0);
+    }
+    else
+    {
+        r.dir = _reflect(r.dir, f);
+        if (f.x != 0 && f.y != 0)
+        {
+            _to_grid(&r, false);
+            _to_grid(&r, true);
+        }
+        else
+            _to_grid(&r, true);
+    }
+    return r;
+}
+
+void exact_ray::nudge_inside()
+{
+    ASSERT(on_corner);
+    const coord_def p = pos();
+    start.x = _frac(9, 10) * start.x + _frac(2 * p.x + 1, 20);
+    start.y = _frac(9, 10) * start.y + _frac(2 * p.y + 1, 20);
+    on_corner = false;
+    ASSERT(in_diamond_int(start));
+}
+
+void exact_ray::bounce(const reflect_grid &rg)
+{
+    ASSERT(_valid());
+    ASSERT(!rg(coord_def(0,0)));
+#ifdef ASSERTS
+    const coord_def old_pos = pos();
+#endif
+
+    if (on_corner)
+        nudge_inside();
+
+    // Translate to cell (0,0).
+    const coord_def p = pos();
+    xray rtrans = { { start.x - _frac(p.x), start.y - _frac(p.y) }, dir };
+
+    // Move to the diamond edge to determine the side.
+    coord_def side;
+    bool corner = _to_grid(&rtrans, false);
+    const ray_frac d1 = _index(ls1, rtrans.start);
+    if (_is_integral(d1))
+        side += d1.num ? coord_def(1,1) : coord_def(-1,-1);
+    const ray_frac d2 = _index(ls2, rtrans.start);
+    if (_is_integral(d2))
+        side += d2.num ? coord_def(1,-1) : coord_def(-1,1);
+    ASSERT(corner == (side.x == 0 || side.y == 0));
+
+    if (corner)
+    {
+        side.x = side.x / 2;
+        side.y = side.y / 2;
+        rtrans = _bounce_corner(rtrans, side, rg);
+    }
+    else
+        rtrans = _bounce_noncorner(rtrans, side, rg);
+
+    // Translate back.
+    start.x = rtrans.start.x + _frac(p.x);
+    start.y = rtrans.start.y + _frac(p.y);
+    dir = rtrans.dir;
+
+    on_corner = is_corner(start);
+
+    ASSERT(_valid());
+    ASSERT(!rg(pos() - old_pos));
+}
@@ -0,0 +1,47 @@
+/**
+ * @file
+ * @brief Ray definition using exact rational arithmetic.
+**/
+
+#pragma once
+
+#include "ray.h"
+
+// A fraction num/den, kept reduced and with den > 0.
+struct ray_frac
+{
+    int64_t num;
+    int64_t den;
+};
+
+struct ray_point
+{
+    ray_frac x;
+    ray_frac y;
+};
+
+// The same rays as ray_def, visiting the same cells (also when bouncing),
+// but with the position kept as exact fractions and the direction as an
+// integer vector. Nothing needs rounding, so there are no epsilons.
+struct exact_ray
+{
+    ray_point start;
+    coord_def dir;
+    bool on_corner;
+    int cycle_idx;
+
+    exact_ray() : start(), dir(), on_corner(false), cycle_idx(-1) {}
+    // ray must have a rational start and direction, as rays coming
+    // from find_ray() or fallback_ray() do.
+    explicit exact_ray(const ray_def& ray);
+
+    ray_def to_ray_def() const;
+
+    coord_def pos() const;
+    bool advance();
+    void bounce(const reflect_grid &rg);
+    void nudge_inside();
+    void regress();
+
+    bool _valid() const;
+};
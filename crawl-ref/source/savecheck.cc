@@ -0,0 +1,368 @@
+/**
+ * @file
+ * @brief Batch verification of save files.
+ *
+ * Every save in a directory is first decoded chunk by chunk, spread over a
+ * pool of threads with one package each, then the player and every level of
+ * the saves that decoded cleanly are unmarshalled with the usual tags.cc
+ * readers. The result is a JSON report of failures, sizes and timings.
+**/
+
+#include "AppHdr.h"
+
+#include "savecheck.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <fcntl.h>
+#if defined(UNIX) || defined(TARGET_COMPILER_MINGW)
+#include <unistd.h>
+#endif
+
+#include "json.h"
+#include "json-wrapper.h"
+
+#include "errors.h"
+#include "files.h"
+#include "libutil.h"
+#include "package.h"
+#include "player.h"
+#include "state.h"
+#include "syscalls.h"
+#include "tags.h"
+#include "threads.h"
+
+typedef chrono::steady_clock check_clock;
+
+static double _us_since(check_clock::time_point start)
+{
+    return chrono::duration<double, micro>(check_clock::now() - start).count();
+}
+
+struct chunk_check
+{
+    string name;
+    string codec;
+    plen_t compressed = 0;
+    plen_t size = 0;
+    plen_t fragments = 0;
+    double decode_us = 0;
+    double unmarshal_us = -1; // not unmarshalled
+    string error;
+};
+
+struct save_check
+{
+    string file;
+    plen_t size = 0;
+    plen_t slack = 0;
+    double fsck_us = 0;
+    string error;
+    vector<chunk_check> chunks;
+};
+
+// Chunks are reported by type: levels all together, the rest by name.
+static string _chunk_type(const string &name)
+{
+    const vector<string> player = save_load_order();
+    if (find(player.begin(), player.end(), name) != player.end())
+        return name;
+    return "level";
+}
+
+// Checks the package structure and decompresses every chunk. This only
+// touches the save's own package, so any number can run at once.
+static void _decode_save(save_check &sc)
+{
+    try
+    {
+        // A save in use would make the package end the game.
+        const int fd = open_u(sc.file.c_str(), O_RDONLY | O_BINARY, 0666);
+        if (fd == -1)
+            sysfail("can't open save file");
+        const bool unlocked = lock_file(fd, false);
+        close(fd);
+        if (!unlocked)
+            fail("save is in use");
+
+        package save(sc.file.c_str(), false);
+        const auto start = check_clock::now();
+        save.check();
+        sc.fsck_us = _us_since(start);
+        sc.size = save.get_size();
+        sc.slack = save.get_slack();
+
+        vector<string> names = save.list_chunks();
+        sort(names.begin(), names.end(), numcmpstr);
+        for (const string &name : names)
+        {
+            chunk_check cc;
+            cc.name = name;
+            cc.compressed = save.get_chunk_compressed_length(name);
+            cc.fragments = save.get_chunk_fragmentation(name);
+            const auto decode_start = check_clock::now();
+            try
+            {
+                cc.codec = codec_name(save.get_chunk_codec(name));
+                chunk_reader in(&save, name);
+                char buf[16384];
+                while (plen_t s = in.read(buf, sizeof(buf)))
+                    cc.size += s;
+            }
+            catch (ext_fail_exception &fe)
+            {
+                cc.error = fe.what();
+            }
+            cc.decode_us = _us_since(decode_start);
+            sc.chunks.push_back(cc);
+        }
+    }
+    catch (exception &e)
+    {
+        sc.error = e.what();
+    }
+}
+
+struct decode_queue
+{
+    vector<save_check> *saves;
+    atomic<size_t> next;
+};
+
+static void *_decode_thread(void *arg)
+{
+    decode_queue *queue = static_cast<decode_queue *>(arg);
+    for (size_t i; (i = queue->next++) < queue->saves->size();)
+        _decode_save((*queue->saves)[i]);
+    return nullptr;
+}
+
+static void _unmarshal_chunk(package &save, chunk_check &cc, tag_type tag)
+{
+    const auto start = check_clock::now();
+    try
+    {
+        reader inf(&save, cc.name);
+        inf.set_safe_read(true);
+        const save_version version = get_save_version(inf);
+        if (!version.is_compatible())
+        {
+            fail("incompatible version %d.%d", version.major,
+                 version.minor);
+        }
+        inf.setMinorVersion(version.minor);
+        crawl_state.minor_version = version.minor;
+        tag_read(inf, tag);
+        inf.fail_if_not_eof(cc.name);
+    }
+    catch (short_read_exception &E)
+    {
+        cc.error = "truncated";
+    }
+    catch (exception &e)
+    {
+        cc.error = e.what();
+    }
+    cc.unmarshal_us = _us_since(start);
+}
+
+// Reads the player and then every level with the real readers. They fill in
+// the global game state, so this can't be done in parallel, and it leaves
+// the current game in no fit state to be played on.
+static void _unmarshal_save(save_check &sc)
+{
+    auto you_chunk = find_if(sc.chunks.begin(), sc.chunks.end(),
+                             [](const chunk_check &cc)
+                             { return cc.name == "you"; });
+    if (you_chunk == sc.chunks.end() || !you_chunk->error.empty())
+        return;
+
+    try
+    {
+        package save(sc.file.c_str(), false);
+        _unmarshal_chunk(save, *you_chunk, TAG_YOU);
+        if (!you_chunk->error.empty())
+            return;
+
+        for (chunk_check &cc : sc.chunks)
+        {
+            if (_chunk_type(cc.name) != "level" || !cc.error.empty())
+                continue;
+
+            // Level fixups look at where the player is.
+            try
+            {
+                const level_id lid = level_id::parse_level_id(cc.name);
+                you.where_are_you = lid.branch;
+                you.depth = lid.depth;
+            }
+            catch (bad_level_id &err)
+            {
+                cc.error = err.what();
+                continue;
+            }
+            _unmarshal_chunk(save, cc, TAG_LEVEL);
+        }
+    }
+    catch (exception &e)
+    {
+        sc.error = e.what();
+    }
+}
+
+struct type_totals
+{
+    int count = 0;
+    int failures = 0;
+    double compressed = 0;
+    double size = 0;
+    double decode_us = 0;
+    double unmarshal_us = 0;
+};
+
+static JsonNode *_chunk_json(const chunk_check &cc)
+{
+    JsonNode *chunk(json_mkobject());
+    json_append_member(chunk, "name", json_mkstring(cc.name.c_str()));
+    json_append_member(chunk, "type",
+                       json_mkstring(_chunk_type(cc.name).c_str()));
+    json_append_member(chunk, "codec", json_mkstring(cc.codec.c_str()));
+    json_append_member(chunk, "compressed", json_mknumber(cc.compressed));
+    json_append_member(chunk, "size", json_mknumber(cc.size));
+    json_append_member(chunk, "fragments", json_mknumber(cc.fragments));
+    json_append_member(chunk, "decode_us", json_mknumber(cc.decode_us));
+    if (cc.unmarshal_us >= 0)
+    {
+        json_append_member(chunk, "unmarshal_us",
+                           json_mknumber(cc.unmarshal_us));
+    }
+    if (!cc.error.empty())
+        json_append_member(chunk, "error", json_mkstring(cc.error.c_str()));
+    return chunk;
+}
+
+static JsonNode *_save_json(const save_check &sc)
+{
+    JsonNode *save(json_mkobject());
+    json_append_member(save, "file", json_mkstring(sc.file.c_str()));
+    json_append_member(save, "size", json_mknumber(sc.size));
+    json_append_member(save, "slack", json_mknumber(sc.slack));
+    json_append_member(save, "fsck_us", json_mknumber(sc.fsck_us));
+    if (!sc.error.empty())
+        json_append_member(save, "error", json_mkstring(sc.error.c_str()));
+
+    JsonNode *chunks(json_mkarray());
+    for (const chunk_check &cc : sc.chunks)
+        json_append_element(chunks, _chunk_json(cc));
+    json_append_member(save, "chunks", chunks);
+    return save;
+}
+
+static JsonNode *_types_json(const vector<save_check> &saves)
+{
+    map<string, type_totals> totals;
+    for (const save_check &sc : saves)
+        for (const chunk_check &cc : sc.chunks)
+        {
+            type_totals &t = totals[_chunk_type(cc.name)];
+            t.count++;
+            t.failures += !cc.error.empty();
+            t.compressed += cc.compressed;
+            t.size += cc.size;
+            t.decode_us += cc.decode_us;
+            t.unmarshal_us += max(cc.unmarshal_us, 0.0);
+        }
+
+    JsonNode *types(json_mkobject());
+    for (const auto &entry : totals)
+    {
+        JsonNode *type(json_mkobject());
+        json_append_member(type, "count", json_mknumber(entry.second.count));
+        json_append_member(type, "failures",
+                           json_mknumber(entry.second.failures));
+        json_append_member(type, "compressed",
+                           json_mknumber(entry.second.compressed));
+        json_append_member(type, "size", json_mknumber(entry.second.size));
+        json_append_member(type, "decode_us",
+                           json_mknumber(entry.second.decode_us));
+        json_append_member(type, "unmarshal_us",
+                           json_mknumber(entry.second.unmarshal_us));
+        json_append_member(types, entry.first.c_str(), type);
+    }
+    return types;
+}
+
+/**
+ * Check every save in a directory.
+ *
+ * @param dir     The directory; subdirectories aren't searched.
+ * @param threads How many saves to decode at once; 0 for one per processor.
+ * @return A JSON object of the form
+ *         @code
+ *           { "saves": [...], "types": {...}, "failures": <n>,
+ *             "threads": <n>, "decode_us": <t>, "unmarshal_us": <t> }
+ *         @endcode
+ *         Each save lists its size, slack, fsck time, error (if the save
+ *         as a whole couldn't be checked) and chunks; each chunk its name,
+ *         type, codec, compressed and decoded sizes, fragments, timings and
+ *         error, if any. Types total the chunks of all saves by type.
+ */
+string verify_saves(const string &dir, int threads)
+{
+    vector<string> files = get_dir_files_ext(dir, SAVE_SUFFIX);
+    sort(files.begin(), files.end());
+    vector<save_check> saves(files.size());
+    for (size_t i = 0; i < files.size(); ++i)
+        saves[i].file = catpath(dir, files[i]);
+
+    if (threads <= 0)
+        threads = cpu_count();
+    threads = max<int>(min<size_t>(threads, saves.size()), 1);
+
+    auto start = check_clock::now();
+    decode_queue queue;
+    queue.saves = &saves;
+    queue.next = 0;
+    vector<thread_t> pool;
+    for (int i = 1; i < threads; ++i)
+    {
+        thread_t th;
+        if (thread_create_joinable(&th, _decode_thread, &queue))
+            break;
+        pool.push_back(th);
+    }
+    _decode_thread(&queue);
+    for (thread_t &th : pool)
+        thread_join(th);
+    const double decode_us = _us_since(start);
+
+    start = check_clock::now();
+    for (save_check &sc : saves)
+        if (sc.error.empty())
+            _unmarshal_save(sc);
+    const double unmarshal_us = _us_since(start);
+
+    int failures = 0;
+    for (const save_check &sc : saves)
+    {
+        bool failed = !sc.error.empty();
+        for (const chunk_check &cc : sc.chunks)
+            failed = failed || !cc.error.empty();
+        failures += failed;
+    }
+
+    JsonWrapper json(json_mkobject());
+    JsonNode *save_array(json_mkarray());
+    for (const save_check &sc : saves)
+        json_append_element(save_array, _save_json(sc));
+    json_append_member(json.node, "saves", save_array);
+    json_append_member(json.node, "types", _types_json(saves));
+    json_append_member(json.node, "failures", json_mknumber(failures));
+    json_append_member(json.node, "threads",
+                       json_mknumber(pool.size() + 1));
+    json_append_member(json.node, "decode_us", json_mknumber(decode_us));
+    json_append_member(json.node, "unmarshal_us",
+                       json_mknumber(unmarshal_us));
+    return json.to_string();
+}
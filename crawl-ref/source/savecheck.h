@@ -0,0 +1,10 @@
+/**
+ * @file
+ * @brief Batch verification of save files.
+**/
+
+#pragma once
+
+#include <string>
+
+string verify_saves(const string &dir, int threads = 0);
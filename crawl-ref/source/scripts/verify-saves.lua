@@ -0,0 +1,19 @@
+-- Checks every save in a directory: the package structure, every chunk's
+-- compression, and the player and every level through the save readers.
+-- Writes a JSON report of failures, timings and sizes per chunk type.
+
+local args = script.simple_args()
+if #args < 1 or #args > 3 then
+  script.usage([[
+Usage: verify-saves <save directory> [<report file>] [<threads>]
+  The report goes to verify-saves.json by default. Saves are decoded by one
+  thread per processor unless <threads> says otherwise.]])
+end
+
+local save_dir = args[1]
+local output_file = args[2] or "verify-saves.json"
+local threads = tonumber(args[3])
+
+local report = debug.verify_saves(save_dir, threads)
+file.writefile(output_file, report)
+crawl.mpr("Wrote the save report to " .. output_file)
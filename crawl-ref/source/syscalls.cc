@@ -118,6 +118,18 @@ bool read_urandom(char *buf, int len)
 #endif
 }
 
+// The number of processors available, for sizing pools of worker threads.
+int cpu_count()
+{
+#ifdef TARGET_OS_WINDOWS
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    return max<int>(info.dwNumberOfProcessors, 1);
+#else
+    return max<long>(sysconf(_SC_NPROCESSORS_ONLN), 1);
+#endif
+}
+
 #ifdef TARGET_OS_WINDOWS
 # ifndef UNIX
 // should check the presence of alarm() instead
@@ -13,6 +13,7 @@ bool lock_file(int fd, bool write, bool wait = false);
 bool unlock_file(int fd);
 
 bool read_urandom(char *buf, int len);
+int cpu_count();
 
 #ifdef TARGET_OS_WINDOWS
 # ifndef UNIX
@@ -239,6 +239,9 @@ enum tag_minor_version
     TAG_MINOR_DUNGEON_SHORTENING,  // Shortening the dungeon also lots of clean-up and restoring the ability to drop items down shafts
     TAG_MINOR_MANGROVE_MUSHROOM,   // Allowing Mangroves outside of Swamp and Giant Mushrooms outside of slime.
     TAG_MINOR_MOUNTS,              // Adding a mount to player.h
+    TAG_MINOR_BULK_GRIDS,          // Level grids marshalled as whole blocks
+    TAG_MINOR_LAZY_MAP_ITEMS,      // Remembered items saved apart from their map cells
+    TAG_MINOR_TRAVEL_TARGET_DISTANCES, // Save interlevel travel's target distance cache
 #endif
     NUM_TAG_MINORS,
     TAG_MINOR_VERSION = NUM_TAG_MINORS - 1
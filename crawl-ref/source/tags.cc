@@ -16,6 +16,7 @@
 #include "tags.h"
 
 #include <algorithm>
+#include <chrono>
 #include <cstdio>
 #include <cstdlib>
 #include <cstring>
@@ -65,6 +66,7 @@
  #include "mon-util.h"
 #endif
 #include "mutation.h"
+#include "pcg.h"
 #include "place.h"
 #include "player-stats.h"
 #include "prompt.h" // index_to_letter
@@ -336,7 +338,8 @@ static void unmarshallSpells(reader &, monster_spells &
 
 static void marshallMonsterInfo (writer &, const monster_info &);
 static void unmarshallMonsterInfo (reader &, monster_info &mi);
-static void marshallMapCell (writer &, const map_cell &);
+static void marshallMapCell (writer &, const map_cell &,
+                             bool with_item = true);
 static void unmarshallMapCell (reader &, map_cell& cell);
 
 template<typename T, typename T_iter, typename T_marshal>
@@ -770,6 +773,150 @@ static void _run_length_decode(reader &th, unmarshall um, grid &g,
     }
 }
 
+// Block format: the number of values, the number of encoded bytes, then a
+// sequence of control bytes. A control byte below 0x80 is followed by that
+// many plus one literal values, otherwise by a single value that repeats
+// (control & 0x7f) + 2 times. Values are stored in network order.
+static const size_t BLOCK_MAX_LITERALS = 0x80;
+static const size_t BLOCK_MAX_REPEAT   = 0x7f + 2;
+// Shorter runs are cheaper to leave inside a literal sequence.
+static const size_t BLOCK_MIN_REPEAT   = 3;
+
+template <typename T>
+static void _put_block_value(vector<uint8_t> &out, T value)
+{
+    for (int shift = (sizeof(T) - 1) * 8; shift >= 0; shift -= 8)
+        out.push_back((value >> shift) & 0xff);
+}
+
+template <typename T>
+static T _get_block_value(const uint8_t *&in)
+{
+    T value = 0;
+    for (size_t i = 0; i < sizeof(T); ++i)
+        value = static_cast<T>((value << 8) | *in++);
+    return value;
+}
+
+template <typename T>
+static void _marshall_block(writer &th, const T *data, size_t count)
+{
+    vector<uint8_t> out;
+    out.reserve(count / 4 + 16);
+
+    size_t i = 0;
+    while (i < count)
+    {
+        size_t run = 1;
+        while (i + run < count && run < BLOCK_MAX_REPEAT
+               && data[i + run] == data[i])
+        {
+            ++run;
+        }
+
+        if (run >= BLOCK_MIN_REPEAT)
+        {
+            out.push_back(0x80 | (run - 2));
+            _put_block_value(out, data[i]);
+            i += run;
+            continue;
+        }
+
+        // Take literals up to the start of the next run worth repeating.
+        size_t end = i + run;
+        while (end < count && end - i < BLOCK_MAX_LITERALS
+               && !(end + 2 < count && data[end] == data[end + 1]
+                    && data[end] == data[end + 2]))
+        {
+            ++end;
+        }
+        out.push_back(end - i - 1);
+        for (; i < end; ++i)
+            _put_block_value(out, data[i]);
+    }
+
+    marshallInt(th, count);
+    marshallInt(th, out.size());
+    th.write(out.data(), out.size());
+}
+
+template <typename T>
+static void _unmarshall_block(reader &th, T *data, size_t count)
+{
+    const size_t stored = static_cast<uint32_t>(unmarshallInt(th));
+    if (stored != count)
+        corrupted("Block of %u values where %u were expected",
+                  (unsigned int)stored, (unsigned int)count);
+
+    // Even a block of nothing but single literals can't be bigger.
+    const size_t len = static_cast<uint32_t>(unmarshallInt(th));
+    if (len > count * (sizeof(T) + 1))
+        corrupted("Block of %u values has %u bytes",
+                  (unsigned int)count, (unsigned int)len);
+
+    vector<uint8_t> buf(len);
+    th.read(buf.data(), len);
+
+    const uint8_t *in = buf.data();
+    const uint8_t *const end = in + len;
+    size_t i = 0;
+    while (in < end)
+    {
+        const uint8_t control = *in++;
+        const bool repeat = control & 0x80;
+        const size_t n = repeat ? (control & 0x7f) + 2 : control + 1;
+        const size_t need = repeat ? sizeof(T) : n * sizeof(T);
+        if (n > count - i || need > static_cast<size_t>(end - in))
+            corrupted("Block of %u values overruns", (unsigned int)count);
+
+        if (repeat)
+        {
+            const T value = _get_block_value<T>(in);
+            fill(data + i, data + i + n, value);
+            i += n;
+        }
+        else
+        {
+            for (const size_t last = i + n; i < last; ++i)
+                data[i] = _get_block_value<T>(in);
+        }
+    }
+
+    if (i != count)
+        corrupted("Block has %u of %u values", (unsigned int)i,
+                  (unsigned int)count);
+}
+
+void marshall_block(writer &th, const uint8_t *data, size_t count)
+{
+    _marshall_block(th, data, count);
+}
+
+void marshall_block(writer &th, const uint16_t *data, size_t count)
+{
+    _marshall_block(th, data, count);
+}
+
+void marshall_block(writer &th, const uint32_t *data, size_t count)
+{
+    _marshall_block(th, data, count);
+}
+
+void unmarshall_block(reader &th, uint8_t *data, size_t count)
+{
+    _unmarshall_block(th, data, count);
+}
+
+void unmarshall_block(reader &th, uint16_t *data, size_t count)
+{
+    _unmarshall_block(th, data, count);
+}
+
+void unmarshall_block(reader &th, uint32_t *data, size_t count)
+{
+    _unmarshall_block(th, data, count);
+}
+
 union float_marshall_kludge
 {
     float    f_num;
@@ -4493,24 +4640,131 @@ static int _last_used_index(const Z &thinglist, int max_things)
 
 // ------------------------------- level tags ---------------------------- //
 
-static void tag_construct_level(writer &th)
+// Remembered items go after all the map cells, each with its size, so that
+// loading the level can keep them as they are until they're looked at.
+static void _marshall_map_items(writer &th)
 {
-    marshallByte(th, env.floor_colour);
-    marshallByte(th, env.rock_colour);
+    const lazy_map_items *lazy = env.map_knowledge.lazy_items();
+    // Items that were never decoded can be written back unchanged, unless
+    // they came from an older save.
+    const bool reuse = lazy && lazy->minor == TAG_MINOR_VERSION;
 
-    marshallInt(th, you.on_current_level ? you.elapsed_time : env.elapsed_time);
-    marshallCoord(th, you.pos());
+    vector<coord_def> cells;
+    for (int x = 0; x < GXM; x++)
+        for (int y = 0; y < GYM; y++)
+        {
+            const coord_def c(x, y);
+            if (env.map_knowledge.item_pending(c)
+                || env.map_knowledge.peek(c).item())
+            {
+                cells.push_back(c);
+            }
+        }
 
-    // Map grids.
-    // how many X?
-    marshallShort(th, GXM);
-    // how many Y?
-    marshallShort(th, GYM);
+    marshallInt(th, cells.size());
+    vector<unsigned char> buf;
+    for (const coord_def &c : cells)
+    {
+        marshallCoord(th, c);
+        if (reuse && env.map_knowledge.item_pending(c))
+        {
+            const lazy_map_items::record &rec = lazy->records(c);
+            marshallInt(th, rec.size);
+            th.write(&lazy->data[rec.offset], rec.size);
+            continue;
+        }
 
-    marshallInt(th, env.turns_on_level);
+        buf.clear();
+        writer item_th(&buf);
+        marshallItem(item_th, *env.map_knowledge(c).item(), true);
+        marshallInt(th, buf.size());
+        th.write(buf.data(), buf.size());
+    }
+}
 
-    CANARY;
+static unique_ptr<lazy_map_items> _unmarshall_map_items(reader &th)
+{
+    unique_ptr<lazy_map_items> items(new lazy_map_items);
+    items->minor = th.getMinorVersion();
+
+    const int count = unmarshallInt(th);
+    for (int i = 0; i < count; ++i)
+    {
+        const coord_def c = unmarshallCoord(th);
+        const int size = unmarshallInt(th);
+        if (!map_bounds(c) || size <= 0 || items->records(c).size)
+        {
+            corrupted("Bad remembered item at (%d,%d) of size %d",
+                      c.x, c.y, size);
+        }
+
+        lazy_map_items::record &rec = items->records(c);
+        rec.offset = items->data.size();
+        rec.size = size;
+        items->data.resize(rec.offset + size);
+        th.read(&items->data[rec.offset], size);
+
+        ++items->column_left[c.x];
+        ++items->left;
+    }
+    return items;
+}
+
+// Decoding a remembered item the first time its cell is accessed; see
+// map_knowledge_grid in env.h.
+void map_knowledge_grid::decode_item(int x, int y) const
+{
+    lazy_map_items::record &rec = lazy->records[x][y];
+    reader th(lazy->data, lazy->minor);
+    th.advance(rec.offset);
+    item_def item;
+    unmarshallItem(th, item);
+
+    // Keep the flags of the cell as they were saved, as the original
+    // unmarshalling does.
+    map_cell &cell = cells[x][y];
+    const uint32_t flags = cell.flags;
+    cell.set_item(item, false);
+    cell.flags = flags;
+
+    rec.size = 0;
+    --lazy->column_left[x];
+    if (!--lazy->left)
+        lazy.reset();
+}
+
+static void tag_construct_level_grids(writer &th)
+{
+    COMPILE_CHECK(NUM_FEATURES <= 256);
+    marshall_block<uint8_t>(th, env.grid);
+    marshall_block<uint32_t>(th, env.pgrid,
+                             [](const terrain_property_t &prop)
+                             {
+                                 return static_cast<uint32_t>(prop.flags);
+                             });
 
+    for (int count_x = 0; count_x < GXM; count_x++)
+        for (int count_y = 0; count_y < GYM; count_y++)
+        {
+            const coord_def c(count_x, count_y);
+            marshallMapCell(th, env.map_knowledge.peek(c), false);
+        }
+    _marshall_map_items(th);
+
+    marshallBoolean(th, !!env.map_forgotten);
+    if (env.map_forgotten)
+        for (int x = 0; x < GXM; x++)
+            for (int y = 0; y < GYM; y++)
+                marshallMapCell(th, (*env.map_forgotten)[x][y]);
+
+    marshall_block<uint8_t>(th, env.grid_colours);
+}
+
+#if TAG_MAJOR_VERSION == 34
+// The layout from before TAG_MINOR_BULK_GRIDS, only kept for
+// bench_level_grids().
+static void tag_construct_level_grids_per_cell(writer &th)
+{
     for (int count_x = 0; count_x < GXM; count_x++)
         for (int count_y = 0; count_y < GYM; count_y++)
         {
@@ -4526,6 +4780,28 @@ static void tag_construct_level(writer &th)
                 marshallMapCell(th, (*env.map_forgotten)[x][y]);
 
     _run_length_encode(th, marshallByte, env.grid_colours, GXM, GYM);
+}
+#endif
+
+static void tag_construct_level(writer &th)
+{
+    marshallByte(th, env.floor_colour);
+    marshallByte(th, env.rock_colour);
+
+    marshallInt(th, you.on_current_level ? you.elapsed_time : env.elapsed_time);
+    marshallCoord(th, you.pos());
+
+    // Map grids.
+    // how many X?
+    marshallShort(th, GXM);
+    // how many Y?
+    marshallShort(th, GYM);
+
+    marshallInt(th, env.turns_on_level);
+
+    CANARY;
+
+    tag_construct_level_grids(th);
 
     CANARY;
 
@@ -4571,11 +4847,7 @@ static void tag_construct_level(writer &th)
     // Save heightmap, if present.
     marshallByte(th, !!env.heightmap);
     if (env.heightmap)
-    {
-        grid_heightmap &heightmap(*env.heightmap);
-        for (rectangle_iterator ri(0); ri; ++ri)
-            marshallShort(th, heightmap(*ri));
-    }
+        marshall_block<uint16_t>(th, *env.heightmap);
 
     CANARY;
 
@@ -5272,7 +5544,7 @@ void unmarshallItem(reader &th, item_def &item)
 #define MAP_SERIALIZE_CLOUD 0x20
 #define MAP_SERIALIZE_MONSTER 0x40
 
-void marshallMapCell(writer &th, const map_cell &cell)
+void marshallMapCell(writer &th, const map_cell &cell, bool with_item)
 {
     unsigned flags = 0;
 
@@ -5292,7 +5564,7 @@ void marshallMapCell(writer &th, const map_cell &cell)
     if (cell.cloud() != CLOUD_NONE)
         flags |= MAP_SERIALIZE_CLOUD;
 
-    if (cell.item())
+    if (with_item && cell.item())
         flags |= MAP_SERIALIZE_ITEM;
 
     if (cell.monster() != MONS_NO_MONSTER)
@@ -5982,65 +6254,71 @@ void tag_construct_level_tiles(writer &th)
     marshallShort(th, env.tile_default.floor);
     marshallShort(th, env.tile_default.special);
 
-    for (int count_x = 0; count_x < GXM; count_x++)
-        for (int count_y = 0; count_y < GYM; count_y++)
-        {
-            marshallShort(th, env.tile_flv[count_x][count_y].wall_idx);
-            marshallShort(th, env.tile_flv[count_x][count_y].floor_idx);
-            marshallShort(th, env.tile_flv[count_x][count_y].feat_idx);
+#define MARSHALL_FLAVOUR(field) \
+    marshall_block<uint16_t>(th, env.tile_flv, \
+                             [](const tile_flavour &f) { return f.field; })
+    MARSHALL_FLAVOUR(wall_idx);
+    MARSHALL_FLAVOUR(floor_idx);
+    MARSHALL_FLAVOUR(feat_idx);
 
-            marshallShort(th, env.tile_flv[count_x][count_y].wall);
-            marshallShort(th, env.tile_flv[count_x][count_y].floor);
-            marshallShort(th, env.tile_flv[count_x][count_y].feat);
-            marshallShort(th, env.tile_flv[count_x][count_y].special);
-        }
+    MARSHALL_FLAVOUR(wall);
+    MARSHALL_FLAVOUR(floor);
+    MARSHALL_FLAVOUR(feat);
+    MARSHALL_FLAVOUR(special);
+#undef MARSHALL_FLAVOUR
 
     marshallInt(th, TILE_WALL_MAX);
 }
 
-static void tag_read_level(reader &th)
+static void tag_read_level_grids(reader &th)
 {
-    env.floor_colour = unmarshallUByte(th);
-    env.rock_colour  = unmarshallUByte(th);
+    env.map_knowledge.set_lazy_items(nullptr);
+    unique_ptr<lazy_map_items> items;
 
 #if TAG_MAJOR_VERSION == 34
-    if (th.getMinorVersion() < TAG_MINOR_NO_LEVEL_FLAGS)
-        unmarshallInt(th);
+    if (th.getMinorVersion() < TAG_MINOR_BULK_GRIDS)
+    {
+        for (int i = 0; i < GXM; i++)
+            for (int j = 0; j < GYM; j++)
+            {
+                grd[i][j] = unmarshallFeatureType(th);
+                unmarshallMapCell(th, env.map_knowledge[i][j]);
+                env.pgrid[i][j].flags = unmarshallInt(th);
+            }
+    }
+    else
 #endif
-
-    env.elapsed_time = unmarshallInt(th);
-    env.old_player_pos = unmarshallCoord(th);
-    env.absdepth0 = absdungeon_depth(you.where_are_you, you.depth);
-
-    // Map grids.
-    // how many X?
-    const int gx = unmarshallShort(th);
-    // how many Y?
-    const int gy = unmarshallShort(th);
-    ASSERT(gx == GXM);
-    ASSERT(gy == GYM);
-
-    env.turns_on_level = unmarshallInt(th);
-
-    EAT_CANARY;
-
-    env.map_seen.reset();
+    {
+        COMPILE_CHECK(NUM_FEATURES <= 256);
+        const int minor = th.getMinorVersion();
+        unmarshall_block<uint8_t>(th, env.grid,
+                                  [minor](dungeon_feature_type &feat,
+                                          uint8_t v)
+                                  {
+                                      feat = rewrite_feature(
+                                          static_cast<dungeon_feature_type>(v),
+                                          minor);
+                                  });
+        unmarshall_block<uint32_t>(th, env.pgrid,
+                                   [](terrain_property_t &prop, uint32_t flags)
+                                   {
+                                       prop.flags = flags;
+                                   });
+        for (int i = 0; i < GXM; i++)
+            for (int j = 0; j < GYM; j++)
+                unmarshallMapCell(th, env.map_knowledge[i][j]);
 #if TAG_MAJOR_VERSION == 34
-    vector<coord_def> transporters;
+        if (th.getMinorVersion() >= TAG_MINOR_LAZY_MAP_ITEMS)
 #endif
-    for (int i = 0; i < gx; i++)
-        for (int j = 0; j < gy; j++)
+        items = _unmarshall_map_items(th);
+    }
+
+    env.map_seen.reset();
+    for (int i = 0; i < GXM; i++)
+        for (int j = 0; j < GYM; j++)
         {
-            dungeon_feature_type feat = unmarshallFeatureType(th);
-            grd[i][j] = feat;
-            ASSERT(feat < NUM_FEATURES);
+            ASSERT(grd[i][j] < NUM_FEATURES);
 
-#if TAG_MAJOR_VERSION == 34
-            // Save these for potential destination clean up.
-            if (grd[i][j] == DNGN_TRANSPORTER)
-                transporters.push_back(coord_def(i, j));
-#endif
-            unmarshallMapCell(th, env.map_knowledge[i][j]);
             // Fixup positions
             if (env.map_knowledge[i][j].monsterinfo())
                 env.map_knowledge[i][j].monsterinfo()->pos = coord_def(i, j);
@@ -6050,10 +6328,8 @@ static void tag_read_level(reader &th)
             env.map_knowledge[i][j].flags &= ~MAP_VISIBLE_FLAG;
             if (env.map_knowledge[i][j].seen())
                 env.map_seen.set(i, j);
-            env.pgrid[i][j].flags = unmarshallInt(th);
-
-            mgrd[i][j] = NON_MONSTER;
         }
+    env.map_knowledge.set_lazy_items(move(items));
 
 #if TAG_MAJOR_VERSION == 34
     if (th.getMinorVersion() < TAG_MINOR_FORGOTTEN_MAP)
@@ -6071,8 +6347,103 @@ static void tag_read_level(reader &th)
     else
         env.map_forgotten.reset();
 
-    env.grid_colours.init(BLACK);
-    _run_length_decode(th, unmarshallByte, env.grid_colours, GXM, GYM);
+#if TAG_MAJOR_VERSION == 34
+    if (th.getMinorVersion() < TAG_MINOR_BULK_GRIDS)
+    {
+        env.grid_colours.init(BLACK);
+        _run_length_decode(th, unmarshallByte, env.grid_colours, GXM, GYM);
+    }
+    else
+#endif
+    unmarshall_block<uint8_t>(th, env.grid_colours);
+}
+
+// Time writing and reading back the grid section of the current level.
+// Reading back what was just written leaves the level as it was, apart from
+// the visibility flags, which are restored afterwards. As in a real load,
+// reading the block format leaves the remembered items undecoded.
+level_grid_bench bench_level_grids(int iterations)
+{
+    level_grid_bench bench;
+    if (iterations < 1)
+        return bench;
+
+    const MapKnowledge knowledge = env.map_knowledge;
+
+    typedef chrono::steady_clock bench_clock;
+    auto run = [iterations](void (*construct)(writer &), int minor,
+                            double &write_us, double &read_us, size_t &bytes)
+    {
+        bench_clock::duration write_time(0), read_time(0);
+        vector<unsigned char> buf;
+        for (int i = 0; i < iterations; ++i)
+        {
+            buf.clear();
+            writer outf(&buf);
+            bench_clock::time_point start = bench_clock::now();
+            construct(outf);
+            write_time += bench_clock::now() - start;
+
+            reader inf(buf, minor);
+            start = bench_clock::now();
+            tag_read_level_grids(inf);
+            read_time += bench_clock::now() - start;
+        }
+        write_us = chrono::duration<double, micro>(write_time).count()
+                   / iterations;
+        read_us = chrono::duration<double, micro>(read_time).count()
+                  / iterations;
+        bytes = buf.size();
+    };
+
+#if TAG_MAJOR_VERSION == 34
+    run(tag_construct_level_grids_per_cell, TAG_MINOR_BULK_GRIDS - 1,
+        bench.legacy_write_us, bench.legacy_read_us, bench.legacy_bytes);
+#endif
+    run(tag_construct_level_grids, TAG_MINOR_VERSION,
+        bench.bulk_write_us, bench.bulk_read_us, bench.bulk_bytes);
+
+    env.map_knowledge = knowledge;
+    return bench;
+}
+
+static void tag_read_level(reader &th)
+{
+    env.floor_colour = unmarshallUByte(th);
+    env.rock_colour  = unmarshallUByte(th);
+
+#if TAG_MAJOR_VERSION == 34
+    if (th.getMinorVersion() < TAG_MINOR_NO_LEVEL_FLAGS)
+        unmarshallInt(th);
+#endif
+
+    env.elapsed_time = unmarshallInt(th);
+    env.old_player_pos = unmarshallCoord(th);
+    env.absdepth0 = absdungeon_depth(you.where_are_you, you.depth);
+
+    // Map grids.
+    // how many X?
+    const int gx = unmarshallShort(th);
+    // how many Y?
+    const int gy = unmarshallShort(th);
+    ASSERT(gx == GXM);
+    ASSERT(gy == GYM);
+
+    env.turns_on_level = unmarshallInt(th);
+
+    EAT_CANARY;
+
+    tag_read_level_grids(th);
+    mgrd.init(NON_MONSTER);
+
+#if TAG_MAJOR_VERSION == 34
+    // Save these for potential destination clean up.
+    vector<coord_def> transporters;
+    for (int i = 0; i < gx; i++)
+        for (int j = 0; j < gy; j++)
+            if (grd[i][j] == DNGN_TRANSPORTER)
+                transporters.push_back(coord_def(i, j));
+#endif
 
     EAT_CANARY;
 
@@ -6202,8 +6573,15 @@ static void tag_read_level(reader &th)
     {
         env.heightmap.reset(new grid_heightmap);
         grid_heightmap &heightmap(*env.heightmap);
-        for (rectangle_iterator ri(0); ri; ++ri)
-            heightmap(*ri) = unmarshallShort(th);
+#if TAG_MAJOR_VERSION == 34
+        if (th.getMinorVersion() < TAG_MINOR_BULK_GRIDS)
+        {
+            for (rectangle_iterator ri(0); ri; ++ri)
+                heightmap(*ri) = unmarshallShort(th);
+        }
+        else
+#endif
+        unmarshall_block<uint16_t>(th, heightmap);
     }
 
     EAT_CANARY;
@@ -6918,19 +7296,42 @@ void tag_read_level_tiles(reader &th)
     env.tile_default.floor     = unmarshallShort(th);
     env.tile_default.special   = unmarshallShort(th);
 
-    for (int x = 0; x < gx; x++)
-        for (int y = 0; y < gy; y++)
-        {
-            env.tile_flv[x][y].wall_idx  = unmarshallShort(th);
-            env.tile_flv[x][y].floor_idx = unmarshallShort(th);
-            env.tile_flv[x][y].feat_idx  = unmarshallShort(th);
+#if TAG_MAJOR_VERSION == 34
+    if (th.getMinorVersion() < TAG_MINOR_BULK_GRIDS)
+    {
+        for (int x = 0; x < gx; x++)
+            for (int y = 0; y < gy; y++)
+            {
+                env.tile_flv[x][y].wall_idx  = unmarshallShort(th);
+                env.tile_flv[x][y].floor_idx = unmarshallShort(th);
+                env.tile_flv[x][y].feat_idx  = unmarshallShort(th);
+
+                // These get overwritten by _regenerate_tile_flavour
+                env.tile_flv[x][y].wall    = unmarshallShort(th);
+                env.tile_flv[x][y].floor   = unmarshallShort(th);
+                env.tile_flv[x][y].feat    = unmarshallShort(th);
+                env.tile_flv[x][y].special = unmarshallShort(th);
+            }
+    }
+    else
+#endif
+    {
+        ASSERT(gx == GXM);
+        ASSERT(gy == GYM);
+#define UNMARSHALL_FLAVOUR(field) \
+        unmarshall_block<uint16_t>(th, env.tile_flv, \
+                                   [](tile_flavour &f, uint16_t v) { f.field = v; })
+        UNMARSHALL_FLAVOUR(wall_idx);
+        UNMARSHALL_FLAVOUR(floor_idx);
+        UNMARSHALL_FLAVOUR(feat_idx);
 
-            // These get overwritten by _regenerate_tile_flavour
-            env.tile_flv[x][y].wall    = unmarshallShort(th);
-            env.tile_flv[x][y].floor   = unmarshallShort(th);
-            env.tile_flv[x][y].feat    = unmarshallShort(th);
-            env.tile_flv[x][y].special = unmarshallShort(th);
-        }
+        // These get overwritten by _regenerate_tile_flavour
+        UNMARSHALL_FLAVOUR(wall);
+        UNMARSHALL_FLAVOUR(floor);
+        UNMARSHALL_FLAVOUR(feat);
+        UNMARSHALL_FLAVOUR(special);
+#undef UNMARSHALL_FLAVOUR
+    }
 
     _debug_count_tiles();
 
@@ -7279,3 +7680,84 @@ void tag_write_ghosts(writer &th, const vector<ghost_demon> &ghosts)
     global_ghosts = ghosts;
     tag_write(TAG_GHOST, th);
 }
+
+/**
+ * Write the part of the player's and the dungeon's state that building a
+ * level reads and changes, other than the level itself: which uniques,
+ * unrandarts and unique vaults have been placed, the vaults of every level,
+ * the portal entries and the levelgen random number generators.
+ */
+void tag_write_levelgen_state(writer &th)
+{
+    marshallFixedBitVector<NUM_MONSTERS>(th, you.unique_creatures);
+    for (int j = 0; j < MAX_UNRANDARTS; ++j)
+        marshallByte(th, you.unique_items[j]);
+    marshallUByte(th, you.octopus_king_rings);
+    marshallInt(th, you.attribute[ATTR_GOLD_GENERATED]);
+
+    for (int j = 0; j < NUM_BRANCHES; ++j)
+        marshall_level_id(th, brentry[j]);
+
+    marshall_iterator(th, you.uniq_map_tags.begin(), you.uniq_map_tags.end(),
+                      marshallString);
+    marshall_iterator(th, you.uniq_map_names.begin(), you.uniq_map_names.end(),
+                      marshallString);
+    marshall_iterator(th, you.uniq_map_tags_abyss.begin(),
+                        you.uniq_map_tags_abyss.end(), marshallString);
+    marshall_iterator(th, you.uniq_map_names_abyss.begin(),
+                        you.uniq_map_names_abyss.end(), marshallString);
+    marshallMap(th, you.vault_list, marshall_level_id, marshallStringVector);
+
+    for (int j = 0; j < NUM_BRANCHES; ++j)
+    {
+        const branch_type br = static_cast<branch_type>(j);
+        rng::get_generator(rng::get_branch_generator(br))->to_vector()
+            .write(th);
+    }
+}
+
+/// Restore the state written by tag_write_levelgen_state().
+void tag_read_levelgen_state(reader &th)
+{
+    unmarshallFixedBitVector<NUM_MONSTERS>(th, you.unique_creatures);
+    for (int j = 0; j < MAX_UNRANDARTS; ++j)
+    {
+        you.unique_items[j] =
+            static_cast<unique_item_status_type>(unmarshallByte(th));
+    }
+    you.octopus_king_rings = unmarshallUByte(th);
+    you.attribute[ATTR_GOLD_GENERATED] = unmarshallInt(th);
+
+    for (int j = 0; j < NUM_BRANCHES; ++j)
+        brentry[j] = unmarshall_level_id(th);
+
+    typedef pair<string_set::iterator, bool> ssipair;
+    unmarshall_container(th, you.uniq_map_tags,
+                         (ssipair (string_set::*)(const string &))
+                         &string_set::insert,
+                         unmarshallString);
+    unmarshall_container(th, you.uniq_map_names,
+                         (ssipair (string_set::*)(const string &))
+                         &string_set::insert,
+                         unmarshallString);
+    unmarshall_container(th, you.uniq_map_tags_abyss,
+                         (ssipair (string_set::*)(const string &))
+                         &string_set::insert,
+                         unmarshallString);
+    unmarshall_container(th, you.uniq_map_names_abyss,
+                         (ssipair (string_set::*)(const string &))
+                         &string_set::insert,
+                         unmarshallString);
+    you.vault_list.clear();
+    unmarshallMap(th, you.vault_list, unmarshall_level_id,
+                  unmarshallStringVector);
+
+    for (int j = 0; j < NUM_BRANCHES; ++j)
+    {
+        const branch_type br = static_cast<branch_type>(j);
+        CrawlVector state;
+        state.read(th);
+        *rng::get_generator(rng::get_branch_generator(br)) =
+            rng::PcgRNG(state);
+    }
+}
@@ -6,7 +6,9 @@
 #pragma once
 
 #include <cstdio>
+#include <type_traits>
 
+#include "fixedarray.h"
 #include "package.h"
 
 struct show_type;
@@ -89,6 +91,53 @@ void marshall_level_id(writer& th, const level_id& id);
 void marshallUnsigned(writer& th, uint64_t v);
 void marshallSigned(writer& th, int64_t v);
 
+// Block marshalling: the values are stored in network order with runs of
+// equal values collapsed, and the whole block goes out in a single write.
+void marshall_block(writer &th, const uint8_t *data, size_t count);
+void marshall_block(writer &th, const uint16_t *data, size_t count);
+void marshall_block(writer &th, const uint32_t *data, size_t count);
+
+// Marshall every element of a FixedVector as a Stored, after passing it
+// through get.
+template<typename Stored, typename T, int SIZE, typename F>
+void marshall_block(writer &th, const FixedVector<T, SIZE> &vec, F get)
+{
+    vector<Stored> data;
+    data.reserve(SIZE);
+    for (const T &elt : vec)
+        data.push_back(get(elt));
+    marshall_block(th, data.data(), data.size());
+}
+
+template<typename Stored, typename T, int SIZE>
+void marshall_block(writer &th, const FixedVector<T, SIZE> &vec)
+{
+    static_assert(is_trivially_copyable<T>::value, "not a plain value");
+    marshall_block<Stored>(th, vec,
+                           [](const T &elt) { return static_cast<Stored>(elt); });
+}
+
+// Grids are stored column by column, like the cell loops they replace.
+template<typename Stored, typename T, int WIDTH, int HEIGHT, typename F>
+void marshall_block(writer &th, const FixedArray<T, WIDTH, HEIGHT> &grid,
+                    F get)
+{
+    vector<Stored> data;
+    data.reserve(WIDTH * HEIGHT);
+    for (int x = 0; x < WIDTH; ++x)
+        for (const T &elt : grid[x])
+            data.push_back(get(elt));
+    marshall_block(th, data.data(), data.size());
+}
+
+template<typename Stored, typename T, int WIDTH, int HEIGHT>
+void marshall_block(writer &th, const FixedArray<T, WIDTH, HEIGHT> &grid)
+{
+    static_assert(is_trivially_copyable<T>::value, "not a plain value");
+    marshall_block<Stored>(th, grid,
+                           [](const T &elt) { return static_cast<Stored>(elt); });
+}
+
 /* ***********************************************************************
  * reader API
  * *********************************************************************** */
@@ -163,6 +212,49 @@ static inline void unmarshallSigned(reader& th, T& v)
     v = (T)unmarshallSigned(th);
 }
 
+void unmarshall_block(reader &th, uint8_t *data, size_t count);
+void unmarshall_block(reader &th, uint16_t *data, size_t count);
+void unmarshall_block(reader &th, uint32_t *data, size_t count);
+
+// Counterparts of the marshall_block templates: set(elt, value) stores each
+// unmarshalled value.
+template<typename Stored, typename T, int SIZE, typename F>
+void unmarshall_block(reader &th, FixedVector<T, SIZE> &vec, F set)
+{
+    vector<Stored> data(SIZE);
+    unmarshall_block(th, data.data(), data.size());
+    auto in = data.begin();
+    for (T &elt : vec)
+        set(elt, *in++);
+}
+
+template<typename Stored, typename T, int SIZE>
+void unmarshall_block(reader &th, FixedVector<T, SIZE> &vec)
+{
+    static_assert(is_trivially_copyable<T>::value, "not a plain value");
+    unmarshall_block<Stored>(th, vec,
+                             [](T &elt, Stored v) { elt = static_cast<T>(v); });
+}
+
+template<typename Stored, typename T, int WIDTH, int HEIGHT, typename F>
+void unmarshall_block(reader &th, FixedArray<T, WIDTH, HEIGHT> &grid, F set)
+{
+    vector<Stored> data(WIDTH * HEIGHT);
+    unmarshall_block(th, data.data(), data.size());
+    auto in = data.begin();
+    for (int x = 0; x < WIDTH; ++x)
+        for (T &elt : grid[x])
+            set(elt, *in++);
+}
+
+template<typename Stored, typename T, int WIDTH, int HEIGHT>
+void unmarshall_block(reader &th, FixedArray<T, WIDTH, HEIGHT> &grid)
+{
+    static_assert(is_trivially_copyable<T>::value, "not a plain value");
+    unmarshall_block<Stored>(th, grid,
+                             [](T &elt, Stored v) { elt = static_cast<T>(v); });
+}
+
 /* ***********************************************************************
  * Tag interface
  * *********************************************************************** */
@@ -174,8 +266,21 @@ void tag_read_char(reader &th, uint8_t format, uint8_t major, uint8_t minor);
 vector<ghost_demon> tag_read_ghosts(reader &th);
 void tag_write_ghosts(writer &th, const vector<ghost_demon> &ghosts);
 
+void tag_write_levelgen_state(writer &th);
+void tag_read_levelgen_state(reader &th);
+
 /* ***********************************************************************
  * misc
  * *********************************************************************** */
 
 string make_date_string(time_t in_date);
+
+// Timings of the level grid section, in the per-cell format used before
+// TAG_MINOR_BULK_GRIDS and the block format used since.
+struct level_grid_bench
+{
+    double legacy_write_us = 0, legacy_read_us = 0;
+    double bulk_write_us = 0, bulk_read_us = 0;
+    size_t legacy_bytes = 0, bulk_bytes = 0;
+};
+level_grid_bench bench_level_grids(int iterations);
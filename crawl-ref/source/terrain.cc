@@ -13,6 +13,7 @@
 
 #include "areas.h"
 #include "attack.h"
+#include "beam.h"
 #include "branch.h"
 #include "cloud.h"
 #include "coord.h"
@@ -32,6 +33,7 @@
 #include "libutil.h"
 #include "mapmark.h"
 #include "message.h"
+#include "mon-pathfind.h"
 #include "mon-place.h"
 #include "mon-poly.h"
 #include "mon-util.h"
@@ -1248,6 +1250,8 @@ void dungeon_terrain_changed(const coord_def &pos,
     if (grd(pos) == nfeat)
         return;
 
+    invalidate_tracer_cache();
+
     // Grate trap coding.
     if (nfeat == DNGN_GRATE)
     {
@@ -2131,6 +2135,7 @@ void set_terrain_changed(const coord_def p)
     dungeon_events.fire_position_event(DET_FEAT_CHANGE, p);
 
     los_terrain_changed(p);
+    invalidate_pathfind_fields();
 
     for (orth_adjacent_iterator ai(p); ai; ++ai)
         if (actor *act = actor_at(*ai))
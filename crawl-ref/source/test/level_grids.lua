@@ -0,0 +1,34 @@
+-- Check that the level grids survive being written and read back in both
+-- the per-cell and the block format, and report how long each takes.
+
+local eol = string.char(13)
+
+local function grid_snapshot()
+  local cells = { }
+  for x = 0, dgn.GXM - 1 do
+    for y = 0, dgn.GYM - 1 do
+      cells[#cells + 1] = dgn.grid(x, y)
+    end
+  end
+  return cells
+end
+
+local function test_level_grids(place, iterations)
+  test.regenerate_level(place)
+
+  local before = grid_snapshot()
+  local bench = debug.bench_level_grids(iterations)
+  local after = grid_snapshot()
+  for i, feat in ipairs(before) do
+    assert(after[i] == feat, "grid changed by a save round trip at " .. place)
+  end
+
+  crawl.stderr(string.format(
+    "%s: per-cell %.0f/%.0f us (%d bytes), block %.0f/%.0f us (%d bytes)",
+    place, bench.legacy_write_us, bench.legacy_read_us, bench.legacy_bytes,
+    bench.bulk_write_us, bench.bulk_read_us, bench.bulk_bytes) .. eol)
+end
+
+for _, place in ipairs({ "D:1", "D:5", "Lair:1", "Elf:1", "Zot:1" }) do
+  test_level_grids(place, 20)
+end
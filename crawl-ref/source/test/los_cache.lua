@@ -0,0 +1,70 @@
+-- Check that partial invalidation of the cell_see_cell cache after terrain
+-- changes gives the same answers as recomputing everything.
+
+local checks = 0
+
+local function snapshot(cx, cy)
+  local seen = { }
+  for y = -9, 9 do
+    for x = -9, 9 do
+      local px, py = cx + x, cy + y
+      if dgn.in_bounds(px, py) then
+        seen[x .. "," .. y] = los.cell_see_cell(cx, cy, px, py)
+      end
+    end
+  end
+  return seen
+end
+
+local function test_partial_invalidation()
+  you.random_teleport()
+  checks = checks + 1
+  local cx, cy = you.pos()
+
+  -- Fill the cache around us.
+  snapshot(cx, cy)
+
+  -- Toggle a few cells in view between wall and floor.
+  for i = 1, 4 do
+    local px, py = cx + crawl.random_range(-6, 6), cy + crawl.random_range(-6, 6)
+    if dgn.in_bounds(px, py) and (px ~= cx or py ~= cy) then
+      if feat.is_wall(px, py) and not feat.is_permarock(px, py) then
+        dgn.terrain_changed(px, py, "floor")
+      elseif dgn.feature_name(dgn.grid(px, py)) == "floor" then
+        dgn.terrain_changed(px, py, "rock_wall")
+      end
+    end
+  end
+
+  local cached = snapshot(cx, cy)
+  debug.los_changed()
+  local fresh = snapshot(cx, cy)
+  for k, v in pairs(fresh) do
+    assert(cached[k] == v,
+           "stale cell_see_cell entry at offset " .. k .. " from ("
+           .. cx .. "," .. cy .. ") (iter #" .. checks .. ")")
+  end
+end
+
+local function run_los_cache_tests(depth, nlevels, tests_per_level)
+  local place = "D:" .. depth
+  crawl.message("Running LOS cache tests on " .. place)
+  debug.goto_place(place)
+
+  for lev_i = 1, nlevels do
+    debug.flush_map_memory()
+    debug.generate_level()
+    for t_i = 1, tests_per_level do
+      test_partial_invalidation()
+    end
+  end
+end
+
+for depth = 1, dgn.br_depth("D") do
+  run_los_cache_tests(depth, 1, 3)
+end
+
+local stats = los.cache_stats()
+crawl.message("LOS cache: " .. stats.hits .. " hits, " .. stats.misses
+              .. " misses, " .. stats.invalidated_entries
+              .. " entries invalidated")
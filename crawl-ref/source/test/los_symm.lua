@@ -58,6 +58,6 @@ local function run_los_tests(depth, nlevels, tests_per_level)
   end
 end
 
-for depth = 1, 15 do
+for depth = 1, dgn.br_depth("D") do
   run_los_tests(depth, 1, 3)
 end
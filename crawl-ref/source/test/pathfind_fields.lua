@@ -0,0 +1,64 @@
+-- Check that monsters chasing the player along the shared distance fields
+-- take paths as cheap as the ones A* finds for them.
+
+local function place_orcs(count)
+  dgn.dismiss_monsters()
+  local placed = 0
+  for i = 1, count * 20 do
+    if placed >= count then
+      break
+    end
+    local x = crawl.random_range(1, dgn.GXM - 2)
+    local y = crawl.random_range(1, dgn.GYM - 2)
+    if dgn.feature_name(dgn.grid(x, y)) == "floor"
+       and dgn.create_monster(x, y, "orc") then
+      placed = placed + 1
+    end
+  end
+  return placed
+end
+
+local function count_traps()
+  local traps = 0
+  for x = 0, dgn.GXM - 1 do
+    for y = 0, dgn.GYM - 1 do
+      if feat.is_trap(x, y) then
+        traps = traps + 1
+      end
+    end
+  end
+  return traps
+end
+
+local function test_pathfind_fields(place, trap_free)
+  crawl.message("Checking shared pathfinding fields on " .. place)
+  debug.goto_place(place)
+  debug.flush_map_memory()
+  debug.generate_level()
+  if trap_free then
+    assert(count_traps() == 0, place .. " has traps")
+  end
+  you.random_teleport()
+
+  assert(place_orcs(30) > 1, "Could not place orcs on " .. place)
+  local bench = debug.bench_pathfind_fields(1)
+  assert(bench.mismatches == 0,
+         bench.mismatches .. " paths from shared fields differ from A* on "
+           .. place)
+  -- With no traps, all the orcs move alike, so they must share.
+  if trap_free then
+    assert(bench.builds > 0 and bench.hits > 0,
+           "No shared fields were used on " .. place)
+  end
+  return bench.hits
+end
+
+test_pathfind_fields("Temple", true)
+
+-- Orcs that disagree about some trap path on their own, but not all of them
+-- can on every level.
+local hits = 0
+for _, place in ipairs({ "D:3", "Orc:1", "Lair:2", "Elf:1" }) do
+  hits = hits + test_pathfind_fields(place, false)
+end
+assert(hits > 0, "No shared fields were used on levels with traps")
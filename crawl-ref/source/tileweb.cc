@@ -6,6 +6,7 @@
 
 #include <cerrno>
 #include <cstdarg>
+#include <functional>
 
 #include <sys/socket.h>
 #include <sys/time.h>
@@ -78,6 +79,7 @@ TilesFramework tiles;
 TilesFramework::TilesFramework() :
       m_controlled_from_web(false),
       _send_lock(false),
+      m_keyframe_pending(false),
       m_last_ui_state(UI_INIT),
       m_view_loaded(false),
       m_current_view(coord_def(GXM, GYM)),
@@ -88,7 +90,10 @@ TilesFramework::TilesFramework() :
       m_next_flash_colour(BLACK),
       m_need_full_map(true),
       m_text_menu("menu_txt"),
-      m_print_fg(15)
+      m_print_fg(15),
+      m_binary_map(false),
+      m_bin_cell_started(false),
+      m_bin_have_last_cell(false)
 {
     screen_cell_t default_cell;
     default_cell.tile.bg = TILE_FLAG_UNSEEN;
@@ -105,6 +110,15 @@ void TilesFramework::shutdown()
     if (m_sock_name.empty())
         return;
 
+    // Give the receivers a moment to take what's still queued, like the
+    // reason for exiting.
+    _send_backlogs();
+    for (int retries = 100; retries > 0 && _has_backlog(); --retries)
+    {
+        usleep(20 * 1000);
+        _send_backlogs();
+    }
+
     close(m_sock);
     remove(m_sock_name.c_str());
 }
@@ -179,13 +193,23 @@ void TilesFramework::write_message(const char *format, ...)
     m_msg_buf.append(buf);
 }
 
+// How much may be queued for one receiver before it counts as lagging.
+static const size_t MAX_DEST_BACKLOG = 1024 * 1024;
+
+web_destination::web_destination(const sockaddr_un &a)
+    : addr(a), binary_map(false), coalesce(false), queue_start(0),
+      lagging(false), peak_backlog(0), bytes_sent(0), datagrams(0), stalls(0),
+      overflows(0)
+{
+}
+
 void TilesFramework::finish_message()
 {
     if (m_msg_buf.size() == 0)
         return;
 #ifdef DEBUG_WEBSOCKETS
-    const int initial_buf_size = m_msg_buf.size();
-    fprintf(stderr, "websocket: About to send %d bytes.\n", initial_buf_size);
+    fprintf(stderr, "websocket: About to queue %d bytes.\n",
+                                                (int) m_msg_buf.size());
 #endif
 
     if (m_sock_name.empty())
@@ -195,82 +219,163 @@ void TilesFramework::finish_message()
     }
 
     m_msg_buf.append("\n");
-    const char* fragment_start = m_msg_buf.data();
-    const char* data_end = m_msg_buf.data() + m_msg_buf.size();
-    int fragments = 0;
-    while (fragment_start < data_end)
+    for (web_destination &dest : m_dests)
     {
-        int fragment_size = data_end - fragment_start;
-        if (fragment_size > m_max_msg_size)
-            fragment_size = m_max_msg_size;
-        fragments++;
+        if (!_sends_to(dest))
+            continue;
 
-        for (unsigned int i = 0; i < m_dest_addrs.size(); ++i)
+        if (dest.backlog() > 0
+            && dest.backlog() + m_msg_buf.size() > MAX_DEST_BACKLOG)
         {
-            int retries = 30;
-            ssize_t sent = 0;
-            while (sent < fragment_size)
-            {
-                ssize_t retval = sendto(m_sock, fragment_start + sent,
-                    fragment_size - sent, 0, (sockaddr*) &m_dest_addrs[i],
-                    sizeof(sockaddr_un));
-#ifdef DEBUG_WEBSOCKETS
-                fprintf(stderr,
-                            "    trying to send fragment to client %d...", i);
-#endif
-                if (retval <= 0)
-                {
-                    const char *errmsg = retval == 0 ? "No bytes sent"
-                                                     : strerror(errno);
-                    if (--retries <= 0)
-                        die("Socket write error: %s", errmsg);
+            _drop_backlog(dest);
+            continue;
+        }
 
-                    if (retval == 0 || errno == ENOBUFS || errno == EWOULDBLOCK
-                        || errno == EINTR || errno == EAGAIN)
-                    {
-                        // Wait for half a second at first (up to five), then
-                        // try again.
-                        const int sleep_time = retries > 25 ? 2 * 1000
-                                             : retries > 10 ? 500 * 1000
-                                             : 5000 * 1000;
-#ifdef DEBUG_WEBSOCKETS
-                        fprintf(stderr, "failed (%s), sleeping for %dms.\n",
-                                                    errmsg, sleep_time / 1000);
-#endif
-                        usleep(sleep_time);
-                    }
-                    else if (errno == ECONNREFUSED || errno == ENOENT)
-                    {
-                        // the other side is dead
+        dest.queue.append(m_msg_buf);
+        dest.peak_backlog = max(dest.peak_backlog, dest.backlog());
+    }
+    m_msg_buf.clear();
+    m_need_flush = true;
+
+    _send_backlogs();
+}
+
+bool TilesFramework::_sends_to(const web_destination &dest) const
+{
+    if (dest.lagging)
+        return false;
+    return m_resync_dest.empty() || m_resync_dest == dest.addr.sun_path;
+}
+
+// A receiver that has fallen this far behind is better off with a fresh copy
+// of the whole game state than with everything it missed. Only the message it
+// is part way through is kept, so that it can still be parsed.
+void TilesFramework::_drop_backlog(web_destination &dest)
+{
+    size_t keep = dest.queue_start;
+    if (keep > 0 && dest.queue[keep - 1] != '\n')
+        keep = dest.queue.find('\n', keep) + 1;
+    dest.queue.resize(keep);
+    dest.lagging = true;
+    dest.overflows++;
 #ifdef DEBUG_WEBSOCKETS
-                        fprintf(stderr,
-                            "failed (%s), breaking.\n", errmsg);
+    fprintf(stderr, "websocket: %s is lagging, dropped its backlog.\n",
+                                                        dest.addr.sun_path);
 #endif
-                        m_dest_addrs.erase(m_dest_addrs.begin() + i);
-                        i--;
-                        break;
-                    }
-                    else
-                        die("Socket write error: %s", errmsg);
-                }
-                else
-                {
+}
+
+/*
+  Sends each receiver as much of its queue as its socket will take without
+  blocking, in datagrams of up to m_max_msg_size bytes. Receivers that don't
+  coalesce get at most one message per datagram. Receivers that have gone
+  away are dropped.
+ */
+void TilesFramework::_send_backlogs()
+{
+    for (unsigned int i = 0; i < m_dests.size(); ++i)
+    {
+        web_destination &dest = m_dests[i];
+        bool gone = false;
+        while (dest.backlog() > 0)
+        {
+            const char *data = dest.queue.data() + dest.queue_start;
+            size_t size = min<size_t>(dest.backlog(), m_max_msg_size);
+            if (!dest.coalesce)
+            {
+                const char *eol =
+                    static_cast<const char *>(memchr(data, '\n', size));
+                if (eol)
+                    size = eol - data + 1;
+            }
+
+            ssize_t retval = sendto(m_sock, data, size, MSG_DONTWAIT,
+                                    (sockaddr*) &dest.addr,
+                                    sizeof(sockaddr_un));
+            if (retval > 0)
+            {
+                dest.queue_start += retval;
+                dest.bytes_sent += retval;
+                dest.datagrams++;
+            }
+            else if (retval == 0 || errno == ENOBUFS || errno == EWOULDBLOCK
+                     || errno == EINTR || errno == EAGAIN)
+            {
+                // Try again later.
+                dest.stalls++;
+                break;
+            }
+            else if (errno == ECONNREFUSED || errno == ENOENT)
+            {
+                // the other side is dead
 #ifdef DEBUG_WEBSOCKETS
-                    fprintf(stderr, "fragment size %d sent.\n", fragment_size);
+                fprintf(stderr, "websocket: %s is gone (%s).\n",
+                                dest.addr.sun_path, strerror(errno));
 #endif
-                    sent += retval;
-                }
+                gone = true;
+                break;
             }
+            else
+                die("Socket write error: %s", strerror(errno));
         }
 
-        fragment_start += fragment_size;
+        if (gone)
+        {
+            m_dests.erase(m_dests.begin() + i);
+            i--;
+            continue;
+        }
+
+        if (dest.queue_start == dest.queue.size())
+        {
+            dest.queue.clear();
+            dest.queue_start = 0;
+        }
+        else if (dest.queue_start > dest.queue.size() / 2)
+        {
+            dest.queue.erase(0, dest.queue_start);
+            dest.queue_start = 0;
+        }
     }
-    m_msg_buf.clear();
-    m_need_flush = true;
+}
+
+bool TilesFramework::_has_backlog() const
+{
+    for (const web_destination &dest : m_dests)
+        if (dest.backlog() > 0)
+            return true;
+    return false;
+}
+
+// Sends the whole game state to the lagging receivers that have caught up
+// with what was left in their queue.
+void TilesFramework::_resync_lagging()
+{
+    if (_send_lock || !m_resync_dest.empty())
+        return;
+
+    vector<string> ready;
+    for (const web_destination &dest : m_dests)
+        if (dest.lagging && dest.backlog() == 0)
+            ready.push_back(dest.addr.sun_path);
+
+    for (const string &path : ready)
+    {
+        // The state sent below becomes what all further updates are relative
+        // to, so everyone else has to be brought up to date with it first.
+        redraw();
+        flush_messages();
+
+        for (web_destination &dest : m_dests)
+            if (path == dest.addr.sun_path)
+                dest.lagging = false;
+
 #ifdef DEBUG_WEBSOCKETS
-    fprintf(stderr, "websocket: Sent %d bytes in %d fragments.\n",
-                                                initial_buf_size, fragments);
+        fprintf(stderr, "websocket: Resyncing %s.\n", path.c_str());
 #endif
+        unwind_var<string> only(m_resync_dest, path);
+        _send_everything();
+        flush_messages();
+    }
 }
 
 void TilesFramework::send_message(const char *format, ...)
@@ -313,7 +418,7 @@ void TilesFramework::_await_connection()
     if (m_sock_name.empty())
         return;
 
-    while (m_dest_addrs.size() == 0)
+    while (m_dests.empty())
         _receive_control_message();
 }
 
@@ -366,8 +471,16 @@ wint_t TilesFramework::_handle_control_message(sockaddr_un addr, string data)
         JsonWrapper primary = json_find_member(obj.node, "primary");
         primary.check(JSON_BOOL);
 
-        m_dest_addrs.push_back(addr);
         m_controlled_from_web = primary->bool_;
+
+        web_destination dest(addr);
+        JsonWrapper binary_map = json_find_member(obj.node, "binary_map");
+        dest.binary_map = binary_map.node && binary_map->tag == JSON_BOOL
+                          && binary_map->bool_;
+        JsonWrapper coalesce = json_find_member(obj.node, "coalesce");
+        dest.coalesce = coalesce.node && coalesce->tag == JSON_BOOL
+                        && coalesce->bool_;
+        m_dests.push_back(dest);
     }
     else if (msgtype == "key")
     {
@@ -378,10 +491,18 @@ wint_t TilesFramework::_handle_control_message(sockaddr_un addr, string data)
     }
     else if (msgtype == "spectator_joined")
     {
-        flush_messages();
-        _send_everything();
-        flush_messages();
+        JsonWrapper keyframe = json_find_member(obj.node, "keyframe");
+        if (keyframe.node && keyframe->tag == JSON_BOOL && keyframe->bool_)
+            _send_keyframe();
+        else
+        {
+            flush_messages();
+            _send_everything();
+            flush_messages();
+        }
     }
+    else if (msgtype == "keyframe")
+        _send_keyframe();
     else if (msgtype == "menu_scroll")
     {
         JsonWrapper first = json_find_member(obj.node, "first");
@@ -467,11 +588,24 @@ bool TilesFramework::await_input(wint_t& c, bool block)
 
             if (block)
             {
+                if (m_keyframe_pending)
+                    _send_keyframe();
                 tiles.flush_messages();
-                result = select(maxfd + 1, &fds, nullptr, nullptr, nullptr);
+                _send_backlogs();
+                _resync_lagging();
+
+                // Wake up now and then to retry whatever the receivers
+                // couldn't take yet.
+                timeval retry;
+                retry.tv_sec = 0;
+                retry.tv_usec = 20 * 1000;
+                result = select(maxfd + 1, &fds, nullptr, nullptr,
+                                _has_backlog() ? &retry : nullptr);
             }
             else
             {
+                _send_backlogs();
+
                 timeval timeout;
                 timeout.tv_sec = 0;
                 timeout.tv_usec = 0;
@@ -481,7 +615,9 @@ bool TilesFramework::await_input(wint_t& c, bool block)
         }
         while (result == -1 && errno == EINTR);
 
-        if (result == 0)
+        if (result == 0 && block)
+            continue;
+        else if (result == 0)
             return false;
         else if (result > 0)
         {
@@ -514,6 +650,17 @@ bool TilesFramework::await_input(wint_t& c, bool block)
 void TilesFramework::dump()
 {
     fprintf(stderr, "Webtiles message buffer: %s\n", m_msg_buf.c_str());
+    for (const web_destination &dest : m_dests)
+    {
+        fprintf(stderr, "Webtiles receiver %s: %u bytes queued (peak %u), "
+                        "%llu bytes in %u datagrams sent, %u stalls, "
+                        "%u overflows%s\n",
+                dest.addr.sun_path, (unsigned int) dest.backlog(),
+                (unsigned int) dest.peak_backlog,
+                (unsigned long long) dest.bytes_sent, dest.datagrams,
+                dest.stalls, dest.overflows,
+                dest.lagging ? ", lagging" : "");
+    }
     fprintf(stderr, "Webtiles JSON stack:\n");
     for (const JsonFrame &frame : m_json_stack)
     {
@@ -1304,27 +1451,170 @@ void TilesFramework::write_tileidx(tileidx_t t)
         tiles.write_message("[%d,%d]", lo, hi);
 }
 
+static void _append_varint(string &buf, uint64_t value)
+{
+    while (value >= 0x80)
+    {
+        buf.push_back(static_cast<char>((value & 0x7f) | 0x80));
+        value >>= 7;
+    }
+    buf.push_back(static_cast<char>(value));
+}
+
+static void _append_zigzag(string &buf, int value)
+{
+    _append_varint(buf, (static_cast<uint32_t>(value) << 1)
+                        ^ static_cast<uint32_t>(value >> 31));
+}
+
+static string _base64(const string &data)
+{
+    static const char digits[] =
+        "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+    string out;
+    out.reserve((data.size() + 2) / 3 * 4);
+    for (size_t i = 0; i < data.size(); i += 3)
+    {
+        uint32_t n = static_cast<uint8_t>(data[i]) << 16;
+        if (i + 1 < data.size())
+            n |= static_cast<uint8_t>(data[i + 1]) << 8;
+        if (i + 2 < data.size())
+            n |= static_cast<uint8_t>(data[i + 2]);
+        out.push_back(digits[n >> 18 & 63]);
+        out.push_back(digits[n >> 12 & 63]);
+        out.push_back(i + 1 < data.size() ? digits[n >> 6 & 63] : '=');
+        out.push_back(i + 2 < data.size() ? digits[n & 63] : '=');
+    }
+    return out;
+}
+
+// Binary map cells are only sent if everyone receiving them can decode them.
+bool TilesFramework::_use_binary_map() const
+{
+    bool any = false;
+    for (const web_destination &dest : m_dests)
+    {
+        if (!_sends_to(dest))
+            continue;
+        if (!dest.binary_map)
+            return false;
+        any = true;
+    }
+    return any;
+}
+
+void TilesFramework::_bin_cell_begin(const coord_def &pos)
+{
+    m_bin_cell = pos;
+    m_bin_cell_started = false;
+}
+
+void TilesFramework::_bin_cell_end()
+{
+    if (!m_bin_cell_started)
+        return;
+    m_bin_cells.push_back(BCF_END);
+    m_bin_last_cell = m_bin_cell;
+    m_bin_have_last_cell = true;
+}
+
+// Start a field of the current cell, and the cell itself if this is its
+// first field.
+void TilesFramework::_bin_write_field(binary_cell_field field)
+{
+    if (!m_bin_cell_started)
+    {
+        m_bin_cell_started = true;
+        if (!m_bin_have_last_cell
+            || m_bin_cell.x != m_bin_last_cell.x + 1
+            || m_bin_cell.y != m_bin_last_cell.y)
+        {
+            m_bin_cells.push_back(BCF_POS);
+            _append_zigzag(m_bin_cells, m_bin_cell.x);
+            _append_zigzag(m_bin_cells, m_bin_cell.y);
+        }
+    }
+    m_bin_cells.push_back(field);
+}
+
+void TilesFramework::_cell_write_int(binary_cell_field field,
+                                     const string& name, int value)
+{
+    if (m_binary_map)
+    {
+        _bin_write_field(field);
+        _append_zigzag(m_bin_cells, value);
+    }
+    else
+        json_write_int(name, value);
+}
+
+void TilesFramework::_cell_write_bool(binary_cell_field field,
+                                      const string& name, bool value)
+{
+    if (m_binary_map)
+    {
+        _bin_write_field(field);
+        m_bin_cells.push_back(value);
+    }
+    else
+        json_write_bool(name, value);
+}
+
+void TilesFramework::_cell_write_tileidx(binary_cell_field field,
+                                         const string& name, tileidx_t t)
+{
+    if (m_binary_map)
+    {
+        _bin_write_field(field);
+        _append_varint(m_bin_cells, t);
+    }
+    else
+    {
+        json_write_name(name);
+        write_tileidx(t);
+    }
+}
+
+sent_map_cell::sent_map_cell()
+    : feat(DNGN_UNSEEN), mf(MF_UNSEEN), has_monster(false), mon_client_id(0),
+      mon_type(MONS_NO_MONSTER), mon_base_type(MONS_NO_MONSTER),
+      mon_attitude(ATT_HOSTILE), mon_threat(MTHRT_TRIVIAL), mon_name_hash(0),
+      mon_plural_hash(0)
+{
+}
+
 void TilesFramework::_send_cell(const coord_def &gc,
                                 const screen_cell_t &current_sc, const screen_cell_t &next_sc,
-                                const map_cell &current_mc, const map_cell &next_mc,
+                                const sent_map_cell &current_mc, const map_cell &next_mc,
+                                sent_map_cell &sent,
                                 map<uint32_t, coord_def>& new_monster_locs,
                                 bool force_full)
 {
-    if (current_mc.feat() != next_mc.feat())
-        json_write_int("f", next_mc.feat());
+    sent.feat = next_mc.feat();
+    if (current_mc.feat != sent.feat)
+        _cell_write_int(BCF_FEAT, "f", sent.feat);
 
     if (next_mc.monsterinfo())
-        _send_monster(gc, next_mc.monsterinfo(), new_monster_locs, force_full);
-    else if (current_mc.monsterinfo())
+    {
+        _send_monster(gc, next_mc.monsterinfo(), sent, new_monster_locs,
+                      force_full);
+    }
+    else if (current_mc.has_monster)
         json_write_null("mon");
 
-    map_feature mf = get_cell_map_feature(gc);
-    if (get_cell_map_feature(current_mc) != mf)
-        json_write_int("mf", mf);
+    sent.mf = get_cell_map_feature(gc);
+    if (current_mc.mf != sent.mf)
+        _cell_write_int(BCF_MAP_FEATURE, "mf", sent.mf);
 
     // Glyph and colour
     char32_t glyph = next_sc.glyph;
-    if (current_sc.glyph != glyph)
+    if (current_sc.glyph != glyph && m_binary_map)
+    {
+        _bin_write_field(BCF_GLYPH);
+        _append_varint(m_bin_cells, glyph);
+    }
+    else if (current_sc.glyph != glyph)
     {
         char buf[5];
         buf[wctoutf8(buf, glyph)] = 0;
@@ -1335,7 +1625,7 @@ void TilesFramework::_send_cell(const coord_def &gc,
     {
         int col = next_sc.colour;
         col = (_get_brand(col) << 4) | macro_colour(col & 0xF);
-        json_write_int("col", col);
+        _cell_write_int(BCF_COLOUR, "col", col);
     }
 
     json_open_object("t");
@@ -1353,88 +1643,93 @@ void TilesFramework::_send_cell(const coord_def &gc,
         {
             fg_changed = true;
 
-            json_write_name("fg");
-            write_tileidx(next_pc.fg);
+            _cell_write_tileidx(BCF_FG, "fg", next_pc.fg);
             if (fg_idx && fg_idx <= TILE_MAIN_MAX)
-                json_write_int("base", (int) tileidx_known_base_item(fg_idx));
+            {
+                _cell_write_int(BCF_BASE, "base",
+                                (int) tileidx_known_base_item(fg_idx));
+            }
         }
 
         if (next_pc.bg != current_pc.bg)
-        {
-            json_write_name("bg");
-            write_tileidx(next_pc.bg);
-        }
+            _cell_write_tileidx(BCF_BG, "bg", next_pc.bg);
 
         if (next_pc.cloud != current_pc.cloud)
-        {
-            json_write_name("cloud");
-            write_tileidx(next_pc.cloud);
-        }
+            _cell_write_tileidx(BCF_CLOUD, "cloud", next_pc.cloud);
 
         if (next_pc.is_bloody != current_pc.is_bloody)
-            json_write_bool("bloody", next_pc.is_bloody);
+            _cell_write_bool(BCF_BLOODY, "bloody", next_pc.is_bloody);
 
         if (next_pc.old_blood != current_pc.old_blood)
-            json_write_bool("old_blood", next_pc.old_blood);
+            _cell_write_bool(BCF_OLD_BLOOD, "old_blood", next_pc.old_blood);
 
         if (next_pc.is_silenced != current_pc.is_silenced)
-            json_write_bool("silenced", next_pc.is_silenced);
+            _cell_write_bool(BCF_SILENCED, "silenced", next_pc.is_silenced);
 
         if (next_pc.halo != current_pc.halo)
-            json_write_int("halo", next_pc.halo);
+            _cell_write_int(BCF_HALO, "halo", next_pc.halo);
 
         if (next_pc.is_highlighted_summoner
             != current_pc.is_highlighted_summoner)
         {
-            json_write_bool("highlighted_summoner",
-                            next_pc.is_highlighted_summoner);
+            _cell_write_bool(BCF_HIGHLIGHTED_SUMMONER, "highlighted_summoner",
+                             next_pc.is_highlighted_summoner);
         }
 
         if (next_pc.is_moldy != current_pc.is_moldy)
-            json_write_bool("moldy", next_pc.is_moldy);
+            _cell_write_bool(BCF_MOLDY, "moldy", next_pc.is_moldy);
 
         if (next_pc.glowing_mold != current_pc.glowing_mold)
-            json_write_bool("glowing_mold", next_pc.glowing_mold);
+            _cell_write_bool(BCF_GLOWING_MOLD, "glowing_mold", next_pc.glowing_mold);
 
         if (next_pc.is_sanctuary != current_pc.is_sanctuary)
-            json_write_bool("sanctuary", next_pc.is_sanctuary);
+            _cell_write_bool(BCF_SANCTUARY, "sanctuary", next_pc.is_sanctuary);
 
         if (next_pc.is_liquefied != current_pc.is_liquefied)
-            json_write_bool("liquefied", next_pc.is_liquefied);
+            _cell_write_bool(BCF_LIQUEFIED, "liquefied", next_pc.is_liquefied);
 
         if (next_pc.orb_glow != current_pc.orb_glow)
-            json_write_int("orb_glow", next_pc.orb_glow);
+            _cell_write_int(BCF_ORB_GLOW, "orb_glow", next_pc.orb_glow);
 
         if (next_pc.quad_glow != current_pc.quad_glow)
-            json_write_bool("quad_glow", next_pc.quad_glow);
+            _cell_write_bool(BCF_QUAD_GLOW, "quad_glow", next_pc.quad_glow);
 
         if (next_pc.disjunct != current_pc.disjunct)
-            json_write_bool("disjunct", next_pc.disjunct);
+            _cell_write_bool(BCF_DISJUNCT, "disjunct", next_pc.disjunct);
 
         if (next_pc.mangrove_water != current_pc.mangrove_water)
-            json_write_bool("mangrove_water", next_pc.mangrove_water);
+            _cell_write_bool(BCF_MANGROVE_WATER, "mangrove_water", next_pc.mangrove_water);
 
         if (next_pc.mushroom_slime != current_pc.mushroom_slime)
-            json_write_bool("mushroom_slime", next_pc.mushroom_slime);
+            _cell_write_bool(BCF_MUSHROOM_SLIME, "mushroom_slime", next_pc.mushroom_slime);
 
         if (next_pc.awakened_forest != current_pc.awakened_forest)
-            json_write_bool("awakened_forest", next_pc.awakened_forest);
+            _cell_write_bool(BCF_AWAKENED_FOREST, "awakened_forest", next_pc.awakened_forest);
 
         if (next_pc.blood_rotation != current_pc.blood_rotation)
-            json_write_int("blood_rotation", next_pc.blood_rotation);
+            _cell_write_int(BCF_BLOOD_ROTATION, "blood_rotation", next_pc.blood_rotation);
 
         if (next_pc.travel_trail != current_pc.travel_trail)
-            json_write_int("travel_trail", next_pc.travel_trail);
+            _cell_write_int(BCF_TRAVEL_TRAIL, "travel_trail", next_pc.travel_trail);
 
         if (next_pc.flv.floor != current_pc.flv.floor
              || next_pc.flv.special != current_pc.flv.special
              || force_full)
         {
-            json_open_object("flv");
-            json_write_int("f", next_pc.flv.floor);
-            if (next_pc.flv.special)
-                json_write_int("s", next_pc.flv.special);
-            json_close_object();
+            if (m_binary_map)
+            {
+                _bin_write_field(BCF_FLV);
+                _append_varint(m_bin_cells, next_pc.flv.floor);
+                _append_varint(m_bin_cells, next_pc.flv.special);
+            }
+            else
+            {
+                json_open_object("flv");
+                json_write_int("f", next_pc.flv.floor);
+                if (next_pc.flv.special)
+                    json_write_int("s", next_pc.flv.special);
+                json_close_object();
+            }
         }
 
         if (fg_idx >= TILEP_MCACHE_START)
@@ -1527,7 +1822,14 @@ void TilesFramework::_send_cell(const coord_def &gc,
             }
         }
 
-        if (overlays_changed)
+        if (overlays_changed && m_binary_map)
+        {
+            _bin_write_field(BCF_OV);
+            _append_varint(m_bin_cells, next_pc.num_dngn_overlay);
+            for (int i = 0; i < next_pc.num_dngn_overlay; ++i)
+                _append_zigzag(m_bin_cells, next_pc.dngn_overlay[i]);
+        }
+        else if (overlays_changed)
         {
             json_open_array("ov");
             for (int i = 0; i < next_pc.num_dngn_overlay; ++i)
@@ -1615,7 +1917,13 @@ void TilesFramework::_send_map(bool force_full)
     default_cell.tile.bg = TILE_FLAG_UNSEEN;
     default_cell.glyph = ' ';
     default_cell.colour = 7;
-    map_cell default_map_cell;
+
+    const sent_map_cell default_sent_cell;
+    m_sent_map_updates.clear();
+
+    m_binary_map = _use_binary_map();
+    m_bin_cells.clear();
+    m_bin_have_last_cell = false;
 
     coord_def last_gc(0, 0);
     bool send_gc = true;
@@ -1643,8 +1951,12 @@ void TilesFramework::_send_map(bool force_full)
             if (m_origin.equals(-1, -1))
                 m_origin = gc;
 
+            // With binary cells, the JSON only has monsters and dolls, and
+            // always says where it goes.
+            if (m_binary_map)
+                _bin_cell_begin(gc - m_origin);
             json_open_object();
-            if (send_gc
+            if (send_gc || m_binary_map
                 || last_gc.x + 1 != gc.x
                 || last_gc.y != gc.y)
             {
@@ -1655,13 +1967,17 @@ void TilesFramework::_send_map(bool force_full)
 
             const screen_cell_t& sc = force_full ? default_cell
                 : m_current_view(gc);
-            const map_cell& mc = force_full ? default_map_cell
-                : m_current_map_knowledge(gc);
+            const sent_map_cell& mc = force_full ? default_sent_cell
+                : m_sent_map(gc);
+            sent_map_cell sent;
             _send_cell(gc,
                        sc,
                        m_next_view(gc),
-                       mc, env.map_knowledge(gc),
+                       mc, env.map_knowledge(gc), sent,
                        new_monster_locs, force_full);
+            m_sent_map_updates.emplace_back(gc, sent);
+            if (m_binary_map)
+                _bin_cell_end();
 
             if (!json_is_empty())
             {
@@ -1672,6 +1988,10 @@ void TilesFramework::_send_map(bool force_full)
         }
     json_close_array(true);
 
+    if (!m_bin_cells.empty())
+        json_write_string("bin", _base64(m_bin_cells));
+    m_binary_map = false;
+
     json_close_object(true);
 
     finish_message();
@@ -1682,7 +2002,8 @@ void TilesFramework::_send_map(bool force_full)
     if (m_mcache_ref_done)
         _mcache_ref(false);
 
-    m_current_map_knowledge = env.map_knowledge;
+    for (const auto &update : m_sent_map_updates)
+        m_sent_map(update.first) = update.second;
     m_current_view = m_next_view;
 
     _mcache_ref(true);
@@ -1692,6 +2013,7 @@ void TilesFramework::_send_map(bool force_full)
 }
 
 void TilesFramework::_send_monster(const coord_def &gc, const monster_info* m,
+                                   sent_map_cell &sent,
                                    map<uint32_t, coord_def>& new_monster_locs,
                                    bool force_full)
 {
@@ -1703,33 +2025,44 @@ void TilesFramework::_send_monster(const coord_def &gc, const monster_info* m,
         new_monster_locs[m->client_id] = gc;
     }
 
-    const monster_info* last = nullptr;
+    const sent_map_cell* last = nullptr;
     auto it = m_monster_locs.find(m->client_id);
     if (m->client_id == 0 || it == m_monster_locs.end())
     {
-        last = m_current_map_knowledge(gc).monsterinfo();
+        last = &m_sent_map(gc);
 
-        if (last && last->client_id != m->client_id)
+        if (last->has_monster && last->mon_client_id != m->client_id)
             json_treat_as_nonempty(); // Force sending at least the id
     }
     else
     {
-        last = m_current_map_knowledge(it->second).monsterinfo();
+        last = &m_sent_map(it->second);
 
         if (it->second != gc)
             json_treat_as_nonempty(); // As above
     }
 
-    if (last == nullptr)
+    if (!last->has_monster)
         force_full = true;
 
-    if (force_full || (last->full_name() != m->full_name()))
-        json_write_string("name", m->full_name());
+    const string name = m->full_name();
+    const string plural = m->pluralised_name();
+    sent.has_monster = true;
+    sent.mon_client_id = m->client_id;
+    sent.mon_type = m->type;
+    sent.mon_base_type = m->base_type;
+    sent.mon_attitude = m->attitude;
+    sent.mon_threat = m->threat;
+    sent.mon_name_hash = hash<string>()(name);
+    sent.mon_plural_hash = hash<string>()(plural);
 
-    if (force_full || (last->pluralised_name() != m->pluralised_name()))
-        json_write_string("plural", m->pluralised_name());
+    if (force_full || last->mon_name_hash != sent.mon_name_hash)
+        json_write_string("name", name);
 
-    if (force_full || last->type != m->type)
+    if (force_full || last->mon_plural_hash != sent.mon_plural_hash)
+        json_write_string("plural", plural);
+
+    if (force_full || last->mon_type != m->type)
     {
         json_write_int("type", m->type);
 
@@ -1741,13 +2074,13 @@ void TilesFramework::_send_monster(const coord_def &gc, const monster_info* m,
         json_close_object();
     }
 
-    if (force_full || last->attitude != m->attitude)
+    if (force_full || last->mon_attitude != m->attitude)
         json_write_int("att", m->attitude);
 
-    if (force_full || last->base_type != m->base_type)
+    if (force_full || last->mon_base_type != m->base_type)
         json_write_int("btype", m->base_type);
 
-    if (force_full || last->threat != m->threat)
+    if (force_full || last->mon_threat != m->threat)
         json_write_int("threat", m->threat);
 
     // tiebreakers for two monsters with the same custom name
@@ -1847,6 +2180,32 @@ void TilesFramework::_send_messages()
     webtiles_send_messages();
 }
 
+/*
+  Send the whole game state for the server to keep and pass on to new
+  spectators, without it going to everyone already watching. Whatever
+  hasn't been sent yet goes out first, as ordinary updates: everything
+  after the keyframe has to be relative to it. If this is asked for while
+  something else is being sent, it's put off until the next time we wait
+  for input; the server is waiting on the end marker, so it can't just be
+  dropped.
+ */
+void TilesFramework::_send_keyframe()
+{
+    if (_send_lock)
+    {
+        m_keyframe_pending = true;
+        return;
+    }
+    m_keyframe_pending = false;
+
+    redraw();
+    flush_messages();
+
+    send_message("*{\"msg\":\"keyframe_begin\"}");
+    _send_everything();
+    send_message("*{\"msg\":\"keyframe_end\"}");
+}
+
 /*
   Send everything a newly joined spectator needs
  */
@@ -86,6 +86,90 @@ struct player_info
     bool quiver_available;
 };
 
+// What the client was last sent for a map cell: just enough to tell which of
+// its fields have changed, without copying the map_cell and the monster and
+// item info it keeps on the heap. Names are kept as hashes.
+struct sent_map_cell
+{
+    sent_map_cell();
+
+    dungeon_feature_type feat;
+    map_feature mf;
+
+    bool has_monster;
+    uint32_t mon_client_id;
+    monster_type mon_type;
+    monster_type mon_base_type;
+    mon_attitude_type mon_attitude;
+    mon_threat_level_type mon_threat;
+    size_t mon_name_hash;
+    size_t mon_plural_hash;
+};
+
+// A process receiving the game's messages, and what it still has to be sent.
+// Nothing waits for a slow receiver: what its socket won't take yet stays
+// queued and is retried between inputs.
+struct web_destination
+{
+    web_destination(const sockaddr_un &a);
+
+    sockaddr_un addr;
+    bool binary_map;    // decodes binary map cells
+    bool coalesce;      // splits datagrams into messages at newlines
+    string queue;       // unsent bytes, from queue_start on
+    size_t queue_start;
+    bool lagging;       // the queue overflowed; resync once it's drained
+
+    // Backlog statistics, for dump().
+    size_t peak_backlog;
+    uint64_t bytes_sent;
+    unsigned int datagrams;
+    unsigned int stalls;    // sends refused because the receiver was full
+    unsigned int overflows;
+
+    size_t backlog() const { return queue.size() - queue_start; }
+};
+
+// Field tags of the binary encoding of map cells, which the map message sends
+// instead of JSON cells when every receiver asked for it. Each cell is a list
+// of tagged fields ending with BCF_END; it starts with BCF_POS unless it's
+// just right of the previous cell. Numbers are varints, zigzag encoded except
+// for tile indices and glyphs. The decoder is in map_knowledge.js and must be
+// kept in sync.
+enum binary_cell_field
+{
+    BCF_END,
+    BCF_POS,    // x, y
+    BCF_FEAT,
+    BCF_MAP_FEATURE,
+    BCF_GLYPH,
+    BCF_COLOUR,
+    // The rest go in the cell's "t" object.
+    BCF_FG,
+    BCF_BASE,
+    BCF_BG,
+    BCF_CLOUD,
+    BCF_BLOODY,
+    BCF_OLD_BLOOD,
+    BCF_SILENCED,
+    BCF_HALO,
+    BCF_HIGHLIGHTED_SUMMONER,
+    BCF_MOLDY,
+    BCF_GLOWING_MOLD,
+    BCF_SANCTUARY,
+    BCF_LIQUEFIED,
+    BCF_ORB_GLOW,
+    BCF_QUAD_GLOW,
+    BCF_DISJUNCT,
+    BCF_MANGROVE_WATER,
+    BCF_MUSHROOM_SLIME,
+    BCF_AWAKENED_FOREST,
+    BCF_BLOOD_ROTATION,
+    BCF_TRAVEL_TRAIL,
+    BCF_FLV,    // floor, special
+    BCF_OV,     // count, then the overlays
+};
+
 class TilesFramework
 {
 public:
@@ -153,7 +237,7 @@ public:
     void send_message(PRINTF(1, ));
     void flush_messages();
 
-    bool has_receivers() { return !m_dest_addrs.empty(); }
+    bool has_receivers() { return !m_dests.empty(); }
     bool is_controlled_from_web() { return m_controlled_from_web; }
 
     /* Webtiles can receive input both via stdin, and on the
@@ -220,16 +304,25 @@ protected:
     int m_sock;
     int m_max_msg_size;
     string m_msg_buf;
-    vector<sockaddr_un> m_dest_addrs;
+    vector<web_destination> m_dests;
+    // While set, messages only go to the receiver with this socket path.
+    string m_resync_dest;
 
     bool m_controlled_from_web;
     bool m_need_flush;
 
     bool _send_lock; // not thread safe
+    // A keyframe was asked for in the middle of sending something else.
+    bool m_keyframe_pending;
 
     void _await_connection();
     wint_t _handle_control_message(sockaddr_un addr, string data);
     wint_t _receive_control_message();
+    bool _sends_to(const web_destination &dest) const;
+    void _drop_backlog(web_destination &dest);
+    void _send_backlogs();
+    bool _has_backlog() const;
+    void _resync_lagging();
 
     struct JsonFrame
     {
@@ -283,7 +376,10 @@ protected:
     int m_current_flash_colour;
     int m_next_flash_colour;
 
-    FixedArray<map_cell, GXM, GYM> m_current_map_knowledge;
+    FixedArray<sent_map_cell, GXM, GYM> m_sent_map;
+    // The cells sent by the current _send_map(), recorded in m_sent_map
+    // once it is done, since monsters are diffed against where they were.
+    vector<pair<coord_def, sent_map_cell>> m_sent_map_updates;
     map<uint32_t, coord_def> m_monster_locs;
     bool m_need_full_map;
 
@@ -311,18 +407,40 @@ protected:
     void _send_layout();
 
     void _send_everything();
+    void _send_keyframe();
 
     bool m_mcache_ref_done;
     void _mcache_ref(bool inc);
 
     void _send_cursor(cursor_type type);
+
+    // The binary cells of the map message being written.
+    bool m_binary_map;
+    string m_bin_cells;
+    coord_def m_bin_cell;
+    bool m_bin_cell_started;
+    coord_def m_bin_last_cell;
+    bool m_bin_have_last_cell;
+    bool _use_binary_map() const;
+    void _bin_cell_begin(const coord_def &pos);
+    void _bin_cell_end();
+    void _bin_write_field(binary_cell_field field);
+    void _cell_write_int(binary_cell_field field, const string& name,
+                         int value);
+    void _cell_write_bool(binary_cell_field field, const string& name,
+                          bool value);
+    void _cell_write_tileidx(binary_cell_field field, const string& name,
+                             tileidx_t t);
+
     void _send_map(bool force_full = false);
     void _send_cell(const coord_def &gc,
                     const screen_cell_t &current_sc, const screen_cell_t &next_sc,
-                    const map_cell &current_mc, const map_cell &next_mc,
+                    const sent_map_cell &current_mc, const map_cell &next_mc,
+                    sent_map_cell &sent,
                     map<uint32_t, coord_def>& new_monster_locs,
                     bool force_full);
     void _send_monster(const coord_def &gc, const monster_info* m,
+                       sent_map_cell &sent,
                        map<uint32_t, coord_def>& new_monster_locs,
                        bool force_full);
     void _send_player(bool force_full = false);
@@ -15,6 +15,7 @@
 #include <cstdarg>
 #include <cstdio>
 #include <memory>
+#include <queue>
 #include <set>
 #include <sstream>
 
@@ -35,6 +36,7 @@
 #include "format.h"
 #include "god-abil.h"
 #include "god-passive.h"
+#include "hash.h"
 #include "hints.h"
 #include "item-name.h"
 #include "item-prop.h"
@@ -183,6 +185,8 @@ static bool _find_transtravel_square(const level_pos &pos,
 
 static bool _loadlev_populate_stair_distances(const level_pos &target);
 static void _populate_stair_distances(const level_pos &target);
+static vector<stair_info> _target_stair_distances(const coord_def &pos,
+                                                  LevelInfo &li);
 static bool _is_greed_inducing_square(const LevelStashes *ls,
                                       const coord_def &c, bool autopickup);
 static bool _is_travelsafe_square(const coord_def& c,
@@ -195,18 +199,18 @@ static bool _is_travelsafe_square(const coord_def& c,
 //
 static inline bool is_trap(const coord_def& c)
 {
-    return feat_is_trap(env.map_knowledge(c).feat());
+    return feat_is_trap(env.map_knowledge.peek(c).feat());
 }
 
 static inline bool _is_safe_cloud(const coord_def& c)
 {
-    const cloud_type ctype = env.map_knowledge(c).cloud();
+    const cloud_type ctype = env.map_knowledge.peek(c).cloud();
     if (ctype == CLOUD_NONE)
         return true;
 
     // We can also safely run through smoke, or any of our own clouds if
     // following Qazlal.
-    return !is_damaging_cloud(ctype, true, YOU_KILL(env.map_knowledge(c).cloudinfo()->killer));
+    return !is_damaging_cloud(ctype, true, YOU_KILL(env.map_knowledge.peek(c).cloudinfo()->killer));
 }
 
 // Returns an estimate for the time needed to cross this feature.
@@ -230,7 +234,7 @@ static inline int _feature_traverse_cost(dungeon_feature_type feature)
 
 bool is_unknown_stair(const coord_def &p)
 {
-    dungeon_feature_type feat = env.map_knowledge(p).feat();
+    dungeon_feature_type feat = env.map_knowledge.peek(p).feat();
 
     return feat_is_travelable_stair(feat) && !travel_cache.know_stair(p)
            && feat != DNGN_EXIT_DUNGEON;
@@ -245,7 +249,7 @@ bool is_unknown_stair(const coord_def &p)
  **/
 bool is_unknown_transporter(const coord_def &p)
 {
-    dungeon_feature_type feat = env.map_knowledge(p).feat();
+    dungeon_feature_type feat = env.map_knowledge.peek(p).feat();
 
     return feat == DNGN_TRANSPORTER && !travel_cache.know_transporter(p);
 }
@@ -358,7 +362,7 @@ static bool _is_reseedable(const coord_def& c, bool ignore_danger = false)
     if (!ignore_danger && is_excluded(c))
         return true;
 
-    map_cell &cell(env.map_knowledge(c));
+    const map_cell &cell(env.map_knowledge.peek(c));
     const dungeon_feature_type grid = cell.feat();
 
     if (feat_is_wall(grid) || feat_is_tree(grid))
@@ -419,7 +423,7 @@ public:
 
 bool is_stair_exclusion(const coord_def &p)
 {
-    if (feat_stair_direction(env.map_knowledge(p).feat()) == CMD_NO_CMD)
+    if (feat_stair_direction(env.map_knowledge.peek(p).feat()) == CMD_NO_CMD)
         return false;
 
     return get_exclusion_radius(p) == 1;
@@ -441,10 +445,10 @@ static bool _is_travelsafe_square(const coord_def& c, bool ignore_hostile,
                : cell.safe;
     }
 
-    if (!env.map_knowledge(c).known())
+    if (!env.map_knowledge.peek(c).known())
         return false;
 
-    const dungeon_feature_type grid = env.map_knowledge(c).feat();
+    const dungeon_feature_type grid = env.map_knowledge.peek(c).feat();
 
     // Only try pathing through temporary obstructions we remember, not
     // those we can actually see (since the latter are clearly still blockers)
@@ -453,7 +457,7 @@ static bool _is_travelsafe_square(const coord_def& c, bool ignore_hostile,
 
     // Also make note of what's displayed on the level map for
     // plant/fungus checks.
-    const map_cell& levelmap_cell = env.map_knowledge(c);
+    const map_cell& levelmap_cell = env.map_knowledge.peek(c);
 
     // Travel will not voluntarily cross squares blocked by immobile
     // monsters.
@@ -486,7 +490,7 @@ static bool _is_travelsafe_square(const coord_def& c, bool ignore_hostile,
     {
         trap_def trap;
         trap.pos = c;
-        trap.type = env.map_knowledge(c).trap();
+        trap.type = env.map_knowledge.peek(c).trap();
         trap.ammo_qty = 1;
         if (trap.is_safe())
             return true;
@@ -661,7 +665,7 @@ static bool _is_valid_explore_target(const coord_def& where)
 {
     // If a square in LOS is unmapped, it's valid.
     for (radius_iterator ri(where, LOS_DEFAULT, true); ri; ++ri)
-        if (!env.map_knowledge(*ri).seen())
+        if (!env.map_knowledge.peek(*ri).seen())
             return true;
 
     if (you.running == RMODE_EXPLORE_GREEDY)
@@ -1066,7 +1070,7 @@ static void _fill_exclude_radius(const travel_exclude &exc)
 
             if (is_exclude_root(p))
                 travel_point_distance[x][y] = PD_EXCLUDED;
-            else if (is_excluded(p) && env.map_knowledge(p).known())
+            else if (is_excluded(p) && env.map_knowledge.peek(p).known())
                 travel_point_distance[x][y] = PD_EXCLUDED_RADIUS;
         }
 }
@@ -1087,8 +1091,9 @@ travel_pathfind::travel_pathfind()
       need_for_greed(false), autopickup(false),
       unexplored_place(), greedy_place(), unexplored_dist(0), greedy_dist(0),
       refdist(nullptr), reseed_points(), features(nullptr), unreachables(),
-      point_distance(travel_point_distance), points(0), next_iter_points(0),
-      traveled_distance(0), circ_index(0)
+      point_distance(travel_point_distance), expansion_order(nullptr),
+      expansions(0), points(0), next_iter_points(0), traveled_distance(0),
+      circ_index(0)
 {
 }
 
@@ -1136,6 +1141,11 @@ void travel_pathfind::set_distance_grid(travel_distance_grid_t grid)
     point_distance = grid;
 }
 
+void travel_pathfind::set_expansion_order(travel_distance_grid_t grid)
+{
+    expansion_order = grid;
+}
+
 void travel_pathfind::set_feature_vector(vector<coord_def> *feats)
 {
     features = feats;
@@ -1236,6 +1246,9 @@ coord_def travel_pathfind::pathfind(run_mode_type rmode, bool fallback_explore)
     // point_distance will hold the distance of all points from the starting
     // point, i.e. the distance travelled to get there.
     memset(point_distance, 0, sizeof(travel_distance_grid_t));
+    if (expansion_order)
+        memset(expansion_order, 0, sizeof(travel_distance_grid_t));
+    expansions = 0;
 
     if (!in_bounds(start))
         return coord_def();
@@ -1380,7 +1393,7 @@ void travel_pathfind::get_features()
     for (dc.x = X_BOUND_1; dc.x <= X_BOUND_2; ++dc.x)
         for (dc.y = Y_BOUND_1; dc.y <= Y_BOUND_2; ++dc.y)
         {
-            const dungeon_feature_type feature = env.map_knowledge(dc).feat();
+            const dungeon_feature_type feature = env.map_knowledge.peek(dc).feat();
 
             if ((feature != DNGN_FLOOR
                     && !feat_is_water(feature)
@@ -1415,7 +1428,7 @@ bool travel_pathfind::square_slows_movement(const coord_def &c)
     // c is a known (explored) location - we never put unknown points in the
     // circumference vector, so we don't need to examine the map array, just the
     // grid array.
-    const dungeon_feature_type feature = env.map_knowledge(c).feat();
+    const dungeon_feature_type feature = env.map_knowledge.peek(c).feat();
 
     // If this is a feature that'll take time to travel past, we simulate that
     // extra turn by taking this feature next turn, thereby artificially
@@ -1464,7 +1477,7 @@ bool travel_pathfind::path_flood(const coord_def &c, const coord_def &dc)
     if (floodout
         && (runmode == RMODE_EXPLORE || runmode == RMODE_EXPLORE_GREEDY))
     {
-        if (!env.map_knowledge(dc).seen())
+        if (!env.map_knowledge.peek(dc).seen())
         {
             if (ignore_hostile && !player_in_branch(BRANCH_SHOALS))
             {
@@ -1515,7 +1528,7 @@ bool travel_pathfind::path_flood(const coord_def &c, const coord_def &dc)
                     {
                         const coord_def ddc = dc + Compass[dir];
 
-                        if (feat_is_wall(env.map_knowledge(ddc).feat()))
+                        if (feat_is_wall(env.map_knowledge.peek(ddc).feat()))
                             dist -= Options.explore_wall_bias;
                     }
                 }
@@ -1563,7 +1576,7 @@ bool travel_pathfind::path_flood(const coord_def &c, const coord_def &dc)
     // taking this transporter.
     if (!ignore_danger
         && is_excluded(c)
-        && env.map_knowledge(c).feat() == DNGN_TRANSPORTER
+        && env.map_knowledge.peek(c).feat() == DNGN_TRANSPORTER
         // We have to actually take the transporter to go from c to dc.
         && !adjacent(c, dc))
     {
@@ -1626,7 +1639,7 @@ bool travel_pathfind::path_flood(const coord_def &c, const coord_def &dc)
 
         if (features && !ignore_hostile)
         {
-            dungeon_feature_type feature = env.map_knowledge(dc).feat();
+            dungeon_feature_type feature = env.map_knowledge.peek(dc).feat();
 
             if (dc != start
                 && (feature != DNGN_FLOOR
@@ -1687,6 +1700,9 @@ bool travel_pathfind::path_examine_point(const coord_def &c)
     if (point_traverse_delay(c))
         return false;
 
+    if (expansion_order && !ignore_hostile)
+        expansion_order[c.x][c.y] = ++expansions;
+
     bool found_target = false;
 
     // For each point, we look at all surrounding points. Take them orthogonals
@@ -1728,6 +1744,175 @@ bool travel_pathfind::path_examine_point(const coord_def &c)
     return found_target;
 }
 
+// Autoexplore walks towards its target one step at a time, and each step
+// floods outwards from the target until the player is reached. The flood
+// doesn't depend on where the player is, and stops at the first square next
+// to them whose neighbours it looks at, which is the step taken. So as long
+// as nothing travel cares about has changed, the step a fresh flood would
+// find from any square it got to is that square's neighbour looked at first,
+// and it's read off the order instead of flooding again. A change to a
+// square in view or on the way to the target means flooding anew.
+struct explore_flood_cache
+{
+    bool valid = false;
+    level_id level;
+    coord_def target;
+    // The squares the flood looked at, and their neighbours.
+    coord_def tl, br;
+    // From travel_pathfind::set_expansion_order().
+    travel_distance_grid_t order;
+    // The traverse cost of each square between tl and br, negated if the
+    // square isn't travel-safe.
+    FixedArray<int8_t, GXM, GYM> state;
+};
+
+static unique_ptr<explore_flood_cache> explore_flood;
+static travel_distance_grid_t explore_flood_order;
+
+static int _explore_flood_state(const coord_def &c)
+{
+    const int cost = _feature_traverse_cost(env.map_knowledge.peek(c).feat());
+    return _is_travelsafe_square(c) ? cost : -cost;
+}
+
+// Finds the neighbour of pos that the flood looked at first, which is the
+// step a fresh flood would find from pos, and returns when it was looked at;
+// 0 if the flood never got to any.
+static int _explore_flood_step(const explore_flood_cache &flood,
+                               const coord_def &pos, coord_def &step)
+{
+    int best = 0;
+    for (adjacent_iterator ai(pos); ai; ++ai)
+    {
+        const int order = flood.order[ai->x][ai->y];
+        if (order > 0 && (!best || order < best))
+        {
+            best = order;
+            step = *ai;
+        }
+    }
+    return best;
+}
+
+static bool _level_has_transporters()
+{
+    LevelInfo *li = travel_cache.find_level_info(level_id::current());
+    return li && !li->get_transporters().empty();
+}
+
+// Remember the flood in travel_point_distance and explore_flood_order, which
+// found dest as the next step from youpos towards you.running.pos.
+static void _store_explore_flood(const coord_def &dest)
+{
+    if (!explore_flood)
+        explore_flood = make_unique<explore_flood_cache>();
+    explore_flood_cache &flood(*explore_flood);
+
+    // Transporters let the flood jump across the level, and a target that
+    // slows movement can have its distance overwritten during the flood.
+    flood.valid = false;
+    if (dest.origin() || _level_has_transporters()
+        || _feature_traverse_cost(env.map_knowledge.peek(you.running.pos).feat())
+           > 1)
+    {
+        return;
+    }
+
+    // Nor can the order be used if the step was only found once the flood
+    // went through hostile squares.
+    if (explore_flood_order[dest.x][dest.y] <= 0)
+        return;
+
+    flood.level  = level_id::current();
+    flood.target = you.running.pos;
+    memcpy(flood.order, explore_flood_order, sizeof(flood.order));
+
+    flood.tl = flood.br = flood.target;
+    for (rectangle_iterator ri(1); ri; ++ri)
+    {
+        if (!travel_point_distance[ri->x][ri->y])
+            continue;
+
+        flood.tl.x = min(flood.tl.x, ri->x);
+        flood.tl.y = min(flood.tl.y, ri->y);
+        flood.br.x = max(flood.br.x, ri->x);
+        flood.br.y = max(flood.br.y, ri->y);
+    }
+    flood.tl = flood.tl - coord_def(1, 1);
+    flood.br = flood.br + coord_def(1, 1);
+    flood.tl.x = max(flood.tl.x, X_BOUND_1);
+    flood.tl.y = max(flood.tl.y, Y_BOUND_1);
+    flood.br.x = min(flood.br.x, X_BOUND_2);
+    flood.br.y = min(flood.br.y, Y_BOUND_2);
+
+    unwind_bool slime_wall_check(g_Slime_Wall_Check,
+                                 !actor_slime_wall_immune(&you));
+    unwind_slime_wall_precomputer slime_neighbours(g_Slime_Wall_Check);
+    for (rectangle_iterator ri(flood.tl, flood.br); ri; ++ri)
+        flood.state(*ri) = _explore_flood_state(*ri);
+
+    flood.valid = true;
+}
+
+// Read the next step from youpos off the stored flood, if it's still good.
+static bool _explore_flood_move(const coord_def &youpos, coord_def &dest)
+{
+    if (!explore_flood || !explore_flood->valid)
+        return false;
+
+    const explore_flood_cache &flood(*explore_flood);
+    if (flood.level != level_id::current()
+        || flood.target != you.running.pos
+        || youpos == flood.target
+        || _level_has_transporters())
+    {
+        return false;
+    }
+
+    unwind_bool slime_wall_check(g_Slime_Wall_Check,
+                                 !actor_slime_wall_immune(&you));
+    unwind_slime_wall_precomputer slime_neighbours(g_Slime_Wall_Check);
+
+    // Between two steps, what travel makes of a square mostly changes in
+    // view. Squares out of view that got worse only matter if they're on
+    // the way ahead, which is checked below; ones that got better can at
+    // worst make the way found a little longer than it need be.
+    const coord_def view_tl(max(flood.tl.x, youpos.x - LOS_RADIUS),
+                            max(flood.tl.y, youpos.y - LOS_RADIUS));
+    const coord_def view_br(min(flood.br.x, youpos.x + LOS_RADIUS),
+                            min(flood.br.y, youpos.y + LOS_RADIUS));
+    if (view_tl.x <= view_br.x && view_tl.y <= view_br.y)
+    {
+        for (rectangle_iterator ri(view_tl, view_br); ri; ++ri)
+            if (_explore_flood_state(*ri) != flood.state(*ri))
+                return false;
+    }
+
+    coord_def step;
+    const int order = _explore_flood_step(flood, youpos, step);
+    // Let a fresh flood decide what to do about unsafe moves.
+    if (!order || !_is_safe_move(step))
+        return false;
+
+    // Follow the rest of the way to the target. Each square was reached from
+    // the neighbour looked at first, so the order only goes down.
+    coord_def c = step;
+    for (int left = order; c != flood.target; )
+    {
+        if (_explore_flood_state(c) != flood.state(c))
+            return false;
+        coord_def next;
+        const int next_order = _explore_flood_step(flood, c, next);
+        if (!next_order || next_order >= left)
+            return false;
+        left = next_order;
+        c = next;
+    }
+
+    dest = step;
+    return true;
+}
+
 /**
  * Run the travel_pathfind algorithm, either from the given position in
  * floodout mode to populate travel_point_distance relative to that starting
@@ -1764,9 +1949,20 @@ void find_travel_pos(const coord_def& youpos,
 
     run_mode_type rmode = (need_move) ? RMODE_TRAVEL : RMODE_NOT_RUNNING;
 
-    coord_def dest = tp.pathfind(rmode, false);
-    if (dest.origin())
-        dest = tp.pathfind(rmode, true);
+    const bool reuse_flood = need_move && !features
+                             && you.running.is_explore();
+
+    coord_def dest;
+    if (!reuse_flood || !_explore_flood_move(youpos, dest))
+    {
+        if (reuse_flood)
+            tp.set_expansion_order(explore_flood_order);
+        dest = tp.pathfind(rmode, false);
+        if (reuse_flood)
+            _store_explore_flood(dest);
+        if (dest.origin())
+            dest = tp.pathfind(rmode, true);
+    }
     coord_def new_dest = dest;
 
     // We'd either have to travel through a runed door, in which case we'll be
@@ -1795,8 +1991,8 @@ void find_travel_pos(const coord_def& youpos,
         coord_def unseen = coord_def();
         for (adjacent_iterator ai(dest); ai; ++ai)
             if (!you.see_cell(*ai)
-                && (!env.map_knowledge(*ai).seen()
-                    || !feat_is_wall(env.map_knowledge(*ai).feat())))
+                && (!env.map_knowledge.peek(*ai).seen()
+                    || !feat_is_wall(env.map_knowledge.peek(*ai).feat())))
             {
                 unseen = *ai;
                 break;
@@ -1816,7 +2012,7 @@ void find_travel_pos(const coord_def& youpos,
             // previously unseen monster but the same would happen by manual
             // movement, so I don't think we need to worry about this. (jpeg)
             if (!_is_travelsafe_square(new_dest)
-                || !feat_is_traversable_now(env.map_knowledge(new_dest).feat()))
+                || !feat_is_traversable_now(env.map_knowledge.peek(new_dest).feat()))
             {
                 new_dest = dest;
             }
@@ -2786,11 +2982,33 @@ static int _target_distance_from(const coord_def &pos)
     return -1;
 }
 
+// A point in the search for a route to another level: somewhere on level
+// 'id' that can be reached after walking 'distance'.
+struct transtravel_node
+{
+    int distance;
+    level_id id;
+    coord_def pos;
+    // The stair on the player's level this route starts by taking, or the
+    // player's position for the start of the search.
+    coord_def first_stair;
+
+    // priority_queue is a max-heap, and we want the closest node first.
+    bool operator < (const transtravel_node &other) const
+    {
+        return distance > other.distance;
+    }
+};
+
 /*
  * Sets best_stair to the coordinates of the best stair on the player's current
- * level to take to get to the 'target' level. Should be called with 'distance'
- * set to 0, 'stair' set to (you.x_pos, you.y_pos) and 'best_distance' set to
- * -1. 'cur' should be the player's current level.
+ * level to take to get to the 'target' level, and returns the length of that
+ * route, or -1 if there is none. best_stair should be (-1, -1) and
+ * best_level_distance -1 on entry.
+ *
+ * This is a Dijkstra search over (level, position) pairs, starting from the
+ * player's position. Stairs are marked with the distance at which they have
+ * been reached, so every stair is taken at most once per improvement.
  *
  * If best_stair remains unchanged when this function returns, there is no
  * travel-safe path between the player's current level and the target level OR
@@ -2803,127 +3021,142 @@ static int _target_distance_from(const coord_def &pos)
  * This function has undefined behavior when the target position is not
  * traversable.
  */
-static int _find_transtravel_stair(const level_id &cur,
-                                    const level_pos &target,
-                                    int distance,
-                                    // This is actually the current position
-                                    // on cur, not necessarily a stair.
-                                    const coord_def &stair,
-                                    level_id &closest_level,
-                                    int &best_level_distance,
-                                    coord_def &best_stair,
-                                    int search_depth = 0)
-{
-    int local_distance = -1;
-    level_id player_level = level_id::current();
-
-    LevelInfo &li = travel_cache.get_level_info(cur);
-
-    // Have we reached the target level?
-    if (cur == target.id)
-    {
-        // Are we in an exclude? If so, bail out. Unless it is just a stair exclusion.
-        if (is_excluded(stair, li.get_excludes()) && !is_stair_exclusion(stair))
-            return -1;
+static int _find_transtravel_stair(const level_pos &target,
+                                   level_id &closest_level,
+                                   int &best_level_distance,
+                                   coord_def &best_stair)
+{
+    const level_id player_level = level_id::current();
+    int best_distance = -1;
 
-        // If there's no target position on the target level, or we're on the
-        // target, we're home.
-        if (target.pos.x == -1 || target.pos == stair)
-            return distance;
+    priority_queue<transtravel_node> queue;
+    queue.push({ 0, player_level, you.pos(), you.pos() });
+    bool at_start = true;
 
-        // If there *is* a target position, we need to work out our distance
-        // from it.
-        int deltadist = _target_distance_from(stair);
+    while (!queue.empty())
+    {
+        const transtravel_node node = queue.top();
+        queue.pop();
+        const bool start = at_start;
+        at_start = false;
 
-        if (deltadist == -1 && cur == player_level)
-        {
-            // Okay, we don't seem to have a distance available to us, which
-            // means we're either (a) not standing on stairs or (b) whoever
-            // initiated interlevel travel didn't call
-            // _populate_stair_distances. Assuming we're not on stairs, that
-            // situation can arise only if interlevel travel has been triggered
-            // for a location on the same level. If that's the case, we can get
-            // the distance off the travel_point_distance matrix.
-            deltadist = travel_point_distance[target.pos.x][target.pos.y];
-            if (!deltadist && stair != target.pos)
-                deltadist = -1;
-        }
+        // Nothing left can beat the route we already have.
+        if (best_distance != -1 && node.distance >= best_distance)
+            break;
+
+        LevelInfo &li = travel_cache.get_level_info(node.id);
+
+        // this_stair being nullptr is perfectly acceptable at the start, since
+        // the player need not be standing on stairs. Anywhere else, we came
+        // here by stairs, so there certainly *should* be a stair here, and we
+        // can't proceed in any reasonable way without one.
+        stair_info *this_stair = li.get_stair(node.pos);
 
-        if (deltadist != -1)
+        // Have we reached the target level?
+        if (node.id == target.id)
         {
-            local_distance = distance + deltadist;
-
-            // See if this is a degenerate case of interlevel travel:
-            // A degenerate case of interlevel travel decays to normal travel;
-            // we identify this by checking if:
-            // a. The current level is the target level.
-            // b. The target square is reachable from the 'current' square.
-            // c. The current square is where the player is.
-            //
-            // Note that even if this *is* degenerate, interlevel travel may
-            // still be able to find a shorter route, since it can consider
-            // routes that leave and reenter the current level.
-            if (player_level == target.id && stair == you.pos())
-                best_stair = target.pos;
-
-            // The local_distance is already set, but there may actually be
-            // stairs we can take that'll get us to the target faster than the
-            // direct route, so we also try the stairs.
-        }
-    }
+            // Are we in an exclude? If so, give up on this route. Unless it
+            // is just a stair exclusion.
+            if (is_excluded(node.pos, li.get_excludes())
+                && !is_stair_exclusion(node.pos))
+            {
+                continue;
+            }
 
-    vector<stair_info> &stairs = li.get_stairs();
+            // If there's no target position on the target level, or we're on
+            // the target, we're home.
+            if (target.pos.x == -1 || target.pos == node.pos)
+            {
+                best_distance = node.distance;
+                if (!start)
+                    best_stair = node.first_stair;
+                continue;
+            }
 
-    // this_stair being nullptr is perfectly acceptable, since we start with
-    // coords as the player coords, and the player need not be standing on
-    // stairs.
-    stair_info *this_stair = li.get_stair(stair);
+            // If there *is* a target position, we need to work out our
+            // distance from it.
+            int deltadist = _target_distance_from(node.pos);
 
-    if (!this_stair && cur != player_level)
-    {
-        // Whoops, there's no stair in the travel cache for the current
-        // position, and we're not on the player's current level (i.e., there
-        // certainly *should* be a stair here). Since we can't proceed in any
-        // reasonable way, bail out.
-        return local_distance;
-    }
+            if (deltadist == -1 && node.id == player_level)
+            {
+                // Okay, we don't seem to have a distance available to us,
+                // which means we're either (a) not standing on stairs or (b)
+                // whoever initiated interlevel travel didn't call
+                // _populate_stair_distances. Assuming we're not on stairs,
+                // that situation can arise only if interlevel travel has been
+                // triggered for a location on the same level. If that's the
+                // case, we can get the distance off the travel_point_distance
+                // matrix.
+                deltadist = travel_point_distance[target.pos.x][target.pos.y];
+                if (!deltadist && node.pos != target.pos)
+                    deltadist = -1;
+            }
 
-    for (stair_info &si : stairs)
-    {
-        if (stairs_destination_is_excluded(si))
-            continue;
+            if (deltadist != -1
+                && (best_distance == -1
+                    || best_distance > node.distance + deltadist))
+            {
+                best_distance = node.distance + deltadist;
+
+                // A degenerate case of interlevel travel decays to normal
+                // travel: the target square is reachable from where the
+                // player is. Note that even if this *is* degenerate,
+                // interlevel travel may still be able to find a shorter
+                // route, since it can consider routes that leave and reenter
+                // the current level, so we also try the stairs.
+                best_stair = start ? target.pos : node.first_stair;
+            }
+        }
 
-        // Skip placeholders and excluded stairs.
-        if (!si.can_travel() || is_excluded(si.position, li.get_excludes()))
+        if (!this_stair && !start)
             continue;
 
-        int deltadist = li.distance_between(this_stair, &si);
-
-        if (!this_stair)
+        // Reached here already by a shorter route.
+        if (this_stair && this_stair->distance != -1
+            && this_stair->distance < node.distance)
         {
-            deltadist = travel_point_distance[si.position.x][si.position.y];
-            if (!deltadist && you.pos() != si.position)
-                deltadist = -1;
-        }
-        // deltadist == 0 is legal (if this_stair is nullptr), since the player
-        // may be standing on the stairs. If two stairs are disconnected,
-        // deltadist has to be negative.
-        if (deltadist < 0)
             continue;
+        }
 
-        int dist2stair = distance + deltadist;
-        if (si.distance == -1 || si.distance > dist2stair)
+        for (stair_info &si : li.get_stairs())
         {
+            if (stairs_destination_is_excluded(si))
+                continue;
+
+            // Skip placeholders and excluded stairs.
+            if (!si.can_travel() || is_excluded(si.position, li.get_excludes()))
+                continue;
+
+            int deltadist = li.distance_between(this_stair, &si);
+
+            if (!this_stair)
+            {
+                deltadist = travel_point_distance[si.position.x][si.position.y];
+                if (!deltadist && you.pos() != si.position)
+                    deltadist = -1;
+            }
+            // deltadist == 0 is legal (if this_stair is nullptr), since the
+            // player may be standing on the stairs. If two stairs are
+            // disconnected, deltadist has to be negative.
+            if (deltadist < 0)
+                continue;
+
+            int dist2stair = node.distance + deltadist;
+            if (si.distance != -1 && si.distance <= dist2stair)
+                continue;
+
             si.distance = dist2stair;
 
             // Account for the cost of taking the stairs
             dist2stair += 500; // XXX: this seems large?
 
             // Already too expensive? Short-circuit.
-            if (local_distance != -1 && dist2stair >= local_distance)
+            if (best_distance != -1 && dist2stair >= best_distance)
                 continue;
 
             const level_pos &dest = si.destination;
+            const coord_def first_stair = start ? si.position
+                                                : node.first_stair;
 
             // Never use escape hatches as the last leg of the trip, since
             // that will leave the player unable to retrace their path.
@@ -2943,12 +3176,8 @@ static int _find_transtravel_stair(const level_id &cur,
             if (target.pos.x == -1
                 && dest.id == target.id)
             {
-                if (local_distance == -1 || local_distance > dist2stair)
-                {
-                    local_distance = dist2stair;
-                    if (cur == player_level && you.pos() == stair)
-                        best_stair = si.position;
-                }
+                best_distance = dist2stair;
+                best_stair = first_stair;
                 continue;
             }
 
@@ -2977,7 +3206,7 @@ static int _find_transtravel_stair(const level_id &cur,
             // used while exiting from the vestibule.
             if (is_hell_branch(dest.id.branch)
                             && !(is_hell_branch(target.id.branch)
-                                 || is_hell_branch(cur.branch)))
+                                 || is_hell_branch(node.id.branch)))
             {
                 continue;
             }
@@ -2993,55 +3222,69 @@ static int _find_transtravel_stair(const level_id &cur,
                     continue;   // We've already been here.
             }
 #ifdef DEBUG_TRAVEL
-            string indent(search_depth, '.');
-            dprf("%strying stairs at %d,%d, dest is %d depth %d, pos %d,%d",
-                indent.c_str(), si.position.x, si.position.y, dest.id.branch,
+            dprf("trying stairs at %d,%d, dest is %d depth %d, pos %d,%d",
+                si.position.x, si.position.y, dest.id.branch,
                 dest.id.depth, dest.pos.x, dest.pos.y);
 #endif
 
             // Okay, take these stairs and keep going.
-            const int newdist =
-                _find_transtravel_stair(dest.id, target,
-                                        dist2stair, dest.pos, closest_level,
-                                        best_level_distance, best_stair,
-                                        search_depth + 1);
-            if (newdist != -1
-                && (local_distance == -1 || local_distance > newdist))
-            {
-                local_distance = newdist;
-                if (cur == player_level && you.pos() == stair)
-                    best_stair = si.position;
-            }
+            queue.push({ dist2stair, dest.id, dest.pos, first_stair });
         }
     }
-    return local_distance;
+    return best_distance;
 }
 
 static bool _loadlev_populate_stair_distances(const level_pos &target)
 {
+    // Nothing can have changed on the target level since we left it, so if
+    // we worked this out back then, there's no need to load it.
+    const LevelInfo &li = travel_cache.get_level_info(target.id);
+    if (const vector<stair_info> *dists = li.get_target_distances(target.pos))
+    {
+        curr_stairs = *dists;
+        return true;
+    }
+
     level_excursion excursion;
     excursion.go_to(target.id);
     _populate_stair_distances(target);
     return true;
 }
 
-static void _populate_stair_distances(const level_pos &target)
+// Returns the stairs of li, the current level, with their travel distance
+// from pos.
+static vector<stair_info> _target_stair_distances(const coord_def &pos,
+                                                  LevelInfo &li)
 {
-    // Populate travel_point_distance.
-    find_travel_pos(target.pos, nullptr, nullptr, nullptr);
+    // Flood into a grid of our own, so as not to disturb anyone in the middle
+    // of using travel_point_distance.
+    static travel_distance_grid_t target_distance;
+    travel_pathfind tp;
+    tp.set_floodseed(pos);
+    tp.set_distance_grid(target_distance);
+    if (tp.pathfind(RMODE_NOT_RUNNING, false).origin())
+        tp.pathfind(RMODE_NOT_RUNNING, true);
 
-    curr_stairs.clear();
-    for (stair_info si : travel_cache.get_level_info(target.id).get_stairs())
+    vector<stair_info> stairs;
+    for (stair_info si : li.get_stairs())
     {
-        si.distance = travel_point_distance[si.position.x][si.position.y];
-        if (!si.distance && target.pos != si.position
+        si.distance = target_distance[si.position.x][si.position.y];
+        if (!si.distance && pos != si.position
             || si.distance < -1)
         {
             si.distance = -1;
         }
 
-        curr_stairs.push_back(si);
+        stairs.push_back(si);
     }
+    return stairs;
+}
+
+static void _populate_stair_distances(const level_pos &target)
+{
+    LevelInfo &li = travel_cache.get_level_info(target.id);
+    curr_stairs = _target_stair_distances(target.pos, li);
+    li.set_target_distances(target.pos, curr_stairs);
 }
 
 static bool _find_transtravel_square(const level_pos &target, bool verbose)
@@ -3049,7 +3292,6 @@ static bool _find_transtravel_square(const level_pos &target, bool verbose)
     level_id current = level_id::current();
 
     coord_def best_stair(-1, -1);
-    coord_def cur_stair(you.pos());
 
     level_id closest_level;
     int best_level_distance = -1;
@@ -3062,13 +3304,12 @@ static bool _find_transtravel_square(const level_pos &target, bool verbose)
     // behavior is that it will go to the level and then fail.
     const bool maybe_traversable = (target.id != current
                                     || (in_bounds(target.pos)
-                                        && feat_is_traversable_now(env.map_knowledge(target.pos).feat())));
+                                        && feat_is_traversable_now(env.map_knowledge.peek(target.pos).feat())));
 
     if (maybe_traversable)
     {
-        _find_transtravel_stair(current, target,
-                                0, cur_stair, closest_level,
-                                best_level_distance, best_stair);
+        _find_transtravel_stair(target, closest_level, best_level_distance,
+                                best_stair);
         dprf("found stair at %d,%d", best_stair.x, best_stair.y);
     }
     // even without _find_transtravel_stair called, the values are initalized
@@ -3184,7 +3425,7 @@ void start_explore(bool grab_items)
     you.running = (grab_items ? RMODE_EXPLORE_GREEDY : RMODE_EXPLORE);
 
     for (rectangle_iterator ri(0); ri; ++ri)
-        if (env.map_knowledge(*ri).seen())
+        if (env.map_knowledge.peek(*ri).seen())
             env.map_seen.set(*ri);
 
     you.running.pos.reset();
@@ -3409,7 +3650,9 @@ void LevelInfo::update()
     vector<coord_def> stair_positions;
     get_stairs(stair_positions);
 
-    // Make sure our stair list is correct.
+    // Make sure our stair list is correct. This forgets the old distances
+    // between stairs, but they may still be good.
+    vector<short> old_distances(stair_distances);
     correct_stair_list(stair_positions);
 
     sync_all_branch_stairs();
@@ -3419,15 +3662,102 @@ void LevelInfo::update()
     unwind_slime_wall_precomputer slime_wall_neighbours(
         !actor_slime_wall_immune(&you));
     precompute_travel_safety_grid travel_safety_calc;
-    update_stair_distances();
 
     vector<coord_def> transporter_positions;
     get_transporters(transporter_positions);
     correct_transporter_list(transporter_positions);
 
+    // Flooding from every stair is slow, so only do it when something
+    // travel cares about has changed since the last time.
+    const uint32_t hash = travel_knowledge_hash();
+    if (hash != knowledge_hash
+        || old_distances.size() != stair_distances.size())
+    {
+        knowledge_hash = hash;
+        update_stair_distances();
+        target_distances.clear();
+    }
+    else
+        stair_distances.swap(old_distances);
+
     update_daction_counters(this);
 }
 
+// Hashes everything about the current level that the stair distances depend
+// on: what travel makes of each square, and where the stairs and transporters
+// are. Needs the travel safety grid to be precomputed.
+uint32_t LevelInfo::travel_knowledge_hash() const
+{
+    ASSERT(_travel_safe_grid);
+
+    vector<uint8_t> data;
+    data.reserve(GXM * GYM);
+    for (rectangle_iterator ri(1); ri; ++ri)
+    {
+        const cell_travel_safety &ts((*_travel_safe_grid)(*ri));
+        const int cost =
+            _feature_traverse_cost(env.map_knowledge.peek(*ri).feat());
+        data.push_back(ts.safe | ts.safe_if_ignoring_hostile_terrain << 1
+                       | cost << 2);
+    }
+
+    for (const stair_info &si : stairs)
+    {
+        data.push_back(si.position.x);
+        data.push_back(si.position.y);
+    }
+
+    for (const transporter_info &ti : transporters)
+    {
+        data.push_back(ti.position.x);
+        data.push_back(ti.position.y);
+        data.push_back(ti.destination.x);
+        data.push_back(ti.destination.y);
+    }
+
+    // Leave 0 for "not computed yet".
+    return hash32(&data[0], data.size()) | 1;
+}
+
+// Everything about the player that changes where travel will go, so that
+// distances worked out for one form or set of options aren't used for
+// another.
+static uint32_t _player_travel_state()
+{
+    vector<uint8_t> data;
+    data.push_back(ignore_player_traversability);
+    data.push_back(player_likes_water(true));
+    data.push_back(have_passive(passive_t::water_walk));
+    data.push_back(you.permanent_flight());
+    data.push_back(you.religion == GOD_JIYVA);
+    data.push_back(you.species == SP_MERFOLK);
+    data.push_back(actor_slime_wall_immune(&you));
+    data.push_back(you.no_tele(false));
+    for (int feat = 0; feat < NUM_FEATURES; ++feat)
+        data.push_back(forbidden_terrain[feat]);
+    return hash32(&data[0], data.size());
+}
+
+const vector<stair_info> *
+LevelInfo::get_target_distances(const coord_def &pos) const
+{
+    if (target_player_state != _player_travel_state())
+        return nullptr;
+    return map_find(target_distances, pos);
+}
+
+void LevelInfo::set_target_distances(const coord_def &pos,
+                                     const vector<stair_info> &dists)
+{
+    const uint32_t state = _player_travel_state();
+    if (state != target_player_state)
+    {
+        target_distances.clear();
+        target_player_state = state;
+    }
+    target_distances[pos] = dists;
+}
+
 void LevelInfo::set_distance_between_stairs(int a, int b, int dist)
 {
     // Note dist == 0 is illegal because we can't have two stairs on
@@ -3679,7 +4009,7 @@ void LevelInfo::correct_stair_list(const vector<coord_def> &s)
             {
                 si.destination = travel_hell_entry;
             }
-            if (!env.map_knowledge(pos).seen())
+            if (!env.map_knowledge.peek(pos).seen())
                 si.type = stair_info::MAPPED;
 
             // We don't know where on the next level these stairs go to, but
@@ -3688,7 +4018,7 @@ void LevelInfo::correct_stair_list(const vector<coord_def> &s)
             stairs.push_back(si);
         }
         else
-            stairs[found].type = env.map_knowledge(pos).seen() ? stair_info::PHYSICAL : stair_info::MAPPED;
+            stairs[found].type = env.map_knowledge.peek(pos).seen() ? stair_info::PHYSICAL : stair_info::MAPPED;
     }
 
     resize_stair_distances();
@@ -3728,7 +4058,7 @@ void LevelInfo::correct_transporter_list(const vector<coord_def> &t)
         }
 
         transporter_info::transporter_type type =
-            env.map_knowledge(pos).seen() ? transporter_info::PHYSICAL
+            env.map_knowledge.peek(pos).seen() ? transporter_info::PHYSICAL
                                           : transporter_info::MAPPED;
         if (found == -1)
             transporters.push_back(transporter_info(pos, coord_def(), type));
@@ -3767,8 +4097,8 @@ void LevelInfo::get_transporters(vector<coord_def> &tr)
         const dungeon_feature_type feat = grd(*ri);
 
         if (feat == DNGN_TRANSPORTER
-            && (*ri == you.pos() || env.map_knowledge(*ri).known())
-            && env.map_knowledge(*ri).seen())
+            && (*ri == you.pos() || env.map_knowledge.peek(*ri).known())
+            && env.map_knowledge.peek(*ri).seen())
         {
             tr.push_back(*ri);
         }
@@ -3781,9 +4111,9 @@ void LevelInfo::get_stairs(vector<coord_def> &st)
     {
         const dungeon_feature_type feat = grd(*ri);
 
-        if ((*ri == you.pos() || env.map_knowledge(*ri).known())
+        if ((*ri == you.pos() || env.map_knowledge.peek(*ri).known())
             && feat_is_travelable_stair(feat)
-            && (env.map_knowledge(*ri).seen() || !_is_branch_stair(*ri)))
+            && (env.map_knowledge.peek(*ri).seen() || !_is_branch_stair(*ri)))
         {
             st.push_back(*ri);
         }
@@ -3836,6 +4166,17 @@ void LevelInfo::save(writer& outf) const
     marshallByte(outf, NUM_DACTION_COUNTERS);
     for (int i = 0; i < NUM_DACTION_COUNTERS; i++)
         marshallShort(outf, daction_counters[i]);
+
+    marshallInt(outf, knowledge_hash);
+    marshallInt(outf, target_player_state);
+    marshallShort(outf, target_distances.size());
+    for (const auto &entry : target_distances)
+    {
+        marshallCoord(outf, entry.first);
+        marshallShort(outf, entry.second.size());
+        for (const stair_info &si : entry.second)
+            si.save(outf);
+    }
 }
 
 void LevelInfo::load(reader& inf, int minorVersion)
@@ -3887,6 +4228,25 @@ void LevelInfo::load(reader& inf, int minorVersion)
     ASSERT_RANGE(n_count, 0, NUM_DACTION_COUNTERS + 1);
     for (int i = 0; i < n_count; i++)
         daction_counters[i] = unmarshallShort(inf);
+
+    knowledge_hash = 0;
+    target_player_state = 0;
+    target_distances.clear();
+#if TAG_MAJOR_VERSION == 34
+    if (minorVersion < TAG_MINOR_TRAVEL_TARGET_DISTANCES)
+        return;
+#endif
+    knowledge_hash = unmarshallInt(inf);
+    target_player_state = unmarshallInt(inf);
+    const int target_count = unmarshallShort(inf);
+    for (int i = 0; i < target_count; ++i)
+    {
+        vector<stair_info> &dists = target_distances[unmarshallCoord(inf)];
+        const int dist_count = unmarshallShort(inf);
+        dists.resize(dist_count);
+        for (stair_info &si : dists)
+            si.load(inf);
+    }
 }
 
 void LevelInfo::fixup()
@@ -3907,7 +4267,7 @@ void LevelInfo::fixup()
 
 void TravelCache::update_stone_stair(const coord_def &c)
 {
-    if (!env.map_knowledge(c).seen())
+    if (!env.map_knowledge.peek(c).seen())
         return;
     LevelInfo *li = find_level_info(level_id::current());
     if (!li)
@@ -3954,7 +4314,7 @@ void TravelCache::update_transporter(const coord_def &c)
     const dungeon_feature_type feat = grd(c);
     ASSERT(feat == DNGN_TRANSPORTER);
 
-    if (!env.map_knowledge(c).seen())
+    if (!env.map_knowledge.peek(c).seen())
         return;
 
     LevelInfo *li = find_level_info(level_id::current());
@@ -4368,7 +4728,7 @@ void runrest::set_run_check(int index, int dir)
     run_check[index].delta = Compass[dir];
 
     const coord_def p = you.pos() + Compass[dir];
-    run_check[index].grid = _base_feat_type(env.map_knowledge(p).feat());
+    run_check[index].grid = _base_feat_type(env.map_knowledge.peek(p).feat());
 }
 
 bool runrest::check_stop_running()
@@ -4386,7 +4746,7 @@ bool runrest::check_stop_running()
 bool runrest::run_should_stop() const
 {
     const coord_def targ = you.pos() + pos;
-    const map_cell& tcell = env.map_knowledge(targ);
+    const map_cell& tcell = env.map_knowledge.peek(targ);
 
     // XXX: probably this should ignore cosmetic clouds (non-opaque)
     if (tcell.cloud() != CLOUD_NONE
@@ -4415,7 +4775,7 @@ bool runrest::run_should_stop() const
     {
         const coord_def p = you.pos() + run_check[i].delta;
         const dungeon_feature_type feat =
-            _base_feat_type(env.map_knowledge(p).feat());
+            _base_feat_type(env.map_knowledge.peek(p).feat());
 
         if (run_check[i].grid != feat)
             return true;
@@ -4440,7 +4800,7 @@ bool runrest::diag_run_passes_door() const
     for (int dir : diag_dirs)
     {
         const coord_def p = you.pos() + Compass[dir];
-        const auto feat = env.map_knowledge(p).feat();
+        const auto feat = env.map_knowledge.peek(p).feat();
         if (feat_is_door(feat))
             return true;
     }
@@ -4610,7 +4970,7 @@ void explore_discoveries::found_feature(const coord_def &pos,
                 // If any neighbours have been seen (and thus announced)
                 // before, skip. For parts seen for the first time this turn,
                 // announce only the upper leftmost cell.
-                if (feat_is_runed(env.map_knowledge(*ai).feat())
+                if (feat_is_runed(env.map_knowledge.peek(*ai).feat())
                     && (env.map_seen(*ai) || *ai < pos))
                 {
                     return;
@@ -4634,7 +4994,7 @@ void explore_discoveries::found_feature(const coord_def &pos,
                 // If any neighbours have been seen (and thus announced) before,
                 // skip. For parts seen for the first time this turn, announce
                 // only the upper leftmost cell.
-                if (env.map_knowledge(*ai).feat() == DNGN_TRANSPORTER
+                if (env.map_knowledge.peek(*ai).feat() == DNGN_TRANSPORTER
                     && (env.map_seen(*ai) || *ai < pos))
                 {
                     return;
@@ -4906,7 +5266,7 @@ static int _adjacent_cmd(const coord_def &gc, bool force)
         if (force)
         {
             if (feat_is_open_door(grd(gc))
-                && !env.map_knowledge(gc).monsterinfo())
+                && !env.map_knowledge.peek(gc).monsterinfo())
             {
                 cmd += CMD_CLOSE_DOOR_LEFT - CMD_MOVE_LEFT;
             }
@@ -4933,7 +5293,7 @@ int click_travel(const coord_def &gc, bool force)
         && (!is_excluded(you.pos()) || is_stair_exclusion(you.pos()))
         && i_feel_safe(false, false, false, false))
     {
-        map_cell &cell(env.map_knowledge(gc));
+        const map_cell &cell(env.map_knowledge.peek(gc));
         // If there's a monster that would block travel,
         // don't start traveling.
         if (!_monster_blocks_travel(cell.monsterinfo()))
@@ -4969,7 +5329,7 @@ bool check_for_interesting_features()
         const coord_def p(*ri);
 
         // Find just noticed squares.
-        if (env.map_knowledge(p).flags & MAP_SEEN_FLAG
+        if (env.map_knowledge.peek(p).flags & MAP_SEEN_FLAG
             && !env.map_seen(p))
         {
             // Update the shadow map
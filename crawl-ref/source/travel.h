@@ -319,7 +319,9 @@ public:
 // Information on a level that interlevel travel needs.
 struct LevelInfo
 {
-    LevelInfo() : stairs(), excludes(), stair_distances(), id()
+    LevelInfo() : stairs(), excludes(), stair_distances(), id(),
+                  target_distances(), target_player_state(0),
+                  knowledge_hash(0)
     {
         daction_counters.init(0);
     }
@@ -357,6 +359,12 @@ struct LevelInfo
     // or does not exist in our list of stairs, returns 0.
     int distance_between(const stair_info *s1, const stair_info *s2) const;
 
+    // Returns the stairs with their travel distance from the given position,
+    // if known, or nullptr.
+    const vector<stair_info> *get_target_distances(const coord_def &pos) const;
+    void set_target_distances(const coord_def &pos,
+                              const vector<stair_info> &dists);
+
     void update_excludes();
     void update();              // Update LevelInfo to be correct for the
                                 // current level.
@@ -399,11 +407,23 @@ private:
     vector<short> stair_distances;  // Dist between stairs
     level_id id;
 
+    // Distances from travel targets on this level to its stairs, kept when
+    // interlevel travel works them out so that going there again needn't
+    // load the level. Forgotten whenever the stair distances are recomputed,
+    // and only good for the player state they were found with.
+    map<coord_def, vector<stair_info>> target_distances;
+    uint32_t target_player_state;
+
+    // Hash of the map knowledge the stair distances were computed from, or 0
+    // if they haven't been yet.
+    uint32_t knowledge_hash;
+
     friend class TravelCache;
 
 private:
     void create_placeholder_stair(const coord_def &, const level_pos &);
     void resize_stair_distances();
+    uint32_t travel_knowledge_hash() const;
 };
 
 const int TRAVEL_WAYPOINT_COUNT = 10;
@@ -508,6 +528,10 @@ public:
     // Sets the travel_distance_grid_t to use instead of travel_point_distance.
     void set_distance_grid(travel_distance_grid_t distgrid);
 
+    // Number the squares in this grid in the order the first flood looks at
+    // their neighbours, starting from 1; 0 for squares it never gets to.
+    void set_expansion_order(travel_distance_grid_t ordergrid);
+
     // Set feature vector to use; if non-nullptr, also sets annotate_map to true.
     void set_feature_vector(vector<coord_def> *features);
 
@@ -607,6 +631,9 @@ protected:
 
     travel_distance_col *point_distance;
 
+    travel_distance_col *expansion_order;
+    int expansions;
+
     // How many points are we currently considering? We start off with just one
     // point, and spread outwards like a flood-filler.
     int points;
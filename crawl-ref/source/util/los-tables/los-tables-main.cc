@@ -0,0 +1,34 @@
+/**
+ * @file
+ * @brief Writes out the LOS ray tables for builds with LOS_TABLES.
+**/
+
+#include "AppHdr.h"
+
+#include "fake-main.hpp"
+
+#include "los.h"
+#include "los-tables.h"
+
+#ifdef USE_LOS_TABLES
+// Being empty, this makes los.cc cast the rays itself.
+const los_table los_builtin_table = { 0, nullptr, 0, nullptr, 0, nullptr };
+#endif
+
+int main(int argc, char* argv[])
+{
+    if (argc != 2)
+    {
+        fprintf(stderr, "Usage: %s <output file>\n", argv[0]);
+        return 1;
+    }
+
+    FILE *f = fopen(argv[1], "w");
+    if (!f)
+    {
+        perror(argv[1]);
+        return 1;
+    }
+    write_los_tables(f);
+    return fclose(f) ? 1 : 0;
+}
@@ -149,6 +149,16 @@ max_idle_time = 5 * 60 * 60
 
 use_gzip = True
 
+# Ask crawl to send map cells in its compact binary encoding instead of JSON
+# objects. Crawl only uses it while every attached server has asked for it.
+# Off until it's been shown to beat JSON once use_gzip has deflated both;
+# the transfer_stats_interval logs below can be used to compare them.
+binary_map = False
+
+# Log the frames and bytes per second sent to each game's watchers every this
+# many seconds. None logs them only when the game ends.
+transfer_stats_interval = None
+
 # Seconds until stale HTTP connections are closed
 # This needs a patch currently not in mainline tornado.
 http_connection_timeout = None
@@ -7,6 +7,7 @@ import warnings
 from datetime import datetime, timedelta
 from tornado.escape import json_encode
 
+import config
 from config import server_socket_path
 
 class WebtilesSocketConnection(object):
@@ -61,7 +62,9 @@ class WebtilesSocketConnection(object):
 
         msg = json_encode({
                 "msg": "attach",
-                "primary": primary
+                "primary": primary,
+                "binary_map": getattr(config, "binary_map", False),
+                "coalesce": True
                 })
 
         self.open = True
@@ -89,8 +92,11 @@ class WebtilesSocketConnection(object):
         else:
             self.msg_buffer = None
 
+            # Crawl may pack several messages into one datagram.
             if self.message_callback:
-                self.message_callback(data)
+                for msg in data.split("\n"):
+                    if msg:
+                        self.message_callback(msg + "\n")
 
     def send_message(self, data):
         start = datetime.now()
@@ -89,6 +89,9 @@ function ($, comm, map_knowledge, view_data, monster_list, minimap,
         if (data.vgrdc)
             minimap.do_view_center_update(data.vgrdc.x, data.vgrdc.y);
 
+        if (data.bin)
+            map_knowledge.merge_binary(data.bin);
+
         if (data.cells)
             map_knowledge.merge(data.cells);
 
@@ -207,9 +207,152 @@ define(["jquery", "./enums", "./util"], function ($, enums, util) {
         clean_monster_table();
     };
 
+    // The fields of binary cells, by tag: name, type, and whether it goes in
+    // the "t" object. Keep in sync with binary_cell_field in tileweb.h.
+    var binary_fields = [
+        null, // end of cell
+        null, // position
+        ["f", "int"],
+        ["mf", "int"],
+        ["g", "glyph"],
+        ["col", "int"],
+        ["fg", "tile", true],
+        ["base", "int", true],
+        ["bg", "tile", true],
+        ["cloud", "tile", true],
+        ["bloody", "bool", true],
+        ["old_blood", "bool", true],
+        ["silenced", "bool", true],
+        ["halo", "int", true],
+        ["highlighted_summoner", "bool", true],
+        ["moldy", "bool", true],
+        ["glowing_mold", "bool", true],
+        ["sanctuary", "bool", true],
+        ["liquefied", "bool", true],
+        ["orb_glow", "int", true],
+        ["quad_glow", "bool", true],
+        ["disjunct", "bool", true],
+        ["mangrove_water", "bool", true],
+        ["mushroom_slime", "bool", true],
+        ["awakened_forest", "bool", true],
+        ["blood_rotation", "int", true],
+        ["travel_trail", "int", true],
+        ["flv", "flv", true],
+        ["ov", "ov", true],
+    ];
+
+    // Decode the base64 "bin" field of a map message into the same cell
+    // objects the JSON "cells" field has.
+    function decode_binary_cells(data)
+    {
+        var bytes = atob(data);
+        var pos = 0;
+        var cells = [];
+        var x = -1, y = 0;
+
+        function varint()
+        {
+            var value = 0, scale = 1, b;
+            do
+            {
+                b = bytes.charCodeAt(pos++);
+                value += (b & 0x7f) * scale;
+                scale *= 128;
+            } while (b & 0x80);
+            return value;
+        }
+
+        function zigzag()
+        {
+            var value = varint();
+            return value % 2 ? -(value + 1) / 2 : value / 2;
+        }
+
+        // Tile indices are 64 bits; like write_tileidx(), give the high
+        // half separately if it's used.
+        function tileidx()
+        {
+            var lo = 0, hi = 0, shift = 0, b;
+            do
+            {
+                b = bytes.charCodeAt(pos++);
+                var bits = b & 0x7f;
+                if (shift < 32)
+                    lo |= bits << shift;
+                if (shift + 7 > 32)
+                    hi |= shift < 32 ? bits >>> (32 - shift) : bits << (shift - 32);
+                shift += 7;
+            } while (b & 0x80);
+            return hi ? [lo | 0, hi | 0] : lo | 0;
+        }
+
+        function glyph()
+        {
+            var c = varint();
+            if (c < 0x10000)
+                return String.fromCharCode(c);
+            c -= 0x10000;
+            return String.fromCharCode(0xd800 + (c >> 10), 0xdc00 + (c & 0x3ff));
+        }
+
+        while (pos < bytes.length)
+        {
+            var tag = bytes.charCodeAt(pos++);
+            if (tag == 1)
+            {
+                x = zigzag();
+                y = zigzag();
+                tag = bytes.charCodeAt(pos++);
+            }
+            else
+                x++;
+
+            var cell = {x: x, y: y};
+            for (; tag != 0; tag = bytes.charCodeAt(pos++))
+            {
+                var field = binary_fields[tag];
+                var target = cell;
+                if (field[2])
+                    target = cell.t = cell.t || {};
+
+                switch (field[1])
+                {
+                case "int":
+                    target[field[0]] = zigzag();
+                    break;
+                case "bool":
+                    target[field[0]] = bytes.charCodeAt(pos++) != 0;
+                    break;
+                case "tile":
+                    target[field[0]] = tileidx();
+                    break;
+                case "glyph":
+                    target[field[0]] = glyph();
+                    break;
+                case "flv":
+                    var flv = {f: varint()};
+                    var special = varint();
+                    if (special)
+                        flv.s = special;
+                    target.flv = flv;
+                    break;
+                case "ov":
+                    var ov = [];
+                    for (var n = varint(); n > 0; --n)
+                        ov.push(zigzag());
+                    target.ov = ov;
+                    break;
+                }
+            }
+            cells.push(cell);
+        }
+        return cells;
+    }
+
     return {
         get: get,
         merge: merge_diff,
+        merge_binary: function (data) { merge_diff(decode_binary_cells(data)); },
         clear: clear,
         touch: touch,
         visible: visible,
@@ -19,6 +19,10 @@ from inotify import DirectoryWatcher
 
 last_game_id = 0
 
+# Seconds to wait for crawl to send a keyframe it was asked for. Older crawl
+# versions never send one.
+KEYFRAME_TIMEOUT = 10
+
 processes = dict()
 unowned_process_logger = logging.LoggerAdapter(logging.getLogger(), {})
 
@@ -109,6 +113,22 @@ class CrawlProcessHandlerBase(object):
         self._was_idle = False
         self.last_watcher_join = 0
 
+        # What went out to the receivers' websockets, for transfer_stats();
+        # counted by the websockets themselves, see count_frame().
+        self.frames_sent = 0
+        self.bytes_sent = 0
+        self.wire_bytes_sent = 0
+        self._stats_start = time.time()
+        self._stats_mark = (self._stats_start, 0, 0, 0)
+        self._flush_pending = False
+        self.stats_logger = None
+        if getattr(config, "transfer_stats_interval", None):
+            self.stats_logger = PeriodicCallback(
+                self.log_transfer_stats,
+                config.transfer_stats_interval * 1000,
+                io_loop = self.io_loop)
+            self.stats_logger.start()
+
         global last_game_id
         self.id = last_game_id + 1
         last_game_id = self.id
@@ -136,12 +156,49 @@ class CrawlProcessHandlerBase(object):
                 update_all_lobbys(self)
 
     def flush_messages_to_all(self):
+        self._flush_pending = False
         for receiver in self._receivers:
             receiver.flush_messages()
 
+    def count_frame(self, raw_bytes, wire_bytes):
+        """Called by a receiver's websocket for each frame it sends while
+        attached to this game."""
+        self.frames_sent += 1
+        self.bytes_sent += raw_bytes
+        self.wire_bytes_sent += wire_bytes
+
     def write_to_all(self, msg, send):
         for receiver in self._receivers:
-            receiver.write_message(msg, send)
+            receiver.write_message(msg, False)
+        if send and not self._flush_pending:
+            # Send everything that arrives before the io loop comes round
+            # again in a single frame.
+            self._flush_pending = True
+            self.io_loop.add_callback(self.flush_messages_to_all)
+
+    def transfer_stats(self, since_last=True):
+        """Frames and bytes per second sent to the receivers, since the
+        last call or since the game started."""
+        now = time.time()
+        if since_last:
+            start, frames, raw, wire = self._stats_mark
+        else:
+            start, frames, raw, wire = self._stats_start, 0, 0, 0
+        self._stats_mark = (now, self.frames_sent, self.bytes_sent,
+                            self.wire_bytes_sent)
+        elapsed = max(now - start, 0.001)
+        return {
+            "frames_per_s": (self.frames_sent - frames) / elapsed,
+            "bytes_per_s": (self.bytes_sent - raw) / elapsed,
+            "wire_bytes_per_s": (self.wire_bytes_sent - wire) / elapsed,
+            }
+
+    def log_transfer_stats(self, since_last=True):
+        stats = self.transfer_stats(since_last)
+        self.logger.info("Sent %.1f frames/s, %.0f bytes/s "
+                         "(%.0f compressed) to %d receivers.",
+                         stats["frames_per_s"], stats["bytes_per_s"],
+                         stats["wire_bytes_per_s"], len(self._receivers))
 
     def send_to_all(self, msg, **data):
         for receiver in self._receivers:
@@ -243,6 +300,9 @@ class CrawlProcessHandlerBase(object):
             self.kill_timeout = None
 
         self.idle_checker.stop()
+        if self.stats_logger:
+            self.stats_logger.stop()
+        self.log_transfer_stats(False)
 
         for watcher in list(self._receivers):
             if watcher.watched_game == self:
@@ -567,6 +627,18 @@ class CrawlProcessHandler(CrawlProcessHandlerBase):
         self._purging_timer = None
         self._process_hup_timeout = None
 
+        # The last full game state crawl sent, and the messages since. New
+        # watchers get both instead of making crawl resend everything to
+        # everyone.
+        self.keyframe = None
+        self.keyframe_log = []
+        self.keyframe_bytes = 0
+        self.keyframe_log_bytes = 0
+        self.keyframe_requested = False
+        self._keyframe_recording = None
+        self._keyframe_waiting = set()
+        self._keyframe_timeout = None
+
     def start(self):
         self._purge_locks_and_start(True)
 
@@ -740,6 +812,7 @@ class CrawlProcessHandler(CrawlProcessHandlerBase):
 
     def connect(self, socketpath, primary = False):
         self.socketpath = socketpath
+        self._drop_keyframe()
         self.conn = WebtilesSocketConnection(self.io_loop, self.socketpath, self.logger)
         self.conn.message_callback = self._on_socket_message
         self.conn.close_callback = self._on_socket_close
@@ -811,8 +884,78 @@ class CrawlProcessHandler(CrawlProcessHandlerBase):
     def add_watcher(self, watcher):
         super(CrawlProcessHandler, self).add_watcher(watcher)
 
-        if self.conn and self.conn.open:
-            self.conn.send_message('{"msg":"spectator_joined"}')
+        if not (self.conn and self.conn.open):
+            return
+
+        if self.keyframe is not None:
+            self._send_keyframe(watcher)
+        else:
+            self._keyframe_waiting.add(watcher)
+            # Crawl versions that don't know about keyframes take this as a
+            # request to resend everything to everyone, as before.
+            if not self.keyframe_requested:
+                self._request_keyframe(
+                    '{"msg":"spectator_joined","keyframe":true}')
+
+    def remove_watcher(self, watcher):
+        super(CrawlProcessHandler, self).remove_watcher(watcher)
+        self._keyframe_waiting.discard(watcher)
+
+        # Nobody needs the keyframe until someone watches again, so don't
+        # keep logging for it or asking crawl to refresh it.
+        if not any(w.watched_game == self for w in self._receivers):
+            self._drop_keyframe()
+
+    def _drop_keyframe(self):
+        self.keyframe = None
+        self.keyframe_log = []
+        self.keyframe_bytes = 0
+        self.keyframe_log_bytes = 0
+        self._end_keyframe_request()
+
+    def _request_keyframe(self, msg):
+        self.keyframe_requested = True
+        if self._keyframe_timeout is None:
+            self._keyframe_timeout = self.io_loop.add_timeout(
+                time.time() + KEYFRAME_TIMEOUT, self._keyframe_timed_out)
+        self.conn.send_message(msg)
+
+    def _end_keyframe_request(self):
+        if self._keyframe_timeout is not None:
+            self.io_loop.remove_timeout(self._keyframe_timeout)
+            self._keyframe_timeout = None
+        self._keyframe_recording = None
+        self.keyframe_requested = False
+        for watcher in self._keyframe_waiting:
+            watcher.flush_messages()
+        self._keyframe_waiting.clear()
+
+    def _keyframe_timed_out(self):
+        # Watchers still waiting get what there is; a half-recorded keyframe
+        # is thrown away, and the next watcher to join asks again.
+        self._keyframe_timeout = None
+        self.logger.debug("Gave up waiting for a keyframe.")
+        self._end_keyframe_request()
+
+    def _send_keyframe(self, watcher):
+        for msg in self.keyframe:
+            watcher.write_message(msg, False)
+        for msg in self.keyframe_log:
+            watcher.write_message(msg, False)
+        watcher.flush_messages()
+
+    def _log_since_keyframe(self, msg):
+        if self.keyframe is None:
+            return
+        self.keyframe_log.append(msg)
+        self.keyframe_log_bytes += len(msg)
+
+        # Replaying the log shouldn't cost new watchers more than a fresh
+        # keyframe would.
+        if (self.keyframe_log_bytes > max(self.keyframe_bytes, 64 * 1024)
+                and not self.keyframe_requested
+                and self.conn and self.conn.open):
+            self._request_keyframe('{"msg":"keyframe"}')
 
     def handle_input(self, msg):
         obj = json_decode(msg)
@@ -912,6 +1055,18 @@ class CrawlProcessHandler(CrawlProcessHandlerBase):
                         self.send_to_all("dump", url = url)
                     else:
                         self.exit_dump_url = url
+            elif msgobj["msg"] == "keyframe_begin":
+                # Unless we gave up on it, in which case everyone is already
+                # getting everything.
+                if self.keyframe_requested:
+                    self._keyframe_recording = []
+            elif msgobj["msg"] == "keyframe_end":
+                if self._keyframe_recording is not None:
+                    self.keyframe = self._keyframe_recording
+                    self.keyframe_bytes = sum(len(m) for m in self.keyframe)
+                    self.keyframe_log = []
+                    self.keyframe_log_bytes = 0
+                self._end_keyframe_request()
             elif msgobj["msg"] == "exit_reason":
                 self.exit_reason = msgobj["type"]
                 if "message" in msgobj:
@@ -931,7 +1086,14 @@ class CrawlProcessHandler(CrawlProcessHandlerBase):
                 # want that to reset idle time.
                 self.note_activity()
 
-            self.write_to_all(msg, not self.queue_messages)
+            if self._keyframe_recording is not None:
+                # Only the watchers waiting for the keyframe need it.
+                self._keyframe_recording.append(msg)
+                for watcher in self._keyframe_waiting:
+                    watcher.write_message(msg, not self.queue_messages)
+            else:
+                self.write_to_all(msg, not self.queue_messages)
+                self._log_since_keyframe(msg)
 
 
 
@@ -659,10 +659,15 @@ class CrawlWebSocket(tornado.websocket.WebSocketHandler):
                 compressed += self._compressobj.flush(zlib.Z_SYNC_FLUSH)
                 compressed = compressed[:-4]
                 self.compressed_bytes_sent += len(compressed)
+                wire_bytes = len(compressed)
                 super(CrawlWebSocket, self).write_message(compressed, binary=True)
             else:
                 self.uncompressed_bytes_sent += len(msg)
+                wire_bytes = len(msg)
                 super(CrawlWebSocket, self).write_message(msg)
+            game = self.process or self.watched_game
+            if game:
+                game.count_frame(len(msg), wire_bytes)
         except:
             self.logger.warning("Exception trying to send message.", exc_info = True)
             if self.ws_connection != None: